@@ -1,7 +1,11 @@
 #pragma once
 #include "fmt/format.h"
 #include "lexer.hpp"
+#include <functional>
 #include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace ast {
@@ -72,7 +76,9 @@ public:
     virtual void visit(UnaryExpression* node) = 0;
     virtual void visit(BinaryExpression* node) = 0;
 
-    std::vector<Error> getErrors() { return std::vector<Error>(m_errors); }
+    const std::vector<Error>& getErrors() const { return m_errors; }
+    /** Moves the errors out of the visitor, leaving it with none */
+    std::vector<Error> takeErrors() { return std::move(m_errors); }
 
 protected:
     std::vector<Error> m_errors;
@@ -88,7 +94,7 @@ protected:
 };
 
 struct Node {
-    lexer::Token::Position begin, end;
+    lexer::Token::Position begin{}, end{};
     bool operator==(const Node& other) const {
         return begin == other.begin && end == other.end;
     }
@@ -112,6 +118,16 @@ struct RoutineDecl : Node {
     std::vector<sPtr<VariableDecl>> parameters;
     sPtr<Type> returnType;
     sPtr<Body> body;
+    // Set when the parser skipped over the body, which is then parsed by the
+    //  first call to `getBody`
+    std::function<sPtr<Body>()> bodyLoader;
+    const sPtr<Body>& getBody() {
+        if (bodyLoader) {
+            body = bodyLoader();
+            bodyLoader = nullptr;
+        }
+        return body;
+    }
     bool operator==(const RoutineDecl& other) const {
         return Node::operator==(other) && name == other.name &&
                returnType == other.returnType && body == other.body &&
@@ -131,6 +147,10 @@ struct TypeDecl : Node {
 
 struct Type : Node {
     virtual TypeKind getTypeKind() { return TypeKind::Integer; };
+    /** The array type this type is or stands for, nullptr if it is none */
+    virtual ArrayType* asArray() { return nullptr; }
+    /** The record type this type is or stands for, nullptr if it is none */
+    virtual RecordType* asRecord() { return nullptr; }
     virtual void accept(Visitor& v) override = 0;
 };
 
@@ -145,6 +165,12 @@ struct AliasedType : Type {
     }
     void accept(Visitor& v) override { v.visit(this); }
     TypeKind getTypeKind() { return this->actualType->getTypeKind(); }
+    ArrayType* asArray() override {
+        return actualType != nullptr ? actualType->asArray() : nullptr;
+    }
+    RecordType* asRecord() override {
+        return actualType != nullptr ? actualType->asRecord() : nullptr;
+    }
 };
 
 struct PrimitiveType : Type {
@@ -172,21 +198,35 @@ struct BooleanType : PrimitiveType {
 struct ArrayType : Type {
     sPtr<Expression> length;
     sPtr<Type> elementType;
+    // Set by the constant folder when the length is known at compile time
+    std::optional<uint64_t> staticLength;
     bool operator==(const ArrayType& other) const {
         return Node::operator==(other) && length == other.length &&
                elementType == other.elementType;
     }
     void accept(Visitor& v) override { v.visit(this); }
     TypeKind getTypeKind() { return TypeKind::Array; }
+    ArrayType* asArray() override { return this; }
 };
 
 struct RecordType : Type {
     std::vector<sPtr<VariableDecl>> fields;
+    // Position of every field by name, see `indexFields`
+    std::unordered_map<std::string, std::size_t> fieldIndex;
     bool operator==(const RecordType& other) const {
         return Node::operator==(other) && fields == other.fields;
     }
     void accept(Visitor& v) override { v.visit(this); }
     TypeKind getTypeKind() { return TypeKind::Record; }
+    RecordType* asRecord() override { return this; }
+
+    /**
+     * Builds the index `findField` uses instead of going through the fields.
+     *  The fields must not change afterwards.
+     */
+    void indexFields();
+    /** The field called `name`, nullptr if there is none */
+    sPtr<VariableDecl> findField(const std::string& name) const;
 };
 
 struct VariableDecl : Node {
@@ -200,6 +240,27 @@ struct VariableDecl : Node {
     void accept(Visitor& v) override { v.visit(this); }
 };
 
+inline void RecordType::indexFields() {
+    fieldIndex.clear();
+    fieldIndex.reserve(fields.size());
+    for (std::size_t i = 0; i < fields.size(); i++) {
+        fieldIndex.try_emplace(fields[i]->name, i);
+    }
+}
+
+inline sPtr<VariableDecl> RecordType::findField(const std::string& name) const {
+    if (!fieldIndex.empty()) {
+        auto field = fieldIndex.find(name);
+        return field != fieldIndex.end() ? fields[field->second] : nullptr;
+    }
+    for (auto& field : fields) {
+        if (field->name == name) {
+            return field;
+        }
+    }
+    return nullptr;
+}
+
 struct Body : Node {
     std::vector<sPtr<Statement>> statements;
     std::vector<sPtr<VariableDecl>> variables;
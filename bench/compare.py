@@ -0,0 +1,62 @@
+#!/usr/bin/env python3
+"""Compares two Google Benchmark JSON reports and fails on regressions.
+
+Usage: compare.py BASE.json HEAD.json [--threshold 0.25]
+
+The medians of repeated runs are compared when the reports contain them,
+otherwise the single measurements are.
+"""
+
+import argparse
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        report = json.load(f)
+    times = {}
+    for run in report["benchmarks"]:
+        if run.get("run_type") == "aggregate":
+            if run.get("aggregate_name") != "median":
+                continue
+            name = run["run_name"]
+        else:
+            name = run["name"]
+        times[name] = run["cpu_time"]
+    return times
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("base")
+    parser.add_argument("head")
+    parser.add_argument("--threshold", type=float, default=0.25,
+                        help="allowed relative slowdown (default: 0.25)")
+    args = parser.parse_args()
+
+    base = load(args.base)
+    head = load(args.head)
+
+    regressions = []
+    width = max(len(name) for name in head)
+    for name, time in head.items():
+        if name not in base:
+            print(f"{name:<{width}}  new")
+            continue
+        change = time / base[name] - 1
+        mark = ""
+        if change > args.threshold:
+            mark = "  REGRESSION"
+            regressions.append(name)
+        print(f"{name:<{width}}  {change:+8.1%}{mark}")
+
+    if regressions:
+        print(f"\n{len(regressions)} benchmark(s) slowed down by more than "
+              f"{args.threshold:.0%}")
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,199 @@
+#include "code_generator.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "san.hpp"
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wconversion"
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/Support/MemoryBuffer.h"
+#pragma GCC diagnostic pop
+
+namespace {
+
+using ast::sPtr;
+
+/**
+ * A program to time. Its `entry` routine takes a single integer, `argument`
+ *  in the benchmark, and returns an integer.
+ */
+struct Kernel {
+    const char* source;
+    const char* entry;
+    int64_t argument;
+};
+
+const Kernel fib{"routine fib(n : integer) : integer is\n"
+                 "    if n < 2 then\n"
+                 "        return n\n"
+                 "    end\n"
+                 "    return fib(n - 1) + fib(n - 2)\n"
+                 "end\n",
+                 "fib", 27};
+
+const Kernel tak{"routine tak(x : integer, y : integer, z : integer)"
+                 " : integer is\n"
+                 "    if y < x then\n"
+                 "        return tak(tak(x - 1, y, z), tak(y - 1, z, x),\n"
+                 "                   tak(z - 1, x, y))\n"
+                 "    end\n"
+                 "    return z\n"
+                 "end\n"
+                 "routine takFrom(n : integer) : integer is\n"
+                 "    return tak(n, n - 6, n - 12)\n"
+                 "end\n",
+                 "takFrom", 18};
+
+// Arrays of a static length, stored in place
+const Kernel matrix{"type Matrix is array [128] array [128] real\n"
+                    "routine multiply(seed : integer) : integer is\n"
+                    "    var a : Matrix\n"
+                    "    var b : Matrix\n"
+                    "    var c : Matrix\n"
+                    "    for i in 1..128 loop\n"
+                    "        for j in 1..128 loop\n"
+                    "            a[i][j] := (i * j + seed) % 7\n"
+                    "            b[i][j] := (i + j * seed) % 5\n"
+                    "            c[i][j] := 0.0\n"
+                    "        end\n"
+                    "    end\n"
+                    "    for i in 1..128 loop\n"
+                    "        for k in 1..128 loop\n"
+                    "            var aik is a[i][k]\n"
+                    "            for j in 1..128 loop\n"
+                    "                c[i][j] := c[i][j] + aik * b[k][j]\n"
+                    "            end\n"
+                    "        end\n"
+                    "    end\n"
+                    "    var trace is 0.0\n"
+                    "    for i in 1..128 loop\n"
+                    "        trace := trace + c[i][i]\n"
+                    "    end\n"
+                    "    return trace\n"
+                    "end\n",
+                    "multiply", 3};
+
+const Kernel dijkstra{"type Graph is array [64] array [64] integer\n"
+                      "routine shortestPaths(seed : integer) : integer is\n"
+                      "    var graph : Graph\n"
+                      "    for i in 1..64 loop\n"
+                      "        for j in 1..64 loop\n"
+                      "            graph[i][j] := (i * 7 + j * 5 + seed) % 23\n"
+                      "        end\n"
+                      "    end\n"
+                      "    var dist : array [64] integer\n"
+                      "    var done : array [64] boolean\n"
+                      "    for i in 1..64 loop\n"
+                      "        dist[i] := 999999999\n"
+                      "        done[i] := false\n"
+                      "    end\n"
+                      "    dist[1] := 0\n"
+                      "    for count in 1..64 loop\n"
+                      "        var u is 1\n"
+                      "        var best is 999999999\n"
+                      "        for v in 1..64 loop\n"
+                      "            if done[v] = false then\n"
+                      "                if dist[v] <= best then\n"
+                      "                    best := dist[v]\n"
+                      "                    u := v\n"
+                      "                end\n"
+                      "            end\n"
+                      "        end\n"
+                      "        done[u] := true\n"
+                      "        for v in 1..64 loop\n"
+                      "            var edge is graph[u][v]\n"
+                      "            if done[v] = false and edge /= 0 then\n"
+                      "                if dist[u] + edge < dist[v] then\n"
+                      "                    dist[v] := dist[u] + edge\n"
+                      "                end\n"
+                      "            end\n"
+                      "        end\n"
+                      "    end\n"
+                      "    var total is 0\n"
+                      "    for i in 1..64 loop\n"
+                      "        total := total + dist[i]\n"
+                      "    end\n"
+                      "    return total\n"
+                      "end\n",
+                      "shortestPaths", 3};
+
+template <typename Pass> void run(const sPtr<ast::Program>& ast) {
+    Pass pass;
+    ast->accept(pass);
+    if (!pass.getErrors().empty()) {
+        throw std::logic_error("kernel fails semantic analysis");
+    }
+}
+
+/** Compiles `kernel` at `level` and loads it into `jit` */
+void load(llvm::orc::LLJIT& jit, const Kernel& kernel, unsigned level) {
+    parser::Parser parser(lexer::Lexer{kernel.source});
+    auto ast = parser.parseProgram();
+    if (!parser.getErrors().empty()) {
+        throw std::logic_error("kernel does not parse");
+    }
+    run<san::IdentifierResolver>(ast);
+    run<san::TypeDeriver>(ast);
+    run<san::ConstantFolder>(ast);
+
+    cg::TargetConfig target;
+    target.cpu = "native";
+    target.optLevel = level;
+    cg::CodeGenerator codeGen(kernel.entry, target);
+    ast->accept(codeGen);
+    if (!codeGen.getErrors().empty()) {
+        throw std::logic_error("kernel fails code generation");
+    }
+    codeGen.optimize();
+
+    llvm::cantFail(jit.addObjectFile(codeGen.emitObject()));
+}
+
+/** Times the generated code of `kernel` compiled at the level in range(0) */
+void BM_GeneratedProgram(benchmark::State& state, const Kernel& kernel) {
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    auto jit = llvm::cantFail(llvm::orc::LLJITBuilder().create());
+    // Copying arrays calls into the C library
+    jit->getMainJITDylib().addGenerator(llvm::cantFail(
+        llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+            jit->getDataLayout().getGlobalPrefix())));
+    load(*jit, kernel, static_cast<unsigned>(state.range(0)));
+
+    auto symbol = llvm::cantFail(jit->lookup(kernel.entry));
+#if LLVM_VERSION_MAJOR >= 15
+    auto entry = symbol.toPtr<int64_t (*)(int64_t)>();
+#else
+    auto entry = reinterpret_cast<int64_t (*)(int64_t)>(symbol.getAddress());
+#endif
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(entry(kernel.argument));
+    }
+}
+
+} // namespace
+
+BENCHMARK_CAPTURE(BM_GeneratedProgram, fib, fib)
+    ->DenseRange(0, 3)
+    ->ArgName("O")
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_GeneratedProgram, tak, tak)
+    ->DenseRange(0, 3)
+    ->ArgName("O")
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_GeneratedProgram, matrix, matrix)
+    ->DenseRange(0, 3)
+    ->ArgName("O")
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_GeneratedProgram, dijkstra, dijkstra)
+    ->DenseRange(0, 3)
+    ->ArgName("O")
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,503 @@
+#include "code_generator.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "program_generator.hpp"
+#include "san.hpp"
+#include <benchmark/benchmark.h>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <sys/resource.h>
+
+namespace {
+
+using ast::sPtr;
+
+/**
+ * Counts the nodes of a freshly parsed tree. Identifiers are not followed to
+ *  their declarations, so every node is counted once.
+ */
+class NodeCounter : public ast::Visitor {
+public:
+    std::size_t count = 0;
+
+    void visit(ast::Program* node) override {
+        count++;
+        acceptAll(node->types);
+        acceptAll(node->variables);
+        acceptAll(node->routines);
+    }
+
+    void visit(ast::RoutineDecl* node) override {
+        count++;
+        acceptAll(node->parameters);
+        accept(node->returnType);
+        accept(node->getBody());
+    }
+
+    void visit(ast::AliasedType*) override { count++; }
+
+    void visit(ast::TypeDecl* node) override {
+        count++;
+        accept(node->type);
+    }
+
+    void visit(ast::IntegerType*) override { count++; }
+
+    void visit(ast::RealType*) override { count++; }
+
+    void visit(ast::BooleanType*) override { count++; }
+
+    void visit(ast::ArrayType* node) override {
+        count++;
+        accept(node->length);
+        accept(node->elementType);
+    }
+
+    void visit(ast::RecordType* node) override {
+        count++;
+        acceptAll(node->fields);
+    }
+
+    void visit(ast::VariableDecl* node) override {
+        count++;
+        accept(node->type);
+        accept(node->initialValue);
+    }
+
+    void visit(ast::Body* node) override {
+        count++;
+        acceptAll(node->types);
+        acceptAll(node->variables);
+        acceptAll(node->statements);
+    }
+
+    void visit(ast::ReturnStatement* node) override {
+        count++;
+        accept(node->expression);
+    }
+
+    void visit(ast::Assignment* node) override {
+        count++;
+        accept(node->lhs);
+        accept(node->rhs);
+    }
+
+    void visit(ast::WhileLoop* node) override {
+        count++;
+        accept(node->condition);
+        accept(node->body);
+    }
+
+    void visit(ast::ForLoop* node) override {
+        count++;
+        accept(node->loopVar);
+        accept(node->rangeFrom);
+        accept(node->rangeTo);
+        accept(node->body);
+    }
+
+    void visit(ast::IfStatement* node) override {
+        count++;
+        accept(node->condition);
+        accept(node->ifBody);
+        accept(node->elseBody);
+    }
+
+    void visit(ast::UnaryExpression* node) override {
+        count++;
+        accept(node->operand);
+    }
+
+    void visit(ast::BinaryExpression* node) override {
+        count++;
+        accept(node->operand1);
+        accept(node->operand2);
+    }
+
+    void visit(ast::IntegerLiteral*) override { count++; }
+
+    void visit(ast::RealLiteral*) override { count++; }
+
+    void visit(ast::BooleanLiteral*) override { count++; }
+
+    void visit(ast::Identifier*) override { count++; }
+
+    void visit(ast::RoutineCall* node) override {
+        count++;
+        acceptAll(node->args);
+    }
+
+private:
+    template <typename T> void accept(const sPtr<T>& node) {
+        if (node != nullptr) {
+            node->accept(*this);
+        }
+    }
+
+    template <typename T> void acceptAll(const std::vector<sPtr<T>>& nodes) {
+        for (auto& node : nodes) {
+            accept(node);
+        }
+    }
+};
+
+/** The program used by a benchmark, generated once per size */
+struct Input {
+    std::string source;
+    std::size_t tokens = 0;
+    std::size_t nodes = 0;
+};
+
+const Input& input(unsigned routines, bool codegenSubset = false) {
+    static std::map<std::pair<unsigned, bool>, Input> cache;
+    auto& in = cache[{routines, codegenSubset}];
+    if (!in.source.empty()) {
+        return in;
+    }
+
+    bench::ProgramShape shape;
+    shape.routines = routines;
+    shape.codegenSubset = codegenSubset;
+    in.source = bench::generateProgram(shape);
+
+    lexer::Lexer lx{in.source};
+    while (lx.Next().type != lexer::TokenType::Eof) {
+        in.tokens++;
+    }
+
+    parser::Parser parser(lexer::Lexer{in.source});
+    auto ast = parser.parseProgram();
+    if (!parser.getErrors().empty()) {
+        throw std::logic_error("generated program does not parse");
+    }
+    NodeCounter counter;
+    ast->accept(counter);
+    in.nodes = counter.count;
+    return in;
+}
+
+/**
+ * Peak resident set size of the process in megabytes. This is a high-water
+ *  mark over the whole run, so filter a single benchmark to see what one stage
+ *  needs on its own.
+ */
+double peakRss() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return static_cast<double>(usage.ru_maxrss) / (1024 * 1024);
+#else
+    return static_cast<double>(usage.ru_maxrss) / 1024;
+#endif
+}
+
+void report(benchmark::State& state, const Input& in) {
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                            static_cast<int64_t>(in.source.size()));
+    state.counters["nodes"] =
+        benchmark::Counter(static_cast<double>(in.nodes),
+                           benchmark::Counter::kIsIterationInvariantRate);
+    state.counters["peak_rss_MB"] = peakRss();
+}
+
+sPtr<ast::Program> parse(const Input& in) {
+    parser::Parser parser(lexer::Lexer{in.source});
+    return parser.parseProgram();
+}
+
+template <typename Pass> void run(const sPtr<ast::Program>& ast) {
+    Pass pass;
+    ast->accept(pass);
+    if (!pass.getErrors().empty()) {
+        throw std::logic_error("generated program fails semantic analysis");
+    }
+}
+
+/** The semantic passes in the order the compiler runs them */
+using PassRunner = void (*)(const sPtr<ast::Program>&);
+const PassRunner passes[] = {
+    run<san::IdentifierResolver>, run<san::ArrayLengthEnforcer>,
+    run<san::MissingReturn>,      run<san::ParamsValidator>,
+    run<san::TypeDeriver>,        run<san::ConstantFolder>,
+};
+
+void BM_Lexer(benchmark::State& state) {
+    auto& in = input(static_cast<unsigned>(state.range(0)));
+    for (auto _ : state) {
+        lexer::Lexer lx{in.source};
+        while (lx.Next().type != lexer::TokenType::Eof) {
+        }
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                            static_cast<int64_t>(in.source.size()));
+    state.counters["tokens"] =
+        benchmark::Counter(static_cast<double>(in.tokens),
+                           benchmark::Counter::kIsIterationInvariantRate);
+    state.counters["peak_rss_MB"] = peakRss();
+}
+
+void BM_Parser(benchmark::State& state) {
+    auto& in = input(static_cast<unsigned>(state.range(0)));
+    for (auto _ : state) {
+        auto ast = parse(in);
+        benchmark::DoNotOptimize(ast);
+        state.PauseTiming();
+        ast.reset();
+        state.ResumeTiming();
+    }
+    report(state, in);
+}
+
+/**
+ * A program of routines that each return one deeply nested arithmetic
+ *  expression. Almost every token goes through the parselet tables, so this
+ *  isolates expression dispatch from declarations and statements.
+ */
+const std::string& expressionInput(unsigned depth) {
+    static std::map<unsigned, std::string> cache;
+    auto& source = cache[depth];
+    if (!source.empty()) {
+        return source;
+    }
+
+    const char* operators[] = {"+", "-", "*", "/", "%"};
+    for (unsigned routine = 0; routine < 64; routine++) {
+        std::string expression = "a";
+        for (unsigned level = 0; level < depth; level++) {
+            expression = "(" + expression + " " + operators[level % 5] +
+                         " -b * " + std::to_string(level + 1) + ") < a[" +
+                         std::to_string(level) + "].x";
+        }
+        source += "routine f" + std::to_string(routine) +
+                  "(a : integer, b : integer) : boolean is\n    return " +
+                  expression + "\nend\n";
+    }
+
+    parser::Parser parser(lexer::Lexer{source});
+    parser.parseProgram();
+    if (!parser.getErrors().empty()) {
+        throw std::logic_error("generated expressions do not parse");
+    }
+    return source;
+}
+
+void BM_ParserExpressions(benchmark::State& state) {
+    auto& source = expressionInput(static_cast<unsigned>(state.range(0)));
+    for (auto _ : state) {
+        parser::Parser parser(lexer::Lexer{source});
+        auto ast = parser.parseProgram();
+        benchmark::DoNotOptimize(ast);
+        state.PauseTiming();
+        ast.reset();
+        state.ResumeTiming();
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                            static_cast<int64_t>(source.size()));
+}
+
+/**
+ * Times the semantic pass with the given index in isolation. The program is
+ *  parsed and the preceding passes are run outside of the timed region.
+ */
+void BM_SemanticPass(benchmark::State& state, std::size_t pass) {
+    auto& in = input(static_cast<unsigned>(state.range(0)));
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto ast = parse(in);
+        for (std::size_t i = 0; i < pass; i++) {
+            passes[i](ast);
+        }
+        state.ResumeTiming();
+
+        passes[pass](ast);
+
+        state.PauseTiming();
+        ast.reset();
+        state.ResumeTiming();
+    }
+    report(state, in);
+}
+
+/** Runs the checks that share a traversal in the compiler */
+void runCheckGroup(const sPtr<ast::Program>& ast) {
+    san::ArrayLengthEnforcer arrLenEnforcer;
+    san::MissingReturn missingReturn;
+    san::ParamsValidator paramsValidator;
+    san::CheckGroup checks{arrLenEnforcer, missingReturn, paramsValidator};
+    ast->accept(checks);
+    if (!arrLenEnforcer.getErrors().empty() ||
+        !missingReturn.getErrors().empty() ||
+        !paramsValidator.getErrors().empty()) {
+        throw std::logic_error("generated program fails semantic analysis");
+    }
+}
+
+void BM_CheckGroup(benchmark::State& state) {
+    auto& in = input(static_cast<unsigned>(state.range(0)));
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto ast = parse(in);
+        run<san::IdentifierResolver>(ast);
+        state.ResumeTiming();
+
+        runCheckGroup(ast);
+
+        state.PauseTiming();
+        ast.reset();
+        state.ResumeTiming();
+    }
+    report(state, in);
+}
+
+/** Runs the semantic analysis the way the compiler does */
+sPtr<ast::Program> analyze(const Input& in) {
+    auto ast = parse(in);
+    run<san::IdentifierResolver>(ast);
+    runCheckGroup(ast);
+    run<san::TypeDeriver>(ast);
+    run<san::ConstantFolder>(ast);
+    return ast;
+}
+
+void BM_Frontend(benchmark::State& state) {
+    auto& in = input(static_cast<unsigned>(state.range(0)));
+    for (auto _ : state) {
+        auto ast = analyze(in);
+        benchmark::DoNotOptimize(ast);
+        state.PauseTiming();
+        ast.reset();
+        state.ResumeTiming();
+    }
+    report(state, in);
+}
+
+void BM_CodegenIR(benchmark::State& state) {
+    auto& in = input(static_cast<unsigned>(state.range(0)), true);
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto ast = analyze(in);
+        auto codeGen = std::make_unique<cg::CodeGenerator>("bench");
+        state.ResumeTiming();
+
+        ast->accept(*codeGen);
+
+        state.PauseTiming();
+        if (!codeGen->getErrors().empty()) {
+            state.SkipWithError("code generation failed");
+        }
+        codeGen.reset();
+        ast.reset();
+        state.ResumeTiming();
+    }
+    report(state, in);
+}
+
+void BM_CodegenObject(benchmark::State& state) {
+    auto& in = input(static_cast<unsigned>(state.range(0)), true);
+    auto object = (std::filesystem::temp_directory_path() / "riddle_bench.o")
+                      .string();
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto ast = analyze(in);
+        auto codeGen = std::make_unique<cg::CodeGenerator>("bench");
+        ast->accept(*codeGen);
+        state.ResumeTiming();
+
+        codeGen->emitCode(object);
+
+        state.PauseTiming();
+        codeGen.reset();
+        ast.reset();
+        state.ResumeTiming();
+    }
+    std::filesystem::remove(object);
+    report(state, in);
+}
+
+/** Times the optimization pipeline of the level in range(1) */
+void BM_CodegenOptimize(benchmark::State& state) {
+    auto& in = input(static_cast<unsigned>(state.range(0)), true);
+    cg::TargetConfig target;
+    target.optLevel = static_cast<unsigned>(state.range(1));
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto ast = analyze(in);
+        auto codeGen = std::make_unique<cg::CodeGenerator>("bench", target);
+        ast->accept(*codeGen);
+        state.ResumeTiming();
+
+        codeGen->optimize();
+
+        state.PauseTiming();
+        codeGen.reset();
+        ast.reset();
+        state.ResumeTiming();
+    }
+    report(state, in);
+}
+
+/**
+ * Times code generation, optimization and object emission split across the
+ *  number of jobs in range(1)
+ */
+void BM_CodegenParallel(benchmark::State& state) {
+    auto& in = input(static_cast<unsigned>(state.range(0)), true);
+    cg::TargetConfig target;
+    target.optLevel = 2;
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto ast = analyze(in);
+        state.ResumeTiming();
+
+        cg::ParallelCodeGenerator codeGen(
+            "bench", target, static_cast<unsigned>(state.range(1)));
+        codeGen.generate(ast.get());
+        codeGen.optimize();
+        benchmark::DoNotOptimize(codeGen.emitObject());
+
+        state.PauseTiming();
+        ast.reset();
+        state.ResumeTiming();
+    }
+    report(state, in);
+}
+
+constexpr int64_t smallProgram = 64;
+constexpr int64_t largeProgram = 2048;
+// Object emission runs at a fraction of the front end's speed
+constexpr int64_t largeCodegenProgram = 512;
+
+} // namespace
+
+BENCHMARK(BM_Lexer)->Range(smallProgram, largeProgram);
+BENCHMARK(BM_Parser)->Range(smallProgram, largeProgram);
+BENCHMARK(BM_ParserExpressions)->Range(8, 512);
+BENCHMARK_CAPTURE(BM_SemanticPass, IdentifierResolver, 0)
+    ->Range(smallProgram, largeProgram);
+BENCHMARK_CAPTURE(BM_SemanticPass, ArrayLengthEnforcer, 1)
+    ->Range(smallProgram, largeProgram);
+BENCHMARK_CAPTURE(BM_SemanticPass, MissingReturn, 2)
+    ->Range(smallProgram, largeProgram);
+BENCHMARK_CAPTURE(BM_SemanticPass, ParamsValidator, 3)
+    ->Range(smallProgram, largeProgram);
+BENCHMARK_CAPTURE(BM_SemanticPass, TypeDeriver, 4)
+    ->Range(smallProgram, largeProgram);
+BENCHMARK_CAPTURE(BM_SemanticPass, ConstantFolder, 5)
+    ->Range(smallProgram, largeProgram);
+BENCHMARK(BM_CheckGroup)->Range(smallProgram, largeProgram);
+BENCHMARK(BM_Frontend)->Range(smallProgram, largeProgram);
+BENCHMARK(BM_CodegenIR)->Range(smallProgram, largeCodegenProgram);
+BENCHMARK(BM_CodegenObject)->Range(smallProgram, largeCodegenProgram);
+BENCHMARK(BM_CodegenOptimize)
+    ->ArgsProduct({{smallProgram, largeCodegenProgram}, {1, 2, 3}})
+    ->ArgNames({"routines", "O"});
+BENCHMARK(BM_CodegenParallel)
+    ->ArgsProduct({{largeCodegenProgram}, {1, 2, 4, 8}})
+    ->ArgNames({"routines", "jobs"})
+    ->UseRealTime();
+
+BENCHMARK_MAIN();
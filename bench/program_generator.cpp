@@ -0,0 +1,294 @@
+#include "program_generator.hpp"
+
+#include "fmt/format.h"
+#include <random>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+namespace {
+
+constexpr unsigned recordTypes = 3;
+constexpr unsigned recordFields = 4;
+constexpr unsigned arrayLength = 16;
+
+/** Array types: integers, reals and records of type `Rec0` */
+enum class ArrayKind { Integer, Real, Record };
+
+class Generator {
+public:
+    explicit Generator(const ProgramShape& shape)
+        : m_shape(shape), m_rng(shape.seed) {}
+
+    std::string run() {
+        if (!m_shape.codegenSubset) {
+            types();
+        }
+        for (unsigned i = 0; i < m_shape.routines; i++) {
+            routine(i);
+        }
+        return std::move(m_out);
+    }
+
+private:
+    struct ArrayVar {
+        std::string name;
+        ArrayKind kind;
+    };
+
+    const ProgramShape& m_shape;
+    std::mt19937_64 m_rng;
+    std::string m_out;
+
+    // Per-routine state
+    unsigned m_routine = 0;
+    unsigned m_loops = 0;
+    std::vector<std::string> m_readable; // integer values
+    // TypeDeriver revisits the initializer of a variable used as an index,
+    //  which loses the field it is looking up in an enclosing `.` access.
+    //  Only parameters and loop variables, which have no initializer, are
+    //  used as indices.
+    std::vector<std::string> m_indices;
+    std::vector<std::string> m_assignable;
+    std::vector<std::string> m_records;
+    std::vector<ArrayVar> m_arrays;
+
+    // std::uniform_int_distribution is implementation-defined, so the
+    //  distributions are spelled out to keep the output identical everywhere.
+    //  For the same reason every draw is sequenced into its own statement
+    //  rather than left to the unspecified order of argument evaluation.
+    unsigned pick(std::size_t n) { return static_cast<unsigned>(m_rng() % n); }
+    bool chance(double p) {
+        return static_cast<double>(m_rng() >> 11) * 0x1.0p-53 < p;
+    }
+
+    void line(unsigned indent, const std::string& text) {
+        m_out.append(indent * 4, ' ');
+        m_out += text;
+        m_out += '\n';
+    }
+
+    void types() {
+        for (unsigned i = 0; i < recordTypes; i++) {
+            line(0, fmt::format("type Rec{} is record", i));
+            for (unsigned f = 0; f < recordFields; f++) {
+                line(1, fmt::format("var f{} : {}", f,
+                                    f % 2 == 0 ? "integer" : "real"));
+            }
+            line(0, "end");
+        }
+        line(0,
+             fmt::format("type IntArray is array [{}] integer", arrayLength));
+        line(0, fmt::format("type RealArray is array [{}] real", arrayLength));
+        line(0, fmt::format("type RecArray is array [{}] Rec0", arrayLength));
+        line(0, "");
+    }
+
+    void routine(unsigned index) {
+        m_routine = index;
+        m_loops = 0;
+        m_readable = {"a", "b"};
+        m_indices = {"a", "b"};
+        m_assignable.clear();
+        m_records.clear();
+        m_arrays.clear();
+
+        constexpr auto header =
+            "routine f{}(a : integer, b : integer) : integer is";
+        line(0, fmt::format(header, index));
+        unsigned locals = 1 + pick(m_shape.statements);
+        for (unsigned i = 0; i < locals; i++) {
+            local(i);
+        }
+        body(1, m_shape.depth);
+        line(1, "return " + expression(m_shape.expressionSize));
+        line(0, "end");
+        line(0, "");
+    }
+
+    void local(unsigned index) {
+        bool aggregates = !m_shape.codegenSubset;
+        if (aggregates && chance(m_shape.recordDensity)) {
+            auto name = fmt::format("r{}", index);
+            line(1, fmt::format("var {} : Rec{}", name, pick(recordTypes)));
+            m_records.push_back(name);
+        } else if (aggregates && chance(m_shape.arrayDensity)) {
+            static const char* typeNames[] = {"IntArray", "RealArray",
+                                              "RecArray"};
+            auto kind = static_cast<ArrayKind>(pick(3));
+            auto name = fmt::format("v{}", index);
+            line(1, fmt::format("var {} : {}", name,
+                                typeNames[static_cast<int>(kind)]));
+            m_arrays.push_back({name, kind});
+        } else {
+            auto name = fmt::format("x{}", index);
+            line(1, fmt::format("var {} : integer is {}", name,
+                                expression(m_shape.expressionSize)));
+            // The code generator does not load locals yet
+            if (!m_shape.codegenSubset) {
+                m_readable.push_back(name);
+            }
+            m_assignable.push_back(name);
+        }
+    }
+
+    void body(unsigned indent, unsigned depth) {
+        for (unsigned i = 0; i < m_shape.statements; i++) {
+            statement(indent, depth);
+        }
+    }
+
+    void statement(unsigned indent, unsigned depth) {
+        unsigned kind = pick(depth > 0 ? 6 : 3);
+        if (kind == 2 && m_routine == 0) {
+            kind = 0;
+        }
+        if (kind == 3 && m_shape.codegenSubset) {
+            // `if` does not produce well-formed IR yet
+            kind = 4;
+        }
+
+        switch (kind) {
+        case 0:
+        case 1: {
+            auto lhs = lvalue();
+            line(indent, lhs + " := " + expression(m_shape.expressionSize));
+            return;
+        }
+        case 2: {
+            auto callee = pick(m_routine);
+            auto first = expression(m_shape.expressionSize);
+            auto second = expression(m_shape.expressionSize);
+            line(indent, fmt::format("f{}({}, {})", callee, first, second));
+            return;
+        }
+        case 3:
+            line(indent, "if " + condition() + " then");
+            body(indent + 1, depth - 1);
+            if (chance(0.5)) {
+                line(indent, "else");
+                body(indent + 1, depth - 1);
+            }
+            line(indent, "end");
+            return;
+        case 4:
+            line(indent, "while " + condition() + " loop");
+            body(indent + 1, depth - 1);
+            line(indent, "end");
+            return;
+        default: {
+            auto var = fmt::format("i{}", m_loops++);
+            auto from = 1 + pick(4);
+            auto to = expression(1);
+            line(indent, fmt::format("for {} in {}..{} loop", var, from, to));
+            if (!m_shape.codegenSubset) {
+                m_readable.push_back(var);
+                m_indices.push_back(var);
+            }
+            body(indent + 1, depth - 1);
+            if (!m_shape.codegenSubset) {
+                m_readable.pop_back();
+                m_indices.pop_back();
+            }
+            line(indent, "end");
+            return;
+        }
+        }
+    }
+
+    std::string index() {
+        return chance(0.5) ? m_indices[pick(m_indices.size())]
+                           : std::to_string(1 + pick(arrayLength));
+    }
+
+    std::string lvalue() {
+        std::size_t choices =
+            m_assignable.size() + m_records.size() + m_arrays.size();
+        auto choice = pick(choices);
+        if (choice < m_assignable.size()) {
+            return m_assignable[choice];
+        }
+        return aggregate(choice - static_cast<unsigned>(m_assignable.size()));
+    }
+
+    /** A field of the chosen record or an element of the chosen array */
+    std::string aggregate(unsigned choice) {
+        if (choice < m_records.size()) {
+            return fmt::format("{}.f{}", m_records[choice],
+                               pick(recordFields));
+        }
+        auto& array = m_arrays[choice - m_records.size()];
+        auto element = fmt::format("{}[{}]", array.name, index());
+        if (array.kind == ArrayKind::Record) {
+            return fmt::format("{}.f{}", element, pick(recordFields));
+        }
+        return element;
+    }
+
+    std::string operand() {
+        std::size_t aggregates = m_records.size() + m_arrays.size();
+        if (aggregates > 0 && chance(0.3)) {
+            return aggregate(pick(aggregates));
+        }
+        if (chance(0.3)) {
+            return std::to_string(pick(100));
+        }
+        return m_readable[pick(m_readable.size())];
+    }
+
+    /** True if `expr` has no operands other than literals */
+    static bool isConstant(const std::string& expr) {
+        return expr.find_first_not_of("0123456789 +-*/()") == std::string::npos;
+    }
+
+    std::string expression(unsigned operands) {
+        if (operands <= 1) {
+            return operand();
+        }
+        static const char* fullOps[] = {"+", "-", "*", "/"};
+        static const char* subsetOps[] = {"+", "-", "*"};
+        const char* op =
+            m_shape.codegenSubset ? subsetOps[pick(3)] : fullOps[pick(4)];
+
+        unsigned left = 1 + pick(operands - 1);
+        unsigned right = operands - left;
+        auto lhs = expression(left);
+        auto rhs = expression(right);
+        if (op[0] == '/' && isConstant(rhs)) {
+            // A divisor that folds to zero does not compile
+            rhs = "1";
+        }
+        // The whole of a divisor is parenthesized, so that none of its
+        //  operands ends up dividing on its own
+        if (right > 1 && (chance(0.5) || op[0] == '/')) {
+            rhs = "(" + rhs + ")";
+        }
+        return fmt::format("{} {} {}", lhs, op, rhs);
+    }
+
+    std::string condition() {
+        unsigned operands = std::max(2u, m_shape.expressionSize / 2);
+        static const char* comparisons[] = {"<", "<=", ">", ">=", "=", "/="};
+        auto compare = [&] {
+            auto lhs = expression(operands / 2);
+            auto op = m_shape.codegenSubset ? "<" : comparisons[pick(6)];
+            auto rhs = expression(operands - operands / 2);
+            return fmt::format("{} {} {}", lhs, op, rhs);
+        };
+        auto first = compare();
+        if (m_shape.codegenSubset || !chance(0.3)) {
+            return first;
+        }
+        auto junction = chance(0.5) ? "and" : "or";
+        return fmt::format("{} {} {}", first, junction, compare());
+    }
+};
+
+} // namespace
+
+std::string generateProgram(const ProgramShape& shape) {
+    return Generator(shape).run();
+}
+
+} // namespace bench
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace bench {
+
+/**
+ * The shape of a synthetic program. The same shape always produces the same
+ *  source text, so benchmark results stay comparable between runs and
+ *  machines.
+ */
+struct ProgramShape {
+    /** Number of top-level routines */
+    unsigned routines = 64;
+    /** Number of statements in each routine and loop/conditional body */
+    unsigned statements = 4;
+    /** How deep loops and conditionals may nest inside a routine */
+    unsigned depth = 2;
+    /** Number of operands in each generated expression */
+    unsigned expressionSize = 6;
+    /** Probability (0..1) that a local variable is of a record type */
+    double recordDensity = 0.2;
+    /** Probability (0..1) that a local variable is of an array type */
+    double arrayDensity = 0.2;
+    /**
+     * Restricts the program to what the code generator currently lowers:
+     *  integer parameters and locals, `+ - * <`, loops, routine calls and a
+     *  final `return`. Record and array densities are ignored.
+     */
+    bool codegenSubset = false;
+    std::uint64_t seed = 1;
+};
+
+/**
+ * Generates a program that passes every semantic analysis pass.
+ *
+ * Routine `fN` takes two integers and returns an integer, and may call any
+ *  routine declared before it.
+ */
+std::string generateProgram(const ProgramShape& shape);
+
+} // namespace bench
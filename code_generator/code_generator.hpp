@@ -2,31 +2,96 @@
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wconversion"
 #pragma GCC diagnostic ignored "-Wunused-parameter"
+#include "llvm/Config/llvm-config.h"
 #include "llvm/ADT/APFloat.h"
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/Passes/PassBuilder.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/SmallVectorMemoryBuffer.h"
+#if LLVM_VERSION_MAJOR >= 14
+#include "llvm/MC/TargetRegistry.h"
+#else
 #include "llvm/Support/TargetRegistry.h"
+#endif
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Target/TargetOptions.h"
+#include "llvm/Transforms/Utils/Mem2Reg.h"
 #pragma GCC diagnostic pop
+#include <algorithm>
 #include <fstream>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace llvm::orc {
+class LLJIT;
+} // namespace llvm::orc
 
 namespace cg {
 
+/** The machine to generate code for and how hard to optimize it */
+struct TargetConfig {
+    // "native" stands for the CPU of the host along with all its features
+    std::string cpu = "generic";
+    // Comma-separated features to turn on (+name) or off (-name) on the CPU
+    std::string features;
+    // 0-3, as in -O0 to -O3
+    unsigned optLevel = 0;
+    // Whether the fields of records may be stored in another order than the
+    //  one they are declared in, to leave out padding
+    bool reorderFields = true;
+    // Whether arrays of records of a static length are stored as an array
+    //  for every field (structure of arrays) rather than one of records
+    bool structOfArrays = false;
+
+    /** The same config with "native" replaced by what it stands for */
+    TargetConfig resolved() const;
+};
+
+/** Where the fields of a record type are in memory */
+struct RecordLayout {
+    struct Field {
+        std::string name;
+        uint64_t offset;
+        uint64_t size;
+    };
+    // Name of the type declaration, empty if the record has none
+    std::string name;
+    lexer::Token::Position pos;
+    uint64_t size;
+    uint64_t alignment;
+    // Bytes of `size` that are not taken by any field
+    uint64_t padding;
+    // Size the record would have with its fields in the declared order
+    uint64_t declaredSize;
+    // Ordered by offset
+    std::vector<Field> fields;
+};
+
 class CodeGenerator : public ast::Visitor {
 public:
-    CodeGenerator(std::string name = "anonymous");
+    CodeGenerator(std::string name = "anonymous",
+                  const TargetConfig& target = {});
     void visit(ast::Program* node) override;
     void visit(ast::RoutineDecl* node) override;
     void visit(ast::AliasedType* node) override;
@@ -51,18 +116,54 @@ public:
     void visit(ast::Identifier* node) override;
     void visit(ast::RoutineCall* node) override;
 
+    /**
+     * Generates the routines [first, last) of the program and declares the
+     *  rest, so they can be called from the module
+     */
+    void generate(ast::Program* node, std::size_t first, std::size_t last);
+    /** Function of the routine, declared if the module has none yet */
+    llvm::Function* declare(ast::RoutineDecl* node);
+
     void print(llvm::raw_ostream& stream = llvm::errs()) {
         m_module->print(stream, nullptr);
     }
+    /**
+     * Adds the entry point of an executable, which has the runtime call the
+     *  routine named by its first argument with the rest and print what it
+     *  returns. Returns false if a routine is called `main` already.
+     */
+    bool generateMain();
+    /** Runs the standard optimization pipeline of the target's level */
+    void optimize();
     void emitCode(std::string filename = "output.o");
+    /** Object code of the module, nullptr if the target cannot emit any */
+    std::unique_ptr<llvm::MemoryBuffer> emitObject();
     llvm::Module::FunctionListType& getFunctions();
+    /** Layouts of the record types of the module, in the order of the source */
+    std::vector<RecordLayout> getLayouts();
 
 private:
     llvm::LLVMContext m_context;
     llvm::IRBuilder<> m_builder;
     std::unique_ptr<llvm::Module> m_module;
+    // Addresses of the variables of the routine being generated
     std::map<std::string, llvm::Value*> m_namedValues;
-    llvm::TargetMachine* m_targetMachine;
+    std::map<std::string, llvm::GlobalVariable*> m_globals;
+    // Descriptors of the arrays on the heap of the bodies being generated,
+    //  freed at their end and on every return
+    std::vector<llvm::AllocaInst*> m_heapArrays;
+    ast::RoutineDecl* m_routine = nullptr;
+
+    struct Record {
+        ast::RecordType* node;
+        std::string name;
+        llvm::StructType* type;
+        // Element of `type` every field is stored in, by declaration order
+        std::vector<unsigned> slots;
+    };
+    std::map<ast::RecordType*, Record> m_records;
+    std::unique_ptr<llvm::TargetMachine> m_targetMachine;
+    TargetConfig m_target;
 
     // used for holding values that should be returned by functions
     llvm::Value* tempVal = nullptr;
@@ -78,6 +179,112 @@ private:
         return t;
     }
 
+    /**
+     * Defines the global variable if `define`, declares one defined by
+     *  another module otherwise
+     */
+    void declareGlobal(ast::VariableDecl* node, bool define);
+    /**
+     * Allocates the elements of an array whose length is known only at run
+     *  time, 64-byte aligned, and keeps their address along with the length
+     */
+    void declareHeapArray(ast::VariableDecl* node, ast::ArrayType* array);
+    /** 64-byte aligned memory for `length` elements, to be freed with free */
+    llvm::Value* allocateElements(llvm::Type* element, llvm::Value* length,
+                                  const llvm::Twine& name = "");
+    /**
+     * Frees the arrays of `m_heapArrays` from `first` on, except for `kept`,
+     *  which is being returned
+     */
+    void freeHeapArrays(std::size_t first = 0,
+                        llvm::AllocaInst* kept = nullptr);
+    /**
+     * Descriptor of an array on the heap holding a copy of the elements of
+     *  the array at `array`, to return it to a caller that frees it
+     */
+    llvm::Value* heapCopy(llvm::Value* array, ast::ArrayType* type,
+                          llvm::StructType* descriptor);
+    /**
+     * Struct type of the record, created the first time. Named after `name`
+     *  then, which is empty for records without a type declaration.
+     */
+    const Record& layOut(ast::RecordType* node, const std::string& name);
+
+    /**
+     * Stores the value of `expression` at `target`, which is of `type`.
+     *  Arrays are copied element by element.
+     */
+    void assign(llvm::Value* target, ast::Type* type,
+                ast::Expression* expression);
+    void copyArray(llvm::Value* target, ast::ArrayType* type,
+                   llvm::Value* source, ast::ArrayType* sourceType,
+                   ast::Expression* expression);
+    /** Address of a variable or an element of an array, to assign to */
+    llvm::Value* address(ast::Expression* node);
+    llvm::Value* variableAddress(ast::Identifier* node);
+    llvm::Value* elementAddress(ast::BinaryExpression* node);
+    llvm::Value* fieldAddress(ast::BinaryExpression* node);
+    /**
+     * The array and the index from 0 of the element `node` stands for, both
+     *  nullptr if they cannot be evaluated
+     */
+    std::pair<llvm::Value*, llvm::Value*>
+    arrayAccess(ast::BinaryExpression* node);
+
+    /** Arrays of records stored as an array for every field */
+    bool isStructOfArrays(ast::ArrayType* type);
+    /**
+     * `node` if it is an element of a structure of arrays, which has no
+     *  address of its own, nullptr otherwise
+     */
+    ast::BinaryExpression* soaElement(ast::Expression* node);
+    llvm::Value* soaFieldAddress(llvm::Value* array, ast::ArrayType* type,
+                                 llvm::Value* index, unsigned slot);
+    /**
+     * Copies the fields of element `index` of a structure of arrays to the
+     *  record at `record`, or the other way around if `toArray`
+     */
+    void copySoaElement(llvm::Value* array, ast::ArrayType* type,
+                        llvm::Value* index, llvm::Value* record, bool toArray);
+    /**
+     * Pointer to the first element of the array at `array`. Arrays of a
+     *  static length are stored in place, others are a descriptor holding
+     *  the pointer and the length.
+     */
+    llvm::Value* arrayData(llvm::Value* array, ast::ArrayType* type);
+    llvm::Value* arrayLength(llvm::Value* array, ast::ArrayType* type);
+    /** The array at `array` as a parameter of type `paramType` takes it */
+    llvm::Value* arrayArgument(llvm::Value* array, ast::Expression* arg,
+                               ast::ArrayType* param, llvm::Type* paramType);
+
+    /** Memory in the stack frame of the routine being generated */
+    llvm::AllocaInst* entryAlloca(llvm::Type* type,
+                                  const llvm::Twine& name = "");
+    /** Type of the values of `type`, booleans are i1 */
+    llvm::Type* llvmType(ast::Type* type);
+    /** Type `type` is stored as in memory, booleans are i8 */
+    llvm::Type* memoryType(ast::Type* type);
+    /** Loads a value of `type` stored at `address` */
+    llvm::Value* load(llvm::Value* address, ast::Type* type,
+                      const llvm::Twine& name = "");
+    /** Stores `value` at `address` as a value of `type`, converting it */
+    void store(llvm::Value* value, llvm::Value* address, ast::Type* type);
+    /** `value` converted to a value of `type` as it is stored in memory */
+    llvm::Value* toMemory(llvm::Value* value, ast::Type* type);
+    /** Arrays and records, which are worked with through their address */
+    bool isAggregate(ast::Type* type);
+    /**
+     * Records and arrays stored in place rather than through a descriptor,
+     *  which are passed by reference
+     */
+    bool isInline(ast::Type* type);
+    bool isLiteral(ast::Expression* node);
+    /** Whether the runtime can call the function from the command line */
+    bool hasScalarSignature(llvm::Function& F);
+    /** The value converted the way an assignment to `type` converts it */
+    llvm::Value* convert(llvm::Value* value, llvm::Type* type);
+    llvm::Value* toBool(llvm::Value* value);
+
     bool anyIsFloat(std::initializer_list<llvm::Value*> values) {
         for (auto& val : values) {
             if (val->getType()->isFloatingPointTy()) {
@@ -88,6 +295,85 @@ private:
     }
 };
 
-void generateIntermediateCpp(std::string, CodeGenerator&);
+/**
+ * Generates a program as several modules at once. The routines are split
+ *  into contiguous runs, one per module, and every module declares the
+ *  routines of the others. Each module has a code generator of its own, with
+ *  its own context and target machine, so they are generated, optimized and
+ *  emitted on separate threads without sharing any LLVM state.
+ *
+ * With a single job there is a single module, the same one CodeGenerator
+ *  would generate.
+ */
+class ParallelCodeGenerator {
+public:
+    /** Uses up to `jobs` threads and modules, one per hardware thread if 0 */
+    ParallelCodeGenerator(std::string name = "anonymous",
+                          const TargetConfig& target = {}, unsigned jobs = 1);
+
+    void generate(ast::Program* node);
+    /** Adds the entry point of an executable to the first module */
+    bool generateMain();
+    void optimize();
+    void print(llvm::raw_ostream& stream = llvm::errs());
+    /**
+     * Object code of the program: the object of the module if there is just
+     *  one, an archive of the objects of all of them otherwise. nullptr if
+     *  the target cannot emit any.
+     */
+    std::unique_ptr<llvm::MemoryBuffer> emitObject();
+    void emitCode(std::string filename = "output.o");
+
+    /** Errors of all the modules, in the order of the source */
+    std::vector<ast::Error> getErrors() const;
+    /** Layouts of the record types of all the modules */
+    std::vector<RecordLayout> getLayouts() const;
+    const std::vector<std::unique_ptr<CodeGenerator>>& getParts() const {
+        return m_parts;
+    }
+
+private:
+    std::string m_name;
+    TargetConfig m_target;
+    unsigned m_jobs;
+    std::vector<std::unique_ptr<CodeGenerator>> m_parts;
+};
+
+/**
+ * Runs the code of a module in the compiler's own process instead of linking
+ *  it into an executable. Any function of the process can be called from it.
+ */
+class Jit {
+public:
+    Jit();
+    ~Jit();
+
+    /**
+     * Compiles the modules of `codegen` and prepares `routine` to be called.
+     *  Adds a routine to its module to call it through, so nothing should be
+     *  done with the modules afterwards. Returns false if it cannot.
+     */
+    bool load(ParallelCodeGenerator& codegen, const std::string& routine);
+    /**
+     * Calls the loaded routine with `args` converted to the types of its
+     *  parameters and sets `result` to the value it returns, which is empty if
+     *  it returns nothing. Returns false if the arguments do not fit.
+     */
+    bool call(const std::vector<std::string>& args, std::string& result);
+
+    const std::string& getError() const { return m_error; }
+
+private:
+    std::unique_ptr<llvm::orc::LLJIT> m_jit;
+    std::string m_error;
+    // Types of the parameters and the return value of the loaded routine
+    std::vector<llvm::Type::TypeID> m_params;
+    std::vector<unsigned> m_paramBits;
+    llvm::Type::TypeID m_return = llvm::Type::VoidTyID;
+    unsigned m_returnBits = 0;
+    uint64_t (*m_entry)(const uint64_t*) = nullptr;
+
+    bool fail(std::string error);
+};
 
 } // namespace cg
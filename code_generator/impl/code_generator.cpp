@@ -1,10 +1,45 @@
 #include "code_generator.hpp"
+#include "runtime.h"
 
 using namespace llvm;
 
 namespace cg {
 
-CodeGenerator::CodeGenerator(std::string name) : m_builder(m_context) {
+namespace {
+
+// Alignment of the elements of arrays, that of a cache line, so that
+//  vectorized loops over them need no peeling
+const uint64_t arrayAlignment = 64;
+
+} // namespace
+
+TargetConfig TargetConfig::resolved() const {
+    if (cpu != "native") {
+        return *this;
+    }
+
+    TargetConfig host = *this;
+    host.cpu = sys::getHostCPUName().str();
+    // Sorted, so the same host always gets the same string
+    StringMap<bool> hostFeatures;
+    std::vector<std::string> features;
+    if (sys::getHostCPUFeatures(hostFeatures)) {
+        for (auto& feature : hostFeatures) {
+            features.push_back((feature.getValue() ? "+" : "-") +
+                               feature.getKey().str());
+        }
+    }
+    std::sort(features.begin(), features.end());
+    // Features given explicitly come last to override those of the host
+    if (!this->features.empty()) {
+        features.push_back(this->features);
+    }
+    host.features = join(features, ",");
+    return host;
+}
+
+CodeGenerator::CodeGenerator(std::string name, const TargetConfig& target)
+    : m_builder(m_context), m_target(target.resolved()) {
     m_module = std::make_unique<Module>(name, m_context);
     auto TargetTriple = sys::getDefaultTargetTriple();
     InitializeAllTargetInfos();
@@ -23,42 +58,101 @@ CodeGenerator::CodeGenerator(std::string name) : m_builder(m_context) {
         errs() << Error;
         return;
     }
-    auto CPU = "generic";
-    auto Features = "";
+    static const CodeGenOpt::Level codeGenLevels[] = {
+        CodeGenOpt::None,
+        CodeGenOpt::Less,
+        CodeGenOpt::Default,
+        CodeGenOpt::Aggressive,
+    };
+    if (m_target.optLevel > 3) {
+        m_target.optLevel = 3;
+    }
 
     TargetOptions opt;
-    auto RM = Optional<Reloc::Model>();
-    m_targetMachine =
-        Target->createTargetMachine(TargetTriple, CPU, Features, opt, RM);
+    // Toolchains link position-independent executables by default
+    auto RM = Optional<Reloc::Model>(Reloc::PIC_);
+    m_targetMachine.reset(Target->createTargetMachine(
+        TargetTriple, m_target.cpu, m_target.features, opt, RM, None,
+        codeGenLevels[m_target.optLevel]));
 
     m_module->setDataLayout(m_targetMachine->createDataLayout());
     m_module->setTargetTriple(TargetTriple);
 }
 
 void CodeGenerator::visit(ast::Program* node) {
+    generate(node, 0, node->routines.size());
+}
+
+void CodeGenerator::generate(ast::Program* node, std::size_t first,
+                             std::size_t last) {
     for (auto& type : node->types) {
         type->accept(*this);
     }
+    // Global variables are defined by the module with the first routines,
+    //  the others refer to them
     for (auto& var : node->variables) {
-        var->accept(*this);
+        declareGlobal(var.get(), first == 0);
     }
+    // Routines may call those declared after them
     for (auto& routine : node->routines) {
-        routine->accept(*this);
+        declare(routine.get());
+    }
+    for (std::size_t i = first; i < last; i++) {
+        node->routines[i]->accept(*this);
     }
 }
 
-void CodeGenerator::visit(ast::RoutineDecl* node) {
-    // Types of the parameters
+void CodeGenerator::declareGlobal(ast::VariableDecl* node, bool define) {
+    if (node->type->asArray() != nullptr && !isInline(node->type.get())) {
+        error(node->begin,
+              "the length of a global array must be known at compile time");
+    }
+    auto type = memoryType(node->type.get());
+    Constant* init = nullptr;
+    if (define) {
+        init = Constant::getNullValue(type);
+        if (node->initialValue != nullptr) {
+            // Constant expressions are folded into literals by now, which
+            //  need no function to be generated in
+            Constant* value = nullptr;
+            if (isLiteral(node->initialValue.get())) {
+                node->initialValue->accept(*this);
+                value = dyn_cast_or_null<Constant>(
+                    toMemory(extractTempVal(), node->type.get()));
+            }
+            if (value == nullptr) {
+                error(node->initialValue->begin,
+                      "the initial value of a global variable must be "
+                      "constant");
+            } else {
+                init = value;
+            }
+        }
+    }
+    m_globals[node->name] =
+        new GlobalVariable(*m_module, type, false, GlobalValue::ExternalLinkage,
+                           init, node->name);
+}
+
+Function* CodeGenerator::declare(ast::RoutineDecl* node) {
+    if (auto F = m_module->getFunction(node->name)) {
+        return F;
+    }
+
+    // Types of the parameters, arrays of a known length are passed by
+    //  reference
     std::vector<Type*> paramTypes;
     for (auto& param : node->parameters) {
-        param->type->accept(*this);
-        paramTypes.push_back(extractTempType());
+        auto type = llvmType(param->type.get());
+        if (isInline(param->type.get())) {
+            type = PointerType::getUnqual(type);
+        }
+        paramTypes.push_back(type);
     }
     // The routine's return type
     Type* returnType = Type::getVoidTy(m_context);
     if (node->returnType != nullptr) {
-        node->returnType->accept(*this);
-        returnType = extractTempType();
+        returnType = llvmType(node->returnType.get());
     }
 
     // The function's type: (return type, parameter types, varargs?)
@@ -68,27 +162,66 @@ void CodeGenerator::visit(ast::RoutineDecl* node) {
     //  given name
     Function* F = Function::Create(FT, Function::ExternalLinkage, node->name,
                                    m_module.get());
+    // The same machine the module is emitted for, should the IR be compiled
+    //  elsewhere
+    F->addFnAttr("target-cpu", m_target.cpu);
+    if (!m_target.features.empty()) {
+        F->addFnAttr("target-features", m_target.features);
+    }
 
     // Give the parameters their names
     unsigned idx = 0;
     for (auto& arg : F->args()) {
         arg.setName(node->parameters[idx++]->name);
     }
+    return F;
+}
+
+void CodeGenerator::visit(ast::RoutineDecl* node) {
+    Function* F = declare(node);
+    m_routine = node;
+    auto errors = getErrors().size();
 
     // Create a new basic block to start inserting into
     BasicBlock* BB = BasicBlock::Create(m_context, "entry", F);
     // Tell the builder that upcoming instructions should go into this block
     m_builder.SetInsertPoint(BB);
 
-    // Record the function arguments in the NamedValues map
+    // Parameters live in memory like any other variable, except for arrays
+    //  and records passed by reference, which are there already
     m_namedValues.clear();
+    m_heapArrays.clear();
     for (auto& Arg : F->args()) {
-        m_namedValues[Arg.getName()] = &Arg;
+        auto name = Arg.getName().str();
+        if (Arg.getType()->isPointerTy()) {
+            m_namedValues[name] = &Arg;
+            continue;
+        }
+        auto type = node->parameters[Arg.getArgNo()]->type.get();
+        auto slot = entryAlloca(memoryType(type), name);
+        store(&Arg, slot, type);
+        m_namedValues[name] = slot;
     }
 
-    node->body->accept(*this);
+    node->getBody()->accept(*this);
 
-    verifyFunction(*F);
+    // Only routines without a result may run off their end
+    if (m_builder.GetInsertBlock()->getTerminator() == nullptr) {
+        if (F->getReturnType()->isVoidTy()) {
+            freeHeapArrays();
+            m_builder.CreateRetVoid();
+        } else {
+            m_builder.CreateUnreachable();
+        }
+    }
+
+    // Code for a routine with errors of its own is expected to be incomplete
+    std::string problems;
+    raw_string_ostream stream(problems);
+    if (verifyFunction(*F, &stream) && getErrors().size() == errors) {
+        error(node->begin, "generated invalid code for routine '{}': {}",
+              node->name, StringRef(stream.str()).rtrim());
+    }
 
     tempVal = F;
 }
@@ -111,38 +244,229 @@ void CodeGenerator::visit(ast::BooleanType* node) {
 }
 
 void CodeGenerator::visit(ast::ArrayType* node) {
-    // TODO
+    if (isStructOfArrays(node)) {
+        // An array for every field, in the order the fields are in a record
+        auto record = layOut(node->elementType->asRecord(), "").type;
+        std::vector<Type*> fields;
+        for (auto field : record->elements()) {
+            fields.push_back(llvm::ArrayType::get(field, *node->staticLength));
+        }
+        tempType = StructType::get(m_context, fields);
+        return;
+    }
+    auto element = memoryType(node->elementType.get());
+    if (node->staticLength) {
+        // Stored in place, rows of nested arrays one after another
+        tempType = llvm::ArrayType::get(element, *node->staticLength);
+    } else {
+        // Elements on the heap or somewhere else, see `arrayData`
+        tempType = StructType::get(
+            m_context,
+            {PointerType::getUnqual(element), Type::getInt64Ty(m_context)});
+    }
 }
 
 void CodeGenerator::visit(ast::RecordType* node) {
-    // TODO
+    tempType = layOut(node, "").type;
+}
+
+const CodeGenerator::Record& CodeGenerator::layOut(ast::RecordType* node,
+                                                   const std::string& name) {
+    auto known = m_records.find(node);
+    if (known != m_records.end()) {
+        return known->second;
+    }
+
+    std::vector<Type*> fieldTypes;
+    for (auto& field : node->fields) {
+        if (field->type->asArray() != nullptr && !isInline(field->type.get())) {
+            error(field->begin, "the length of an array in a record must be "
+                                "known at compile time");
+        }
+        fieldTypes.push_back(memoryType(field->type.get()));
+    }
+
+    // From the most aligned field to the least, every field starts right
+    //  where the one before it ends, as sizes are multiples of alignments.
+    //  Ties keep the order of declaration.
+    std::vector<unsigned> order(fieldTypes.size());
+    std::iota(order.begin(), order.end(), 0);
+    if (m_target.reorderFields) {
+        auto& layout = m_module->getDataLayout();
+        std::stable_sort(order.begin(), order.end(),
+                         [&](unsigned a, unsigned b) {
+                             return layout.getABITypeAlign(fieldTypes[a]) >
+                                    layout.getABITypeAlign(fieldTypes[b]);
+                         });
+    }
+
+    Record record;
+    record.node = node;
+    record.name = name;
+    record.slots.resize(order.size());
+    std::vector<Type*> slotTypes;
+    for (unsigned slot = 0; slot < order.size(); slot++) {
+        record.slots[order[slot]] = slot;
+        slotTypes.push_back(fieldTypes[order[slot]]);
+    }
+    record.type = StructType::create(
+        m_context, slotTypes, name.empty() ? "record" : "record." + name);
+    return m_records.emplace(node, std::move(record)).first->second;
+}
+
+std::vector<RecordLayout> CodeGenerator::getLayouts() {
+    auto& layout = m_module->getDataLayout();
+    std::vector<RecordLayout> layouts;
+    for (auto& [node, record] : m_records) {
+        auto structLayout = layout.getStructLayout(record.type);
+        RecordLayout result;
+        result.name = record.name;
+        result.pos = node->begin;
+        result.size = structLayout->getSizeInBytes();
+        result.alignment = structLayout->getAlignment().value();
+        result.padding = result.size;
+
+        std::vector<Type*> declared;
+        for (std::size_t i = 0; i < node->fields.size(); i++) {
+            auto slot = record.slots[i];
+            auto type = record.type->getElementType(slot);
+            declared.push_back(type);
+            RecordLayout::Field field;
+            field.name = node->fields[i]->name;
+            field.offset = structLayout->getElementOffset(slot);
+            field.size = layout.getTypeAllocSize(type).getFixedSize();
+            result.padding -= field.size;
+            result.fields.push_back(field);
+        }
+        result.declaredSize =
+            layout.getTypeAllocSize(StructType::get(m_context, declared))
+                .getFixedSize();
+        std::sort(result.fields.begin(), result.fields.end(),
+                  [](auto& a, auto& b) { return a.offset < b.offset; });
+        layouts.push_back(std::move(result));
+    }
+    std::sort(layouts.begin(), layouts.end(),
+              [](auto& a, auto& b) { return a.pos < b.pos; });
+    return layouts;
 }
 
 void CodeGenerator::visit(ast::VariableDecl* node) {
-    node->type->accept(*this);
-    auto type = extractTempType();
-    auto v = m_builder.CreateAlloca(type, 0, node->name);
-
-    if (node->type->getTypeKind() == ast::TypeKind::Array ||
-        node->type->getTypeKind() == ast::TypeKind::Record) {
-        node->type->accept(*this);
-        m_builder.CreateStore(extractTempVal(), v);
-    } else {
-        if (node->initialValue != nullptr) {
-            node->initialValue->accept(*this);
-            m_builder.CreateStore(extractTempVal(), v);
+    auto array = node->type->asArray();
+    // Only the outermost array is allocated along with its variable
+    for (auto inner = array; inner != nullptr;
+         inner = inner->elementType->asArray()) {
+        if (inner != array && !inner->staticLength) {
+            error(node->begin, "the length of the elements of an array must "
+                               "be known at compile time");
+            break;
         }
     }
+    if (array != nullptr && !array->staticLength) {
+        declareHeapArray(node, array);
+        return;
+    }
+
+    auto v = entryAlloca(memoryType(node->type.get()), node->name);
+    if (array != nullptr) {
+        v->setAlignment(Align(arrayAlignment));
+    }
+    if (node->initialValue != nullptr) {
+        assign(v, node->type.get(), node->initialValue.get());
+    }
     m_namedValues[node->name] = v;
 
     tempVal = v;
 }
 
+void CodeGenerator::declareHeapArray(ast::VariableDecl* node,
+                                     ast::ArrayType* array) {
+    auto int64 = Type::getInt64Ty(m_context);
+    auto type = cast<StructType>(llvmType(array));
+    auto element = memoryType(array->elementType.get());
+
+    // The elements are freed at the end of the body, or on a return before
+    //  that, see `visit(ast::Body*)`
+    auto descriptor = entryAlloca(type, node->name);
+    m_heapArrays.push_back(descriptor);
+
+    array->length->accept(*this);
+    auto length = convert(extractTempVal(), int64);
+    m_builder.CreateStore(allocateElements(element, length, node->name),
+                          m_builder.CreateStructGEP(type, descriptor, 0));
+    m_builder.CreateStore(length,
+                          m_builder.CreateStructGEP(type, descriptor, 1));
+
+    m_namedValues[node->name] = descriptor;
+    tempVal = descriptor;
+}
+
+Value* CodeGenerator::allocateElements(Type* element, Value* length,
+                                       const Twine& name) {
+    auto int64 = Type::getInt64Ty(m_context);
+    auto bytes = Type::getInt8PtrTy(m_context);
+    // aligned_alloc wants a multiple of the alignment
+    auto size = m_builder.CreateMul(
+        length, ConstantInt::get(int64, m_module->getDataLayout()
+                                            .getTypeAllocSize(element)
+                                            .getFixedSize()));
+    size = m_builder.CreateAnd(
+        m_builder.CreateAdd(size, ConstantInt::get(int64, arrayAlignment - 1)),
+        ConstantInt::get(int64, ~uint64_t(arrayAlignment - 1)));
+    auto alloc = m_module->getOrInsertFunction(
+        "aligned_alloc", FunctionType::get(bytes, {int64, int64}, false));
+    auto data = m_builder.CreateCall(
+        alloc, {ConstantInt::get(int64, arrayAlignment), size}, name);
+    return m_builder.CreateBitCast(data, PointerType::getUnqual(element));
+}
+
+Value* CodeGenerator::heapCopy(Value* array, ast::ArrayType* type,
+                               StructType* descriptor) {
+    auto element = memoryType(type->elementType.get());
+    auto length = arrayLength(array, type);
+    auto data = allocateElements(element, length, "copy");
+    auto size = m_builder.CreateMul(
+        length, ConstantInt::get(Type::getInt64Ty(m_context),
+                                 m_module->getDataLayout()
+                                     .getTypeAllocSize(element)
+                                     .getFixedSize()));
+    auto align = m_module->getDataLayout().getABITypeAlign(element);
+    m_builder.CreateMemCpy(data, Align(arrayAlignment), arrayData(array, type),
+                           align, size);
+    Value* result = UndefValue::get(descriptor);
+    result = m_builder.CreateInsertValue(result, data, 0);
+    return m_builder.CreateInsertValue(result, length, 1);
+}
+
+void CodeGenerator::freeHeapArrays(std::size_t first, AllocaInst* kept) {
+    if (m_heapArrays.size() <= first) {
+        return;
+    }
+    auto bytes = Type::getInt8PtrTy(m_context);
+    auto free = m_module->getOrInsertFunction(
+        "free", FunctionType::get(Type::getVoidTy(m_context), {bytes}, false));
+    for (auto i = first; i < m_heapArrays.size(); i++) {
+        auto descriptor = m_heapArrays[i];
+        if (descriptor == kept) {
+            continue;
+        }
+        auto type = cast<StructType>(descriptor->getAllocatedType());
+        auto data = m_builder.CreateLoad(
+            type->getElementType(0),
+            m_builder.CreateStructGEP(type, descriptor, 0));
+        m_builder.CreateCall(free, {m_builder.CreateBitCast(data, bytes)});
+    }
+}
+
 void CodeGenerator::visit(ast::TypeDecl* node) {
-    // Nothing to do here. all type aliases should have already been replaced
+    // All type aliases should have already been replaced, records are only
+    //  laid out here so that they are named after the declaration
+    if (auto record = node->type->asRecord()) {
+        layOut(record, node->name);
+    }
 }
 
 void CodeGenerator::visit(ast::Body* node) {
+    auto heapArrays = m_heapArrays.size();
     for (auto& type : node->types) {
         type->accept(*this);
     }
@@ -152,23 +476,169 @@ void CodeGenerator::visit(ast::Body* node) {
     for (auto& statement : node->statements) {
         statement->accept(*this);
     }
+    // Arrays on the heap live as long as the body they are declared in, so
+    //  a loop does not keep those of every iteration
+    if (m_builder.GetInsertBlock()->getTerminator() == nullptr) {
+        freeHeapArrays(heapArrays);
+    }
+    m_heapArrays.resize(heapArrays);
 }
 
 void CodeGenerator::visit(ast::ReturnStatement* node) {
+    Function* F = m_builder.GetInsertBlock()->getParent();
     Value* returnValue = nullptr;
+    // An array on the heap being returned is the caller's to free
+    AllocaInst* kept = nullptr;
     if (node->expression != nullptr) {
+        auto type = F->getReturnType();
+        auto array = m_routine->returnType != nullptr
+                         ? m_routine->returnType->asArray()
+                         : nullptr;
         node->expression->accept(*this);
         returnValue = extractTempVal();
+        if (returnValue != nullptr && array != nullptr && !isInline(array)) {
+            auto source = node->expression->type->asArray();
+            if (source == nullptr ||
+                memoryType(source->elementType.get()) !=
+                    memoryType(array->elementType.get())) {
+                error(node->expression->begin,
+                      "cannot return a value of another type than the "
+                      "routine's");
+                return;
+            }
+            if (isStructOfArrays(source)) {
+                error(node->expression->begin,
+                      "an array of records stored as a structure of arrays "
+                      "can only be returned as one of its length");
+                return;
+            }
+            // Arrays of the routine's own are handed over, any other is
+            //  copied
+            auto owned = std::find(m_heapArrays.begin(), m_heapArrays.end(),
+                                   returnValue);
+            if (owned != m_heapArrays.end()) {
+                kept = *owned;
+                returnValue = m_builder.CreateLoad(type, kept);
+            } else {
+                returnValue =
+                    heapCopy(returnValue, source, cast<StructType>(type));
+            }
+        } else if (returnValue != nullptr &&
+                   isInline(node->expression->type.get())) {
+            // Arrays and records are returned by value
+            if (llvmType(node->expression->type.get()) != type) {
+                error(node->expression->begin,
+                      "cannot return a value of another type than the "
+                      "routine's");
+                return;
+            }
+            returnValue = m_builder.CreateLoad(type, returnValue);
+        } else {
+            returnValue = convert(returnValue, type);
+        }
+    }
+    freeHeapArrays(0, kept);
+    if (returnValue != nullptr) {
+        m_builder.CreateRet(returnValue);
+    } else {
+        m_builder.CreateRetVoid();
     }
-    m_builder.CreateRet(returnValue);
+    // Statements after a return are unreachable, but still need a block
+    m_builder.SetInsertPoint(BasicBlock::Create(m_context, "afterreturn", F));
 }
 
 void CodeGenerator::visit(ast::Assignment* node) {
-    node->lhs->accept(*this);
-    auto lhs = extractTempVal();
-    node->rhs->accept(*this);
-    auto rhs = extractTempVal();
-    m_builder.CreateStore(rhs, lhs);
+    if (auto element = soaElement(node->lhs.get())) {
+        // Assigned as a whole record first, then scattered to the arrays
+        auto array = element->operand1->type->asArray();
+        auto [base, index] = arrayAccess(element);
+        if (base != nullptr) {
+            auto record = entryAlloca(llvmType(element->type.get()), "elemtmp");
+            assign(record, element->type.get(), node->rhs.get());
+            copySoaElement(base, array, index, record, true);
+        }
+        return;
+    }
+    auto lhs = address(node->lhs.get());
+    if (lhs != nullptr) {
+        assign(lhs, node->lhs->type.get(), node->rhs.get());
+    }
+}
+
+void CodeGenerator::assign(Value* target, ast::Type* type,
+                           ast::Expression* expression) {
+    expression->accept(*this);
+    auto value = extractTempVal();
+    if (value == nullptr) {
+        return;
+    }
+    if (auto array = type->asArray()) {
+        auto source = expression->type->asArray();
+        if (source == nullptr) {
+            error(expression->begin, "only an array can be assigned to one");
+            return;
+        }
+        copyArray(target, array, value, source, expression);
+        return;
+    }
+    if (type->asRecord() != nullptr) {
+        auto recordType = llvmType(type);
+        if (!isAggregate(expression->type.get()) ||
+            llvmType(expression->type.get()) != recordType) {
+            error(expression->begin,
+                  "only a record of the same type can be assigned to one");
+            return;
+        }
+        auto& layout = m_module->getDataLayout();
+        auto align = layout.getABITypeAlign(recordType);
+        m_builder.CreateMemCpy(target, align, value, align,
+                               layout.getTypeAllocSize(recordType));
+        return;
+    }
+    store(value, target, type);
+}
+
+void CodeGenerator::copyArray(Value* target, ast::ArrayType* type,
+                              Value* source, ast::ArrayType* sourceType,
+                              ast::Expression* expression) {
+    auto element = memoryType(type->elementType.get());
+    if (element != memoryType(sourceType->elementType.get())) {
+        error(expression->begin,
+              "cannot assign arrays of different element types");
+        return;
+    }
+    if (isStructOfArrays(type) || isStructOfArrays(sourceType)) {
+        auto arrays = llvmType(type);
+        if (arrays != llvmType(sourceType)) {
+            error(expression->begin,
+                  "arrays of records stored as structures of arrays can only "
+                  "be assigned arrays of the same length");
+            return;
+        }
+        auto& layout = m_module->getDataLayout();
+        auto align = layout.getABITypeAlign(arrays);
+        m_builder.CreateMemMove(target, align, source, align,
+                                layout.getTypeAllocSize(arrays));
+        return;
+    }
+    // Arrays of different lengths share as many elements as the shorter one
+    //  has
+    auto length = arrayLength(target, type);
+    auto sourceLength = arrayLength(source, sourceType);
+    if (length != sourceLength) {
+        length = m_builder.CreateSelect(
+            m_builder.CreateICmpULT(length, sourceLength), length,
+            sourceLength);
+    }
+    auto size = m_builder.CreateMul(
+        length,
+        ConstantInt::get(Type::getInt64Ty(m_context),
+                         m_module->getDataLayout()
+                             .getTypeAllocSize(element)
+                             .getFixedSize()));
+    auto align = m_module->getDataLayout().getABITypeAlign(element);
+    m_builder.CreateMemMove(arrayData(target, type), align,
+                            arrayData(source, sourceType), align, size);
 }
 
 void CodeGenerator::visit(ast::WhileLoop* node) {
@@ -183,10 +653,17 @@ void CodeGenerator::visit(ast::WhileLoop* node) {
     m_builder.CreateBr(conditionBB);
     // Start insertion in conditionBB.
     m_builder.SetInsertPoint(conditionBB);
+    auto heapArrays = m_heapArrays.size();
     node->condition->accept(*this);
-    Value* condition = extractTempVal();
-    condition = m_builder.CreateICmpNE(
-        condition, ConstantInt::get(m_context, APInt(1, 0)), "loopcond");
+    Value* condition = toBool(extractTempVal());
+    if (condition == nullptr) {
+        error(node->condition->begin, "Cannot understand the condition");
+        return;
+    }
+    // Arrays returned by calls in the condition are done with once it is
+    //  evaluated, which happens on every iteration
+    freeHeapArrays(heapArrays);
+    m_heapArrays.resize(heapArrays);
     m_builder.CreateCondBr(condition, loopBB, endBB);
 
     TheFunction->getBasicBlockList().push_back(loopBB);
@@ -201,56 +678,67 @@ void CodeGenerator::visit(ast::WhileLoop* node) {
 }
 
 void CodeGenerator::visit(ast::ForLoop* node) {
-    // TODO: make this function work!!
+    auto int64 = Type::getInt64Ty(m_context);
     Function* func = m_builder.GetInsertBlock()->getParent();
     BasicBlock* condBB = BasicBlock::Create(m_context, "forloopcond", func);
     BasicBlock* loopBB = BasicBlock::Create(m_context, "forloop");
     BasicBlock* endBB = BasicBlock::Create(m_context, "forloopend");
 
-    node->loopVar->accept(*this);
-    auto loopVar = extractTempVal();
-
+    // Both bounds are evaluated once, before the loop
     node->rangeFrom->accept(*this);
-    auto rangeFrom = extractTempVal();
-    m_builder.CreateStore(rangeFrom, loopVar);
-
+    auto rangeFrom = convert(extractTempVal(), int64);
     node->rangeTo->accept(*this);
-    auto rangeTo = extractTempVal();
-    auto endexpr =
-        m_builder.CreateAlloca(Type::getInt64Ty(m_context), 0, "endexpr");
-    m_builder.CreateStore(rangeTo, endexpr);
+    auto rangeTo = convert(extractTempVal(), int64);
+    if (rangeFrom == nullptr || rangeTo == nullptr) {
+        error(node->begin, "Cannot understand the range");
+        return;
+    }
 
+    // The loop variable hides any other of the same name inside the loop
+    auto& name = node->loopVar->name;
+    auto hidden = m_namedValues.find(name) != m_namedValues.end()
+                      ? m_namedValues[name]
+                      : nullptr;
+    auto loopVar = entryAlloca(int64, name);
+    m_namedValues[name] = loopVar;
+
+    // The range includes both bounds, `reverse` walks it from the end
+    m_builder.CreateStore(node->reverse ? rangeTo : rangeFrom, loopVar);
+    auto last = node->reverse ? rangeFrom : rangeTo;
     m_builder.CreateBr(condBB);
     m_builder.SetInsertPoint(condBB);
 
-    auto i = m_builder.CreateLoad(loopVar, "loopvar");
-    auto pred = m_builder.CreateLoad(endexpr, "pred");
+    auto i = m_builder.CreateLoad(int64, loopVar, "loopvar");
     if (node->reverse) {
-        tempVal = m_builder.CreateICmpSGT(i, pred, "comp");
+        tempVal = m_builder.CreateICmpSGE(i, last, "comp");
     } else {
-        tempVal = m_builder.CreateICmpSLT(i, pred, "comp");
+        tempVal = m_builder.CreateICmpSLE(i, last, "comp");
     }
-    m_builder.CreateCondBr(tempVal, loopBB, endBB);
+    m_builder.CreateCondBr(extractTempVal(), loopBB, endBB);
 
     func->getBasicBlockList().push_back(loopBB);
     m_builder.SetInsertPoint(loopBB);
 
     node->body->accept(*this);
 
-    i = m_builder.CreateLoad(loopVar, "loopvarIncr");
+    i = m_builder.CreateLoad(int64, loopVar, "loopvarIncr");
     llvm::Value* incr;
+    // The variable stays within the range, so it never wraps, which lets
+    //  the trip count of the loop be computed
     if (node->reverse) {
-        incr = m_builder.CreateSub(
-            i, ConstantInt::get(m_context, APInt(64, 1, true)));
+        incr = m_builder.CreateNSWSub(i, ConstantInt::get(int64, 1));
     } else {
-        incr = m_builder.CreateAdd(
-            i, ConstantInt::get(m_context, APInt(64, 1, true)));
+        incr = m_builder.CreateNSWAdd(i, ConstantInt::get(int64, 1));
     }
     m_builder.CreateStore(incr, loopVar);
     m_builder.CreateBr(condBB);
     func->getBasicBlockList().push_back(endBB);
 
-    m_namedValues.erase(node->loopVar->name);
+    if (hidden != nullptr) {
+        m_namedValues[name] = hidden;
+    } else {
+        m_namedValues.erase(name);
+    }
     m_builder.SetInsertPoint(endBB);
 }
 
@@ -261,14 +749,8 @@ void CodeGenerator::visit(ast::IfStatement* node) {
         error(node->condition->begin, "Cannot understand the condition");
         return;
     }
-
-    if (condition->getType()->isFloatingPointTy()) {
-        error(node->condition->begin, "Cannot cast real to boolean");
-        return;
-    }
     // Convert condition to a bool by comparing it to 0
-    condition = m_builder.CreateICmpNE(
-        condition, ConstantInt::get(m_context, APInt(1, 0)), "ifcond");
+    condition = toBool(condition);
 
     // Get the current function
     Function* func = m_builder.GetInsertBlock()->getParent();
@@ -288,13 +770,8 @@ void CodeGenerator::visit(ast::IfStatement* node) {
 
     node->ifBody->accept(*this);
 
-    if (hasElse) {
-        // Jump to after the "else" block
-        m_builder.CreateBr(mergeBB);
-    }
-
-    // Code of "then" can change current block; update thenBB for the PHI
-    thenBB = m_builder.GetInsertBlock();
+    // Jump to after the "else" block
+    m_builder.CreateBr(mergeBB);
 
     if (hasElse) {
         // Emit else block
@@ -302,10 +779,7 @@ void CodeGenerator::visit(ast::IfStatement* node) {
         m_builder.SetInsertPoint(elseBB);
 
         node->elseBody->accept(*this);
-        // m_builder.CreateBr(mergeBB); // should not need to explicitly branch
-
-        // Code of 'else' can change the current block; update elseBB for PHI
-        // elseBB = m_builder.GetInsertBlock(); // we don't use PHI
+        m_builder.CreateBr(mergeBB);
     }
 
     // Emit merge block
@@ -314,10 +788,58 @@ void CodeGenerator::visit(ast::IfStatement* node) {
 }
 
 void CodeGenerator::visit(ast::UnaryExpression* node) {
-    // TODO
+    node->operand->accept(*this);
+    auto operand = extractTempVal();
+    if (operand == nullptr) {
+        error(node->begin, "a unary expression needs an operand");
+        return;
+    }
+
+    switch (node->operation) {
+    case lexer::TokenType::Not:
+        tempVal = m_builder.CreateNot(toBool(operand), "nottmp");
+        return;
+    case lexer::TokenType::Sub:
+        if (operand->getType()->isFloatingPointTy()) {
+            tempVal = m_builder.CreateFNeg(operand, "negtmp");
+        } else {
+            tempVal = m_builder.CreateNeg(
+                convert(operand, Type::getInt64Ty(m_context)), "negtmp");
+        }
+        return;
+    case lexer::TokenType::Add:
+        tempVal = operand;
+        return;
+    default:
+        error(node->begin, "invalid unary operator");
+        return;
+    }
 }
 
 void CodeGenerator::visit(ast::BinaryExpression* node) {
+    if (soaElement(node) != nullptr) {
+        // The fields of the element are gathered from their arrays
+        auto array = node->operand1->type->asArray();
+        auto [base, index] = arrayAccess(node);
+        if (base != nullptr) {
+            auto record = entryAlloca(llvmType(node->type.get()), "elemtmp");
+            copySoaElement(base, array, index, record, false);
+            tempVal = record;
+        }
+        return;
+    }
+    if (node->operation == lexer::TokenType::OpenBrack ||
+        node->operation == lexer::TokenType::Dot) {
+        auto element = node->operation == lexer::TokenType::Dot
+                           ? fieldAddress(node)
+                           : elementAddress(node);
+        if (element != nullptr && !isAggregate(node->type.get())) {
+            element = load(element, node->type.get(), "elemtmp");
+        }
+        tempVal = element;
+        return;
+    }
+
     Value *L, *R;
     node->operand1->accept(*this);
     L = extractTempVal();
@@ -330,43 +852,248 @@ void CodeGenerator::visit(ast::BinaryExpression* node) {
         return;
     }
 
+    switch (node->operation) {
+    case lexer::TokenType::And:
+        tempVal = m_builder.CreateAnd(toBool(L), toBool(R), "andtmp");
+        return;
+    case lexer::TokenType::Or:
+        tempVal = m_builder.CreateOr(toBool(L), toBool(R), "ortmp");
+        return;
+    case lexer::TokenType::Xor:
+        tempVal = m_builder.CreateXor(toBool(L), toBool(R), "xortmp");
+        return;
+    default:
+        break;
+    }
+
+    // Both operands are brought to the same type: real if either is, integer
+    //  if either is
+    bool real = anyIsFloat({R, L});
+    if (real) {
+        L = convert(L, Type::getDoubleTy(m_context));
+        R = convert(R, Type::getDoubleTy(m_context));
+    } else if (L->getType() != R->getType()) {
+        L = convert(L, Type::getInt64Ty(m_context));
+        R = convert(R, Type::getInt64Ty(m_context));
+    }
+
     switch (node->operation) {
     case lexer::TokenType::Add:
-        if (anyIsFloat({R, L})) {
-            tempVal = m_builder.CreateFAdd(L, R, "addtmp");
-        } else {
-            tempVal = m_builder.CreateAdd(L, R, "addtmp");
-        }
+        tempVal = real ? m_builder.CreateFAdd(L, R, "addtmp")
+                       : m_builder.CreateAdd(L, R, "addtmp");
         return;
     case lexer::TokenType::Sub:
-        if (anyIsFloat({R, L})) {
-            tempVal = m_builder.CreateFSub(L, R, "subtmp");
-        } else {
-            tempVal = m_builder.CreateSub(L, R, "subtmp");
-        }
+        tempVal = real ? m_builder.CreateFSub(L, R, "subtmp")
+                       : m_builder.CreateSub(L, R, "subtmp");
         return;
     case lexer::TokenType::Mul:
-        if (anyIsFloat({R, L})) {
-            tempVal = m_builder.CreateFMul(L, R, "multmp");
-        } else {
-            tempVal = m_builder.CreateMul(L, R, "multmp");
-        }
+        tempVal = real ? m_builder.CreateFMul(L, R, "multmp")
+                       : m_builder.CreateMul(L, R, "multmp");
+        return;
+    case lexer::TokenType::Div:
+        tempVal = real ? m_builder.CreateFDiv(L, R, "divtmp")
+                       : m_builder.CreateSDiv(L, R, "divtmp");
+        return;
+    case lexer::TokenType::Mod:
+        tempVal = real ? m_builder.CreateFRem(L, R, "modtmp")
+                       : m_builder.CreateSRem(L, R, "modtmp");
         return;
-    // Note: '<' requires both operands to be of the same type
     case lexer::TokenType::Less:
-        if (anyIsFloat({R, L})) {
-            tempVal = m_builder.CreateFCmpOLT(L, R, "cmptmp");
-        } else {
-            tempVal = m_builder.CreateICmpSLT(L, R, "cmptmp");
-        }
+        tempVal = real ? m_builder.CreateFCmpOLT(L, R, "cmptmp")
+                       : m_builder.CreateICmpSLT(L, R, "cmptmp");
+        return;
+    case lexer::TokenType::Leq:
+        tempVal = real ? m_builder.CreateFCmpOLE(L, R, "cmptmp")
+                       : m_builder.CreateICmpSLE(L, R, "cmptmp");
+        return;
+    case lexer::TokenType::Greater:
+        tempVal = real ? m_builder.CreateFCmpOGT(L, R, "cmptmp")
+                       : m_builder.CreateICmpSGT(L, R, "cmptmp");
+        return;
+    case lexer::TokenType::Geq:
+        tempVal = real ? m_builder.CreateFCmpOGE(L, R, "cmptmp")
+                       : m_builder.CreateICmpSGE(L, R, "cmptmp");
+        return;
+    case lexer::TokenType::Eq:
+        tempVal = real ? m_builder.CreateFCmpOEQ(L, R, "cmptmp")
+                       : m_builder.CreateICmpEQ(L, R, "cmptmp");
+        return;
+    case lexer::TokenType::Neq:
+        tempVal = real ? m_builder.CreateFCmpUNE(L, R, "cmptmp")
+                       : m_builder.CreateICmpNE(L, R, "cmptmp");
         return;
-    // TODO: /, %, =, !=, ., [], <=, >, >=
     default:
         error(node->begin, "invalid binary operator");
         return;
     }
 }
 
+std::pair<Value*, Value*>
+CodeGenerator::arrayAccess(ast::BinaryExpression* node) {
+    auto array = node->operand1->type->asArray();
+    node->operand1->accept(*this);
+    auto base = extractTempVal();
+    node->operand2->accept(*this);
+    auto index = convert(extractTempVal(), Type::getInt64Ty(m_context));
+    if (array == nullptr || base == nullptr || index == nullptr) {
+        error(node->begin, "Cannot understand the array access");
+        return {nullptr, nullptr};
+    }
+
+    // Arrays are indexed from 1. The index is assumed to be within bounds,
+    //  which lets the vectorizer reason about the accesses.
+    index = m_builder.CreateNSWSub(
+        index, ConstantInt::get(index->getType(), 1), "index");
+    return {base, index};
+}
+
+Value* CodeGenerator::elementAddress(ast::BinaryExpression* node) {
+    auto array = node->operand1->type->asArray();
+    if (isStructOfArrays(array)) {
+        error(node->begin, "an element of an array of records stored as a "
+                           "structure of arrays has no address");
+        return nullptr;
+    }
+    auto [base, index] = arrayAccess(node);
+    if (base == nullptr) {
+        return nullptr;
+    }
+    if (array->staticLength) {
+        return m_builder.CreateInBoundsGEP(
+            llvmType(array), base,
+            {ConstantInt::get(index->getType(), 0), index}, "elemptr");
+    }
+    return m_builder.CreateInBoundsGEP(memoryType(array->elementType.get()),
+                                       arrayData(base, array), index,
+                                       "elemptr");
+}
+
+Value* CodeGenerator::fieldAddress(ast::BinaryExpression* node) {
+    auto record = node->operand1->type->asRecord();
+    auto name = dynamic_cast<ast::Identifier*>(node->operand2.get());
+    if (record == nullptr || name == nullptr) {
+        error(node->begin, "Cannot understand the field access");
+        return nullptr;
+    }
+    auto field = record->findField(name->name);
+    auto index =
+        std::find(record->fields.begin(), record->fields.end(), field) -
+        record->fields.begin();
+    auto& layout = layOut(record, "");
+    auto slot = layout.slots[index];
+
+    // The field of an element of a structure of arrays is in an array of its
+    //  own, with those of the other elements
+    if (auto element = soaElement(node->operand1.get())) {
+        auto array = element->operand1->type->asArray();
+        auto [base, elementIndex] = arrayAccess(element);
+        return base != nullptr
+                   ? soaFieldAddress(base, array, elementIndex, slot)
+                   : nullptr;
+    }
+
+    node->operand1->accept(*this);
+    auto base = extractTempVal();
+    if (base == nullptr) {
+        error(node->begin, "Cannot understand the field access");
+        return nullptr;
+    }
+    return m_builder.CreateStructGEP(layout.type, base, slot, name->name);
+}
+
+ast::BinaryExpression* CodeGenerator::soaElement(ast::Expression* node) {
+    auto element = dynamic_cast<ast::BinaryExpression*>(node);
+    if (element == nullptr ||
+        element->operation != lexer::TokenType::OpenBrack ||
+        element->operand1->type == nullptr) {
+        return nullptr;
+    }
+    return isStructOfArrays(element->operand1->type->asArray()) ? element
+                                                                 : nullptr;
+}
+
+Value* CodeGenerator::soaFieldAddress(Value* array, ast::ArrayType* type,
+                                      Value* index, unsigned slot) {
+    auto zero = ConstantInt::get(index->getType(), 0);
+    return m_builder.CreateInBoundsGEP(
+        llvmType(type), array, {zero, m_builder.getInt32(slot), index},
+        "fieldptr");
+}
+
+void CodeGenerator::copySoaElement(Value* array, ast::ArrayType* type,
+                                   Value* index, Value* record,
+                                   bool toArray) {
+    auto recordType = layOut(type->elementType->asRecord(), "").type;
+    auto& layout = m_module->getDataLayout();
+    for (unsigned slot = 0; slot < recordType->getNumElements(); slot++) {
+        auto fieldType = recordType->getElementType(slot);
+        Value* from = soaFieldAddress(array, type, index, slot);
+        Value* to = m_builder.CreateStructGEP(recordType, record, slot);
+        if (toArray) {
+            std::swap(from, to);
+        }
+        if (fieldType->isAggregateType()) {
+            auto align = layout.getABITypeAlign(fieldType);
+            m_builder.CreateMemCpy(to, align, from, align,
+                                   layout.getTypeAllocSize(fieldType));
+        } else {
+            m_builder.CreateStore(m_builder.CreateLoad(fieldType, from), to);
+        }
+    }
+}
+
+Value* CodeGenerator::address(ast::Expression* node) {
+    if (auto identifier = dynamic_cast<ast::Identifier*>(node)) {
+        return variableAddress(identifier);
+    }
+    auto binary = dynamic_cast<ast::BinaryExpression*>(node);
+    if (binary != nullptr &&
+        binary->operation == lexer::TokenType::OpenBrack) {
+        return elementAddress(binary);
+    }
+    if (binary != nullptr && binary->operation == lexer::TokenType::Dot) {
+        return fieldAddress(binary);
+    }
+    error(node->begin,
+          "only variables, their elements and fields can be assigned");
+    return nullptr;
+}
+
+Value* CodeGenerator::variableAddress(ast::Identifier* node) {
+    auto local = m_namedValues.find(node->name);
+    if (local != m_namedValues.end()) {
+        return local->second;
+    }
+    auto global = m_globals.find(node->name);
+    if (global != m_globals.end()) {
+        return global->second;
+    }
+    error(node->begin, "Unknown variable name");
+    return nullptr;
+}
+
+Value* CodeGenerator::arrayData(Value* array, ast::ArrayType* type) {
+    auto llvmArray = llvmType(type);
+    if (type->staticLength) {
+        auto zero = ConstantInt::get(Type::getInt64Ty(m_context), 0);
+        return m_builder.CreateInBoundsGEP(llvmArray, array, {zero, zero});
+    }
+    auto descriptor = cast<StructType>(llvmArray);
+    return m_builder.CreateLoad(descriptor->getElementType(0),
+                                m_builder.CreateStructGEP(descriptor, array, 0),
+                                "data");
+}
+
+Value* CodeGenerator::arrayLength(Value* array, ast::ArrayType* type) {
+    auto int64 = Type::getInt64Ty(m_context);
+    if (type->staticLength) {
+        return ConstantInt::get(int64, *type->staticLength);
+    }
+    auto descriptor = cast<StructType>(llvmType(type));
+    return m_builder.CreateLoad(
+        int64, m_builder.CreateStructGEP(descriptor, array, 1), "length");
+}
+
 void CodeGenerator::visit(ast::IntegerLiteral* node) {
     tempVal = ConstantInt::get(m_context, APInt(64, node->value));
 }
@@ -380,9 +1107,10 @@ void CodeGenerator::visit(ast::BooleanLiteral* node) {
 }
 
 void CodeGenerator::visit(ast::Identifier* node) {
-    auto V = m_namedValues[node->name];
-    if (V == nullptr) {
-        error(node->begin, "Unknown variable name");
+    auto V = variableAddress(node);
+    // Arrays and records are worked with through their address
+    if (V != nullptr && !isAggregate(node->type.get())) {
+        V = load(V, node->type.get(), node->name);
     }
     tempVal = V;
 }
@@ -400,18 +1128,251 @@ void CodeGenerator::visit(ast::RoutineCall* node) {
         return;
     }
 
+    auto routine = node->routine.lock();
     std::vector<Value*> args;
-    for (auto& arg : node->args) {
-        arg->accept(*this);
-        Value* argCode = extractTempVal();
+    // Elements of structures of arrays are passed as a copy, which is copied
+    //  back after the call
+    std::vector<std::tuple<Value*, ast::ArrayType*, Value*, Value*>> copies;
+    for (std::size_t i = 0; i < node->args.size(); i++) {
+        auto& arg = node->args[i];
+        Value* argCode = nullptr;
+        if (auto element = soaElement(arg.get())) {
+            auto array = element->operand1->type->asArray();
+            auto [base, index] = arrayAccess(element);
+            if (base != nullptr) {
+                argCode = entryAlloca(llvmType(element->type.get()), "elemtmp");
+                copySoaElement(base, array, index, argCode, false);
+                copies.emplace_back(base, array, index, argCode);
+            }
+        } else {
+            arg->accept(*this);
+            argCode = extractTempVal();
+        }
         if (argCode == nullptr) {
             error(arg->begin, "what is this?");
             return;
         }
+        auto paramType = CalleeF->getArg(static_cast<unsigned>(i))->getType();
+        auto param = routine != nullptr ? routine->parameters[i]->type.get()
+                                         : nullptr;
+        if (param != nullptr && param->asArray() != nullptr) {
+            argCode =
+                arrayArgument(argCode, arg.get(), param->asArray(), paramType);
+            if (argCode == nullptr) {
+                return;
+            }
+        } else if (param != nullptr && param->asRecord() != nullptr) {
+            // Records are passed by reference
+            if (!isAggregate(arg->type.get()) ||
+                llvmType(arg->type.get()) != llvmType(param)) {
+                error(arg->begin, "expected a record of the parameter's type");
+                return;
+            }
+        } else {
+            argCode = convert(argCode, paramType);
+        }
         args.push_back(argCode);
     }
 
-    tempVal = m_builder.CreateCall(CalleeF, args, "calltmp");
+    auto call = m_builder.CreateCall(CalleeF, args);
+    for (auto& [base, array, index, record] : copies) {
+        copySoaElement(base, array, index, record, true);
+    }
+    auto returnType = CalleeF->getReturnType();
+    if (returnType->isVoidTy()) {
+        tempVal = nullptr;
+    } else if (returnType->isAggregateType()) {
+        // Arrays and records returned by value are worked with through an
+        //  address too
+        auto result = entryAlloca(returnType, "calltmp");
+        result->setAlignment(Align(arrayAlignment));
+        m_builder.CreateStore(call, result);
+        // Arrays on the heap are freed like those of the body the call is in
+        if (routine != nullptr && routine->returnType->asArray() != nullptr &&
+            !isInline(routine->returnType.get())) {
+            m_heapArrays.push_back(result);
+        }
+        tempVal = result;
+    } else {
+        call->setName("calltmp");
+        tempVal = call;
+    }
+}
+
+Value* CodeGenerator::arrayArgument(Value* array, ast::Expression* arg,
+                                    ast::ArrayType* param, Type* paramType) {
+    auto type = arg->type->asArray();
+    if (type == nullptr || memoryType(type->elementType.get()) !=
+                               memoryType(param->elementType.get())) {
+        error(arg->begin, "expected an array of the parameter's element type");
+        return nullptr;
+    }
+    if (isStructOfArrays(type) && !param->staticLength) {
+        error(arg->begin, "an array of records stored as a structure of "
+                          "arrays can only be passed as one of its length");
+        return nullptr;
+    }
+    if (param->staticLength) {
+        if (!type->staticLength ||
+            *type->staticLength != *param->staticLength) {
+            error(arg->begin, "expected an array of length {}",
+                  *param->staticLength);
+            return nullptr;
+        }
+        return array;
+    }
+    // Arrays of any length can be passed as a pointer and a length
+    if (!type->staticLength) {
+        return m_builder.CreateLoad(paramType, array);
+    }
+    Value* descriptor = UndefValue::get(paramType);
+    descriptor = m_builder.CreateInsertValue(descriptor,
+                                             arrayData(array, type), {0});
+    return m_builder.CreateInsertValue(
+        descriptor, arrayLength(array, type), {1});
+}
+
+bool CodeGenerator::isStructOfArrays(ast::ArrayType* type) {
+    return m_target.structOfArrays && type != nullptr && type->staticLength &&
+           type->elementType->asRecord() != nullptr;
+}
+
+bool CodeGenerator::isLiteral(ast::Expression* node) {
+    if (auto unary = dynamic_cast<ast::UnaryExpression*>(node)) {
+        return isLiteral(unary->operand.get());
+    }
+    return dynamic_cast<ast::IntegerLiteral*>(node) != nullptr ||
+           dynamic_cast<ast::RealLiteral*>(node) != nullptr ||
+           dynamic_cast<ast::BooleanLiteral*>(node) != nullptr;
+}
+
+AllocaInst* CodeGenerator::entryAlloca(Type* type, const Twine& name) {
+    // Allocated once when the routine is called, wherever they are used,
+    //  which is also what mem2reg looks for
+    auto& entry = m_builder.GetInsertBlock()->getParent()->getEntryBlock();
+    IRBuilder<> builder(&entry, entry.getFirstInsertionPt());
+    return builder.CreateAlloca(type, nullptr, name);
+}
+
+Type* CodeGenerator::llvmType(ast::Type* type) {
+    type->accept(*this);
+    return extractTempType();
+}
+
+Type* CodeGenerator::memoryType(ast::Type* type) {
+    auto value = llvmType(type);
+    // Booleans take a byte in memory, as in C
+    return value->isIntegerTy(1) ? Type::getInt8Ty(m_context) : value;
+}
+
+Value* CodeGenerator::load(Value* address, ast::Type* type,
+                           const Twine& name) {
+    Value* value = m_builder.CreateLoad(memoryType(type), address, name);
+    // Only 0 and 1 are ever stored as booleans
+    if (llvmType(type)->isIntegerTy(1)) {
+        value = m_builder.CreateTrunc(value, Type::getInt1Ty(m_context));
+    }
+    return value;
+}
+
+void CodeGenerator::store(Value* value, Value* address, ast::Type* type) {
+    m_builder.CreateStore(toMemory(value, type), address);
+}
+
+Value* CodeGenerator::toMemory(Value* value, ast::Type* type) {
+    // Booleans are made 0 or 1 before they are widened to a byte
+    return convert(convert(value, llvmType(type)), memoryType(type));
+}
+
+bool CodeGenerator::isAggregate(ast::Type* type) {
+    return type != nullptr &&
+           (type->asArray() != nullptr || type->asRecord() != nullptr);
+}
+
+bool CodeGenerator::isInline(ast::Type* type) {
+    if (type == nullptr) {
+        return false;
+    }
+    auto array = type->asArray();
+    return type->asRecord() != nullptr ||
+           (array != nullptr && array->staticLength);
+}
+
+Value* CodeGenerator::toBool(Value* value) {
+    return convert(value, Type::getInt1Ty(m_context));
+}
+
+Value* CodeGenerator::convert(Value* value, Type* type) {
+    if (value == nullptr || value->getType() == type) {
+        return value;
+    }
+    auto from = value->getType();
+    if (type->isIntegerTy(1)) {
+        return from->isFloatingPointTy()
+                   ? m_builder.CreateFCmpUNE(
+                         value, ConstantFP::get(from, 0.0), "booltmp")
+                   : m_builder.CreateICmpNE(
+                         value, ConstantInt::get(from, 0), "booltmp");
+    }
+    if (type->isIntegerTy()) {
+        if (from->isFloatingPointTy()) {
+            // Reals are rounded to the nearest integer
+            return m_builder.CreateFPToSI(
+                m_builder.CreateUnaryIntrinsic(Intrinsic::round, value), type,
+                "inttmp");
+        }
+        return m_builder.CreateZExt(value, type, "inttmp");
+    }
+    if (type->isFloatingPointTy()) {
+        return from->isIntegerTy(1)
+                   ? m_builder.CreateUIToFP(value, type, "realtmp")
+                   : m_builder.CreateSIToFP(value, type, "realtmp");
+    }
+    return value;
+}
+
+void CodeGenerator::optimize() {
+#if LLVM_VERSION_MAJOR >= 14
+    using llvm::OptimizationLevel;
+#else
+    using OptimizationLevel = PassBuilder::OptimizationLevel;
+#endif
+    static const OptimizationLevel* levels[] = {
+        &OptimizationLevel::O0,
+        &OptimizationLevel::O1,
+        &OptimizationLevel::O2,
+        &OptimizationLevel::O3,
+    };
+    // The analyses of every IR unit have to know about each other
+    LoopAnalysisManager LAM;
+    FunctionAnalysisManager FAM;
+    CGSCCAnalysisManager CGAM;
+    ModuleAnalysisManager MAM;
+    PassBuilder PB(m_targetMachine.get());
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+    // Even unoptimized code keeps scalars in registers rather than going to
+    //  the stack for every use
+    if (m_target.optLevel == 0) {
+        FunctionPassManager FPM;
+        FPM.addPass(PromotePass());
+        for (auto& F : *m_module) {
+            if (!F.isDeclaration()) {
+                FPM.run(F, FAM);
+            }
+        }
+        return;
+    }
+
+    // SROA/mem2reg, instcombine, GVN, LICM, the inliner and the loop
+    //  vectorizer are all part of the default pipelines
+    ModulePassManager MPM =
+        PB.buildPerModuleDefaultPipeline(*levels[m_target.optLevel]);
+    MPM.run(*m_module, MAM);
 }
 
 void CodeGenerator::emitCode(std::string filename) {
@@ -423,16 +1384,170 @@ void CodeGenerator::emitCode(std::string filename) {
         return;
     }
 
+    if (auto object = emitObject()) {
+        dest << object->getBuffer();
+    }
+    dest.flush();
+}
+
+std::unique_ptr<MemoryBuffer> CodeGenerator::emitObject() {
+    SmallVector<char, 0> object;
+    raw_svector_ostream dest(object);
+
     legacy::PassManager pass;
     auto FileType = CGFT_ObjectFile;
 
     if (m_targetMachine->addPassesToEmitFile(pass, dest, nullptr, FileType)) {
         errs() << "TargetMachine can't emit a file of this type";
-        return;
+        return nullptr;
     }
 
     pass.run(*m_module);
-    dest.flush();
+    return std::make_unique<SmallVectorMemoryBuffer>(std::move(object));
+}
+
+bool CodeGenerator::generateMain() {
+    if (m_module->getFunction("main")) {
+        return false;
+    }
+    // Routines generated by other code generators are declared here too
+    std::vector<Function*> routines;
+    for (auto& F : m_module->functions()) {
+        if (!F.isIntrinsic() && hasScalarSignature(F)) {
+            routines.push_back(&F);
+        }
+    }
+
+    auto int8 = Type::getInt8Ty(m_context);
+    auto int32 = Type::getInt32Ty(m_context);
+    auto int64 = Type::getInt64Ty(m_context);
+    auto real = Type::getDoubleTy(m_context);
+    auto string = Type::getInt8PtrTy(m_context);
+    auto strings = PointerType::getUnqual(string);
+    // Mirrors riddle_entry and riddle_routine of the runtime
+    auto entryType = FunctionType::get(int32, {strings}, false);
+    auto routineType = StructType::create(
+        m_context, {int64, string, int32, PointerType::getUnqual(entryType)},
+        "riddle_routine");
+    auto declare = [&](const char* name, Type* result,
+                       ArrayRef<Type*> params) {
+        return m_module->getOrInsertFunction(
+            name, FunctionType::get(result, params, false));
+    };
+    auto riddleMain =
+        declare("riddle_main", int32,
+                {int32, strings, PointerType::getUnqual(routineType), int64});
+
+    // Every routine gets an entry that parses its arguments, calls it and
+    //  prints the result, all through the runtime
+    std::vector<std::pair<uint64_t, Constant*>> entries;
+    for (auto routine : routines) {
+        auto name = routine->getName().str();
+        Function* entry = Function::Create(entryType, Function::InternalLinkage,
+                                           "riddle.entry." + name,
+                                           m_module.get());
+        m_builder.SetInsertPoint(BasicBlock::Create(m_context, "entry", entry));
+
+        std::vector<Value*> values;
+        for (auto& param : routine->args()) {
+            auto type = param.getType();
+            const char* parser = "riddle_parse_real";
+            Type* slotType = real;
+            if (type->isIntegerTy(1)) {
+                parser = "riddle_parse_boolean";
+                slotType = int8;
+            } else if (type->isIntegerTy()) {
+                parser = "riddle_parse_integer";
+                slotType = int64;
+            }
+            auto slot = entryAlloca(slotType);
+            auto text = m_builder.CreateLoad(
+                string, m_builder.CreateConstGEP1_64(string, entry->getArg(0),
+                                                     param.getArgNo()));
+            auto status = m_builder.CreateCall(
+                declare(parser, int32,
+                        {string, PointerType::getUnqual(slotType)}),
+                {text, slot});
+
+            auto invalid = BasicBlock::Create(m_context, "invalid", entry);
+            auto parsed = BasicBlock::Create(m_context, "parsed", entry);
+            m_builder.CreateCondBr(
+                m_builder.CreateICmpEQ(status, ConstantInt::get(int32, 0)),
+                parsed, invalid);
+            m_builder.SetInsertPoint(invalid);
+            m_builder.CreateRet(status);
+
+            m_builder.SetInsertPoint(parsed);
+            Value* value = m_builder.CreateLoad(slotType, slot);
+            if (type->isIntegerTy(1)) {
+                value = m_builder.CreateTrunc(value, type);
+            }
+            values.push_back(value);
+        }
+
+        Value* result = m_builder.CreateCall(routine, values);
+        auto type = routine->getReturnType();
+        if (type->isIntegerTy(1)) {
+            m_builder.CreateCall(
+                declare("riddle_print_boolean", Type::getVoidTy(m_context),
+                        {int8}),
+                {m_builder.CreateZExt(result, int8)});
+        } else if (type->isIntegerTy()) {
+            m_builder.CreateCall(declare("riddle_print_integer",
+                                         Type::getVoidTy(m_context), {int64}),
+                                 {result});
+        } else if (type->isFloatingPointTy()) {
+            m_builder.CreateCall(declare("riddle_print_real",
+                                         Type::getVoidTy(m_context), {real}),
+                                 {result});
+        }
+        m_builder.CreateRet(ConstantInt::get(int32, 0));
+        verifyFunction(*entry);
+
+        auto hash = riddle_hash(name.c_str());
+        entries.emplace_back(
+            hash, ConstantStruct::get(
+                      routineType,
+                      {ConstantInt::get(int64, hash),
+                       m_builder.CreateGlobalStringPtr(name),
+                       ConstantInt::get(int32, routine->arg_size()), entry}));
+    }
+
+    // The runtime looks routines up by binary search over the hashes
+    std::sort(entries.begin(), entries.end(),
+              [](auto& a, auto& b) { return a.first < b.first; });
+    std::vector<Constant*> table;
+    for (auto& entry : entries) {
+        table.push_back(entry.second);
+    }
+    auto tableType = llvm::ArrayType::get(routineType, table.size());
+    auto tableVar = new GlobalVariable(
+        *m_module, tableType, true, GlobalValue::PrivateLinkage,
+        ConstantArray::get(tableType, table), "riddle.routines");
+
+    Function* F = Function::Create(
+        FunctionType::get(int32, {int32, strings}, false),
+        Function::ExternalLinkage, "main", m_module.get());
+    m_builder.SetInsertPoint(BasicBlock::Create(m_context, "entry", F));
+    m_builder.CreateRet(m_builder.CreateCall(
+        riddleMain,
+        {F->getArg(0), F->getArg(1),
+         m_builder.CreateConstGEP2_64(tableType, tableVar, 0, 0),
+         ConstantInt::get(int64, table.size())}));
+
+    verifyFunction(*F);
+    return true;
+}
+
+bool CodeGenerator::hasScalarSignature(Function& F) {
+    // Arrays cannot be given on the command line or printed
+    auto scalar = [](Type* type) {
+        return type->isIntegerTy() || type->isDoubleTy();
+    };
+    auto returnType = F.getReturnType();
+    return (returnType->isVoidTy() || scalar(returnType)) &&
+           std::all_of(F.arg_begin(), F.arg_end(),
+                       [&](Argument& arg) { return scalar(arg.getType()); });
 }
 
 Module::FunctionListType& CodeGenerator::getFunctions() {
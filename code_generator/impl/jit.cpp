@@ -0,0 +1,200 @@
+#include "code_generator.hpp"
+#include "fmt/core.h"
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wconversion"
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#pragma GCC diagnostic ignored "-Wredundant-move"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#pragma GCC diagnostic pop
+#include <cstring>
+#include <stdexcept>
+
+using namespace llvm;
+
+namespace {
+
+// Name of the routine added to the module to call the loaded one through.
+//  Riddle names cannot contain a dot, so it never clashes with a routine.
+constexpr const char* entryName = "riddle.run";
+
+} // namespace
+
+namespace cg {
+
+Jit::Jit() {
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+    auto jit = orc::LLJITBuilder().create();
+    if (!jit) {
+        m_error = toString(jit.takeError());
+        return;
+    }
+    m_jit = std::move(*jit);
+
+    // Let the program call whatever the compiler itself is linked with, the
+    //  C library in particular
+    auto process = orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+        m_jit->getDataLayout().getGlobalPrefix());
+    if (!process) {
+        m_error = toString(process.takeError());
+        return;
+    }
+    m_jit->getMainJITDylib().addGenerator(std::move(*process));
+}
+
+Jit::~Jit() = default;
+
+bool Jit::fail(std::string error) {
+    m_error = std::move(error);
+    return false;
+}
+
+bool Jit::load(ParallelCodeGenerator& codegen, const std::string& routine) {
+    if (!m_jit) {
+        return false;
+    }
+
+    // The routine is declared in every module but defined in one
+    Function* callee = nullptr;
+    for (auto& part : codegen.getParts()) {
+        for (auto& function : part->getFunctions()) {
+            if (function.getName() == routine && !function.isDeclaration()) {
+                callee = &function;
+            }
+        }
+    }
+    if (!callee) {
+        return fail(fmt::format("there is no routine '{}'", routine));
+    }
+
+    // The entry takes the arguments as an array of 64-bit slots and returns
+    //  the result in one, so a single signature fits every routine
+    auto& module = *callee->getParent();
+    auto& context = module.getContext();
+    auto slotType = Type::getInt64Ty(context);
+    auto entryType = FunctionType::get(
+        slotType, {PointerType::getUnqual(slotType)}, false);
+    auto entry = Function::Create(entryType, Function::ExternalLinkage,
+                                  entryName, module);
+    IRBuilder<> builder(BasicBlock::Create(context, "entry", entry));
+
+    m_params.clear();
+    m_paramBits.clear();
+    std::vector<Value*> args;
+    for (auto& param : callee->args()) {
+        auto type = param.getType();
+        if (!type->isIntegerTy() && !type->isDoubleTy()) {
+            return fail(fmt::format(
+                "routine '{}' takes parameters that cannot be given on the "
+                "command line",
+                routine));
+        }
+        auto slot = builder.CreateConstGEP1_64(slotType, entry->getArg(0),
+                                               args.size());
+        Value* arg = builder.CreateLoad(slotType, slot);
+        arg = type->isDoubleTy() ? builder.CreateBitCast(arg, type)
+                                 : builder.CreateTrunc(arg, type);
+        args.push_back(arg);
+        m_params.push_back(type->getTypeID());
+        m_paramBits.push_back(type->getScalarSizeInBits());
+    }
+
+    auto returnType = callee->getReturnType();
+    if (!returnType->isVoidTy() && !returnType->isIntegerTy() &&
+        !returnType->isDoubleTy()) {
+        return fail(fmt::format(
+            "routine '{}' returns a value that cannot be printed", routine));
+    }
+    m_return = returnType->getTypeID();
+    m_returnBits = returnType->getScalarSizeInBits();
+
+    Value* result = builder.CreateCall(callee, args);
+    if (returnType->isVoidTy()) {
+        result = ConstantInt::get(slotType, 0);
+    } else if (returnType->isDoubleTy()) {
+        result = builder.CreateBitCast(result, slotType);
+    } else {
+        result = builder.CreateZExt(result, slotType);
+    }
+    builder.CreateRet(result);
+
+    for (auto& part : codegen.getParts()) {
+        auto object = part->emitObject();
+        if (!object) {
+            return fail("cannot generate code for the target");
+        }
+        if (auto error = m_jit->addObjectFile(std::move(object))) {
+            return fail(toString(std::move(error)));
+        }
+    }
+
+    auto symbol = m_jit->lookup(entryName);
+    if (!symbol) {
+        return fail(toString(symbol.takeError()));
+    }
+#if LLVM_VERSION_MAJOR >= 15
+    m_entry = symbol->toPtr<uint64_t (*)(const uint64_t*)>();
+#else
+    m_entry = reinterpret_cast<uint64_t (*)(const uint64_t*)>(
+        symbol->getAddress());
+#endif
+    return true;
+}
+
+bool Jit::call(const std::vector<std::string>& args, std::string& result) {
+    if (!m_entry) {
+        return fail("no routine is loaded");
+    }
+    if (args.size() != m_params.size()) {
+        return fail(fmt::format("the routine takes {} arguments, {} given",
+                                m_params.size(), args.size()));
+    }
+
+    std::vector<uint64_t> slots;
+    for (std::size_t i = 0; i < args.size(); i++) {
+        uint64_t slot = 0;
+        try {
+            std::size_t parsed = 0;
+            if (m_params[i] == Type::DoubleTyID) {
+                double value = std::stod(args[i], &parsed);
+                std::memcpy(&slot, &value, sizeof(value));
+            } else if (m_paramBits[i] == 1) {
+                if (args[i] != "true" && args[i] != "false") {
+                    throw std::invalid_argument(args[i]);
+                }
+                slot = args[i] == "true";
+                parsed = args[i].size();
+            } else {
+                slot = static_cast<uint64_t>(std::stoll(args[i], &parsed));
+            }
+            if (parsed != args[i].size()) {
+                throw std::invalid_argument(args[i]);
+            }
+        } catch (const std::logic_error&) {
+            return fail(fmt::format("argument {} is not {}: '{}'", i + 1,
+                                    m_params[i] == Type::DoubleTyID ? "a real"
+                                    : m_paramBits[i] == 1 ? "a boolean"
+                                                          : "an integer",
+                                    args[i]));
+        }
+        slots.push_back(slot);
+    }
+
+    auto value = m_entry(slots.data());
+    if (m_return == Type::VoidTyID) {
+        result.clear();
+    } else if (m_return == Type::DoubleTyID) {
+        double real;
+        std::memcpy(&real, &value, sizeof(real));
+        // The same as riddle_print_real, so that executables print it alike
+        result = fmt::format("{:g}", real);
+    } else if (m_returnBits == 1) {
+        result = value & 1 ? "true" : "false";
+    } else {
+        result = fmt::format("{}", static_cast<int64_t>(value));
+    }
+    return true;
+}
+
+} // namespace cg
@@ -0,0 +1,147 @@
+#include "code_generator.hpp"
+#include "parallel.hpp"
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wconversion"
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#include "llvm/ADT/Triple.h"
+#include "llvm/Object/ArchiveWriter.h"
+#pragma GCC diagnostic pop
+#include <algorithm>
+#include <set>
+#include <thread>
+#include <utility>
+
+using namespace llvm;
+
+namespace cg {
+
+ParallelCodeGenerator::ParallelCodeGenerator(std::string name,
+                                             const TargetConfig& target,
+                                             unsigned jobs)
+    : m_name(std::move(name)), m_target(target.resolved()), m_jobs(jobs) {
+    if (m_jobs == 0) {
+        m_jobs = std::max(1u, std::thread::hardware_concurrency());
+    }
+}
+
+void ParallelCodeGenerator::generate(ast::Program* node) {
+    auto routines = node->routines.size();
+    auto parts =
+        std::max<std::size_t>(1, std::min<std::size_t>(m_jobs, routines));
+    // Made one after another, setting up the target registry is not
+    //  thread-safe
+    m_parts.clear();
+    for (std::size_t i = 0; i < parts; i++) {
+        m_parts.push_back(std::make_unique<CodeGenerator>(m_name, m_target));
+    }
+
+    common::parallelFor(parts, m_jobs, [&](std::size_t i) {
+        m_parts[i]->generate(node, routines * i / parts,
+                             routines * (i + 1) / parts);
+    });
+}
+
+bool ParallelCodeGenerator::generateMain() {
+    return m_parts.front()->generateMain();
+}
+
+void ParallelCodeGenerator::optimize() {
+    common::parallelFor(m_parts.size(), m_jobs,
+                        [&](std::size_t i) { m_parts[i]->optimize(); });
+}
+
+void ParallelCodeGenerator::print(raw_ostream& stream) {
+    for (auto& part : m_parts) {
+        part->print(stream);
+    }
+}
+
+std::unique_ptr<MemoryBuffer> ParallelCodeGenerator::emitObject() {
+    std::vector<std::unique_ptr<MemoryBuffer>> objects(m_parts.size());
+    common::parallelFor(m_parts.size(), m_jobs, [&](std::size_t i) {
+        objects[i] = m_parts[i]->emitObject();
+    });
+    if (std::find(objects.begin(), objects.end(), nullptr) != objects.end()) {
+        return nullptr;
+    }
+    if (objects.size() == 1) {
+        return std::move(objects.front());
+    }
+
+    // The linker pulls in every member, as the entry point refers to all the
+    //  routines
+    std::vector<std::string> names;
+    for (std::size_t i = 0; i < objects.size(); i++) {
+        names.push_back(m_name + "." + std::to_string(i) + ".o");
+    }
+    std::vector<NewArchiveMember> members;
+    for (std::size_t i = 0; i < objects.size(); i++) {
+        members.emplace_back(objects[i]->getMemBufferRef());
+        members.back().MemberName = names[i];
+    }
+    auto kind = Triple(sys::getDefaultTargetTriple()).isOSDarwin()
+                    ? object::Archive::K_DARWIN
+                    : object::Archive::K_GNU;
+    auto archive = writeArchiveToBuffer(members, true, kind, true, false);
+    if (!archive) {
+        errs() << "Could not write archive: " << toString(archive.takeError());
+        return nullptr;
+    }
+    return std::move(*archive);
+}
+
+void ParallelCodeGenerator::emitCode(std::string filename) {
+    std::error_code EC;
+    raw_fd_ostream dest(filename, EC, sys::fs::OF_None);
+
+    if (EC) {
+        errs() << "Could not open file: " << EC.message();
+        return;
+    }
+
+    if (auto object = emitObject()) {
+        dest << object->getBuffer();
+    }
+    dest.flush();
+}
+
+std::vector<ast::Error> ParallelCodeGenerator::getErrors() const {
+    // Every module generates the types and globals of the program, so their
+    //  errors are reported by all of them
+    std::set<std::pair<lexer::Token::Position, std::string>> seen;
+    std::vector<ast::Error> errors;
+    for (auto& part : m_parts) {
+        for (auto& error : part->getErrors()) {
+            if (seen.emplace(error.pos, error.message).second) {
+                errors.push_back(error);
+            }
+        }
+    }
+    std::stable_sort(errors.begin(), errors.end(),
+                     [](const ast::Error& a, const ast::Error& b) {
+                         return a.pos < b.pos;
+                     });
+    return errors;
+}
+
+std::vector<RecordLayout> ParallelCodeGenerator::getLayouts() const {
+    // Records of the program are laid out the same way in every module
+    std::vector<RecordLayout> layouts;
+    for (auto& part : m_parts) {
+        for (auto& layout : part->getLayouts()) {
+            auto same = [&](const RecordLayout& other) {
+                return other.pos == layout.pos;
+            };
+            if (std::none_of(layouts.begin(), layouts.end(), same)) {
+                layouts.push_back(layout);
+            }
+        }
+    }
+    std::sort(layouts.begin(), layouts.end(),
+              [](const RecordLayout& a, const RecordLayout& b) {
+                  return a.pos < b.pos;
+              });
+    return layouts;
+}
+
+} // namespace cg
@@ -0,0 +1,70 @@
+#include "parallel.hpp"
+#include <deque>
+#include <vector>
+
+namespace common {
+
+namespace {
+
+class ThreadPool {
+public:
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_available.notify_all();
+        for (auto& thread : m_threads) {
+            thread.join();
+        }
+    }
+
+    void submit(std::function<void()> task, unsigned threads) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            while (m_threads.size() < threads) {
+                m_threads.emplace_back([this] { work(); });
+            }
+            m_tasks.push_back(std::move(task));
+        }
+        m_available.notify_one();
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_available;
+    std::deque<std::function<void()>> m_tasks;
+    std::vector<std::thread> m_threads;
+    bool m_stopping = false;
+
+    void work() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_available.wait(
+                    lock, [&] { return m_stopping || !m_tasks.empty(); });
+                // Queued tasks are still run when stopping
+                if (m_tasks.empty()) {
+                    return;
+                }
+                task = std::move(m_tasks.front());
+                m_tasks.pop_front();
+            }
+            task();
+        }
+    }
+};
+
+} // namespace
+
+namespace detail {
+
+void submit(std::function<void()> task, unsigned threads) {
+    static ThreadPool pool;
+    pool.submit(std::move(task), threads);
+}
+
+} // namespace detail
+
+} // namespace common
@@ -0,0 +1,173 @@
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace common {
+
+namespace detail {
+
+/**
+ * Runs `task` on one of the threads kept for the rest of the process, which
+ *  are started the first time at least `threads` of them are asked for. Tasks
+ *  are taken in the order they were submitted.
+ */
+void submit(std::function<void()> task, unsigned threads);
+
+} // namespace detail
+
+/**
+ * Calls `fn(i)` for every `i` in [0, count) on up to `threads` threads (one
+ *  per hardware thread if 0), the calling thread included. With a single
+ *  thread the calls are made in order.
+ *
+ * The other threads come from a pool shared by every call, so no thread is
+ *  started or joined per call. The calling thread never waits for a pool
+ *  thread that has not picked up its share yet and takes that share over
+ *  instead, so calls may run at the same time and may be nested.
+ *
+ * Every thread starts with an equal slice of the indices and works through it
+ *  front to back. A thread that runs out steals the back half of the largest
+ *  slice left, so uneven items even out without all threads contending for a
+ *  shared counter.
+ *
+ * If `fn` throws, the threads stop taking new items and the first exception
+ *  is rethrown once they are done.
+ */
+template <typename Fn>
+void parallelFor(std::size_t count, unsigned threads, Fn&& fn) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = static_cast<unsigned>(std::min<std::size_t>(threads, count));
+    if (threads <= 1) {
+        for (std::size_t i = 0; i < count; i++) {
+            fn(i);
+        }
+        return;
+    }
+
+    struct Slice {
+        std::mutex mutex;
+        std::size_t begin = 0;
+        std::size_t end = 0;
+    };
+    auto slices = std::make_unique<Slice[]>(threads);
+    for (unsigned t = 0; t < threads; t++) {
+        slices[t].begin = count * t / threads;
+        slices[t].end = count * (t + 1) / threads;
+    }
+
+    std::mutex failure;
+    std::exception_ptr exception;
+
+    // Moves the back half of the largest other slice into `own`
+    auto steal = [&](unsigned own) {
+        while (true) {
+            unsigned victim = own;
+            std::size_t largest = 0;
+            for (unsigned t = 0; t < threads; t++) {
+                std::lock_guard<std::mutex> lock(slices[t].mutex);
+                if (slices[t].end - slices[t].begin > largest) {
+                    largest = slices[t].end - slices[t].begin;
+                    victim = t;
+                }
+            }
+            if (victim == own) {
+                return false;
+            }
+
+            std::scoped_lock lock(slices[own].mutex, slices[victim].mutex);
+            auto& from = slices[victim];
+            if (from.begin == from.end) {
+                // Someone else got there first
+                continue;
+            }
+            auto middle = from.begin + (from.end - from.begin) / 2;
+            slices[own].begin = middle;
+            slices[own].end = from.end;
+            from.end = middle;
+            return true;
+        }
+    };
+
+    auto worker = [&](unsigned own) {
+        auto& slice = slices[own];
+        while (true) {
+            std::size_t item;
+            {
+                std::lock_guard<std::mutex> lock(slice.mutex);
+                if (slice.begin == slice.end) {
+                    item = count;
+                } else {
+                    item = slice.begin++;
+                }
+            }
+            if (item == count) {
+                if (!steal(own)) {
+                    return;
+                }
+                continue;
+            }
+
+            try {
+                fn(item);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(failure);
+                if (!exception) {
+                    exception = std::current_exception();
+                }
+                // Leave nothing for anyone to take
+                for (unsigned t = 0; t < threads; t++) {
+                    std::lock_guard<std::mutex> sliceLock(slices[t].mutex);
+                    slices[t].begin = slices[t].end;
+                }
+                return;
+            }
+        }
+    };
+
+    // Outlives the call if a pool thread only gets to its task afterwards
+    struct Helpers {
+        std::mutex mutex;
+        std::condition_variable done;
+        unsigned running = 0;
+        bool closed = false;
+    };
+    auto helpers = std::make_shared<Helpers>();
+    for (unsigned t = 1; t < threads; t++) {
+        detail::submit(
+            [helpers, &worker, t] {
+                {
+                    std::lock_guard<std::mutex> lock(helpers->mutex);
+                    if (helpers->closed) {
+                        return;
+                    }
+                    helpers->running++;
+                }
+                worker(t);
+                {
+                    std::lock_guard<std::mutex> lock(helpers->mutex);
+                    helpers->running--;
+                }
+                helpers->done.notify_one();
+            },
+            threads - 1);
+    }
+    worker(0);
+    {
+        std::unique_lock<std::mutex> lock(helpers->mutex);
+        helpers->closed = true;
+        helpers->done.wait(lock, [&] { return helpers->running == 0; });
+    }
+    if (exception) {
+        std::rethrow_exception(exception);
+    }
+}
+
+} // namespace common
@@ -0,0 +1,71 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace common {
+
+/**
+ * Symbol table of nested scopes. Every name maps to the stack of its
+ *  declarations, innermost on top, so looking a name up and leaving a scope
+ *  take time independent of the number of declarations in sight.
+ *
+ * A table can be nested in another one, which is searched for the names it
+ *  does not declare itself. The outer table is only read, so several tables
+ *  may share it across threads as long as nobody changes it meanwhile.
+ */
+template <typename T> class ScopedTable {
+public:
+    ScopedTable() = default;
+    /** `outer` has to outlive the table */
+    explicit ScopedTable(const ScopedTable* outer) : m_outer(outer) {}
+
+    void pushScope() { m_scopes.push_back(m_declared.size()); }
+
+    /** Forgets the declarations made since the matching pushScope() */
+    void popScope() {
+        auto begin = m_scopes.back();
+        m_scopes.pop_back();
+        while (m_declared.size() > begin) {
+            // The stacks are left in the map even when empty, the same names
+            //  tend to be declared again in the next scope
+            m_declared.back()->pop_back();
+            m_declared.pop_back();
+        }
+    }
+
+    /** Hides the previous declarations of `name` until the scope is left */
+    void declare(const std::string& name, T value) {
+        auto& stack = m_names[name];
+        stack.push_back(std::move(value));
+        m_declared.push_back(&stack);
+    }
+
+    /** The innermost declaration of `name` or nullptr if there is none */
+    const T* find(const std::string& name) const {
+        auto it = m_names.find(name);
+        if (it != m_names.end() && !it->second.empty()) {
+            return &it->second.back();
+        }
+        return m_outer != nullptr ? m_outer->find(name) : nullptr;
+    }
+
+    void clear() {
+        m_names.clear();
+        m_declared.clear();
+        m_scopes.clear();
+    }
+
+private:
+    const ScopedTable* m_outer = nullptr;
+    std::unordered_map<std::string, std::vector<T>> m_names;
+    // Declaration stacks in the order they were pushed to, to be popped when
+    //  their scope is left. Pointers to the elements of an unordered_map stay
+    //  valid when it grows.
+    std::vector<std::vector<T>*> m_declared;
+    // Size of `m_declared` when every open scope was entered
+    std::vector<std::size_t> m_scopes;
+};
+
+} // namespace common
@@ -93,12 +93,17 @@ Token Lexer::Peek() {
  * Consumes the next token
  */
 Token Lexer::Next() {
-    Token ret = Peek();
-    if (ret.type == TokenType::Eof) {
+    if (consumedEof) {
+        throw std::overflow_error("End-of-file already consumed");
+    }
+
+    if (currentToken.type == TokenType::Eof) {
         consumedEof = true;
-    } else {
-        currentToken = scanNext();
+        return currentToken;
     }
+
+    Token ret = std::move(currentToken);
+    currentToken = scanNext();
     return ret;
 }
 
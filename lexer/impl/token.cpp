@@ -115,4 +115,38 @@ std::string to_string(TokenType type) {
     return "<internal error: unknown token>";
 }
 
+std::vector<TokenType> TokenSet::Types() const {
+    std::vector<TokenType> types;
+    types.reserve(Size());
+    for (unsigned i = 0; i < 64; i++) {
+        if ((m_bits >> i) & 1) {
+            types.push_back(static_cast<TokenType>(i));
+        }
+    }
+    return types;
+}
+
+std::string to_string(TokenSet set) {
+    auto types = set.Types();
+
+    if (types.empty()) {
+        return "";
+    }
+
+    if (types.size() == 1) {
+        return to_string(types[0]);
+    }
+
+    if (types.size() == 2) {
+        return to_string(types[0]) + " or " + to_string(types[1]);
+    }
+
+    std::string msg;
+    for (size_t i = 0; i + 1 < types.size(); i++) {
+        msg += to_string(types[i]) + ", ";
+    }
+
+    return msg + "or " + to_string(types.back());
+}
+
 } // namespace lexer
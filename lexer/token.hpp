@@ -1,6 +1,9 @@
 #pragma once
 
+#include <cstdint>
+#include <initializer_list>
 #include <string>
+#include <vector>
 
 namespace lexer {
 
@@ -68,6 +71,9 @@ enum class TokenType {
     Return,
 };
 
+// Return must remain the last token type.
+constexpr size_t g_tokenTypeCount = static_cast<size_t>(TokenType::Return) + 1;
+
 struct Token {
 
     struct Position {
@@ -95,6 +101,70 @@ struct Token {
     friend bool operator!=(const Token& a, const Token& b) { return !(a == b); }
 };
 
+/**
+ * TokenSet is a set of token types packed into a single 64-bit mask.
+ * It is cheap to copy and can be built at compile time, so it is meant to be
+ * passed around by value wherever a list of acceptable tokens is needed.
+ */
+class TokenSet {
+public:
+    constexpr TokenSet() = default;
+    constexpr TokenSet(TokenType type) : m_bits(bit(type)) {}
+    constexpr TokenSet(std::initializer_list<TokenType> types) {
+        for (auto type : types) {
+            m_bits |= bit(type);
+        }
+    }
+
+    constexpr bool Contains(TokenType type) const {
+        return (m_bits & bit(type)) != 0;
+    }
+
+    constexpr bool Empty() const { return m_bits == 0; }
+
+    constexpr size_t Size() const {
+        size_t count = 0;
+        for (uint64_t bits = m_bits; bits != 0; bits &= bits - 1) {
+            count++;
+        }
+        return count;
+    }
+
+    constexpr TokenSet operator|(TokenSet other) const {
+        TokenSet result;
+        result.m_bits = m_bits | other.m_bits;
+        return result;
+    }
+
+    constexpr bool operator==(TokenSet other) const {
+        return m_bits == other.m_bits;
+    }
+
+    constexpr bool operator!=(TokenSet other) const {
+        return !(*this == other);
+    }
+
+    /**
+     * Returns the types in the set in the order of their declaration.
+     */
+    std::vector<TokenType> Types() const;
+
+private:
+    uint64_t m_bits = 0;
+
+    static constexpr uint64_t bit(TokenType type) {
+        return uint64_t(1) << static_cast<unsigned>(type);
+    }
+};
+
+static_assert(g_tokenTypeCount <= 64, "TokenSet cannot hold all token types");
+
 std::string to_string(TokenType type);
 
+/**
+ * Joins the names of the types in the set into an english enumeration,
+ * like "',', ')', or 'end'".
+ */
+std::string to_string(TokenSet types);
+
 } // namespace lexer
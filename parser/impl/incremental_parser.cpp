@@ -0,0 +1,436 @@
+#include "parser.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+namespace parser {
+
+using lexer::Token;
+using lexer::TokenType;
+using Position = lexer::Token::Position;
+
+namespace {
+
+/**
+ * FNV-1a over the tokens in [begin, end). Lines are taken relative to the
+ *  first token, so that a chunk keeps its fingerprint when it is moved down.
+ */
+uint64_t Fingerprint(const std::vector<Token>& tokens, size_t begin,
+                     size_t end) {
+    uint64_t hash = 14695981039346656037ull;
+    auto mix = [&hash](uint64_t value) {
+        hash = (hash ^ value) * 1099511628211ull;
+    };
+
+    size_t line = tokens[begin].pos.line;
+    for (size_t i = begin; i < end; i++) {
+        const Token& tok = tokens[i];
+        mix(static_cast<uint64_t>(tok.type));
+        mix(tok.pos.line - line);
+        mix(tok.pos.column);
+        for (char ch : tok.lit) {
+            mix(static_cast<unsigned char>(ch));
+        }
+    }
+
+    return hash;
+}
+
+/**
+ * Moves every node of a reused declaration up or down by a number of lines.
+ *  The nodes are expected to form a tree, as built by the parser.
+ */
+class LineShifter : public ast::Visitor {
+public:
+    LineShifter(std::ptrdiff_t delta) : m_delta(delta) {}
+
+    void visit(ast::Program*) override {}
+
+    void visit(ast::RoutineDecl* node) override {
+        shift(node);
+        acceptAll(node->parameters);
+        accept(node->returnType);
+        accept(node->body);
+    }
+
+    void visit(ast::AliasedType* node) override { shift(node); }
+
+    void visit(ast::TypeDecl* node) override {
+        shift(node);
+        accept(node->type);
+    }
+
+    void visit(ast::IntegerType* node) override { shift(node); }
+
+    void visit(ast::RealType* node) override { shift(node); }
+
+    void visit(ast::BooleanType* node) override { shift(node); }
+
+    void visit(ast::ArrayType* node) override {
+        shift(node);
+        accept(node->length);
+        accept(node->elementType);
+    }
+
+    void visit(ast::RecordType* node) override {
+        shift(node);
+        acceptAll(node->fields);
+    }
+
+    void visit(ast::VariableDecl* node) override {
+        shift(node);
+        accept(node->type);
+        accept(node->initialValue);
+    }
+
+    void visit(ast::Body* node) override {
+        shift(node);
+        acceptAll(node->variables);
+        acceptAll(node->types);
+        acceptAll(node->statements);
+    }
+
+    void visit(ast::ReturnStatement* node) override {
+        shift(node);
+        accept(node->expression);
+    }
+
+    void visit(ast::Assignment* node) override {
+        shift(node);
+        accept(node->lhs);
+        accept(node->rhs);
+    }
+
+    void visit(ast::WhileLoop* node) override {
+        shift(node);
+        accept(node->condition);
+        accept(node->body);
+    }
+
+    void visit(ast::ForLoop* node) override {
+        shift(node);
+        accept(node->loopVar);
+        accept(node->rangeFrom);
+        accept(node->rangeTo);
+        accept(node->body);
+    }
+
+    void visit(ast::IfStatement* node) override {
+        shift(node);
+        accept(node->condition);
+        accept(node->ifBody);
+        accept(node->elseBody);
+    }
+
+    void visit(ast::IntegerLiteral* node) override { shift(node); }
+
+    void visit(ast::RealLiteral* node) override { shift(node); }
+
+    void visit(ast::BooleanLiteral* node) override { shift(node); }
+
+    void visit(ast::Identifier* node) override { shift(node); }
+
+    void visit(ast::RoutineCall* node) override {
+        shift(node);
+        acceptAll(node->args);
+    }
+
+    void visit(ast::UnaryExpression* node) override {
+        shift(node);
+        accept(node->operand);
+    }
+
+    void visit(ast::BinaryExpression* node) override {
+        shift(node);
+        accept(node->operand1);
+        accept(node->operand2);
+    }
+
+    void move(Position& pos) {
+        // Line 0 marks a position that was never set
+        if (pos.line != 0) {
+            pos.line = static_cast<size_t>(
+                static_cast<std::ptrdiff_t>(pos.line) + m_delta);
+        }
+    }
+
+private:
+    std::ptrdiff_t m_delta;
+
+    void shift(ast::Node* node) {
+        move(node->begin);
+        move(node->end);
+    }
+
+    template <typename T> void accept(const sPtr<T>& node) {
+        if (node != nullptr) {
+            node->accept(*this);
+        }
+    }
+
+    template <typename T> void acceptAll(const std::vector<sPtr<T>>& nodes) {
+        for (auto& node : nodes) {
+            accept(node);
+        }
+    }
+};
+
+} // namespace
+
+/**
+ * Parses `source`, which is expected to be an edited version of the source
+ *  given last time. The edit is found by comparing both versions from either
+ *  end. Chunks that end before the edit are kept as they are, chunks that
+ *  start on a line after it are kept and moved by the number of lines the edit
+ *  added or removed, and the ones in between are lexed and parsed again.
+ */
+sPtr<ast::Program> IncrementalParser::parse(std::string source) {
+    if (m_program != nullptr && source == m_source) {
+        return m_program;
+    }
+
+    try {
+        std::vector<Chunk> old = std::move(m_chunks);
+        m_chunks.clear();
+
+        size_t oldSize = m_source.size();
+        size_t newSize = source.size();
+        size_t common = std::min(oldSize, newSize);
+
+        // The edit replaced [prefix, oldSize - suffix) of the old source with
+        //  [prefix, newSize - suffix) of the new one
+        auto commonEnd = m_source.begin() + static_cast<std::ptrdiff_t>(common);
+        size_t prefix = static_cast<size_t>(
+            std::mismatch(m_source.begin(), commonEnd, source.begin()).first -
+            m_source.begin());
+        size_t suffix = static_cast<size_t>(
+            std::mismatch(m_source.rbegin(),
+                          m_source.rbegin() +
+                              static_cast<std::ptrdiff_t>(common - prefix),
+                          source.rbegin())
+                .first -
+            m_source.rbegin());
+        size_t oldChangeEnd = oldSize - suffix;
+        size_t newChangeEnd = newSize - suffix;
+
+        auto countLines = [](const std::string& str, size_t from, size_t to) {
+            return std::count(str.begin() + static_cast<std::ptrdiff_t>(from),
+                              str.begin() + static_cast<std::ptrdiff_t>(to),
+                              '\n');
+        };
+        std::ptrdiff_t lineDelta = countLines(source, prefix, newChangeEnd) -
+                                   countLines(m_source, prefix, oldChangeEnd);
+        auto sizeDelta = static_cast<std::ptrdiff_t>(newSize - oldSize);
+
+        // Chunks [first, last) are affected by the edit
+        size_t first = 0;
+        while (first + 1 < old.size() && old[first + 1].offset < prefix) {
+            first++;
+        }
+        size_t newline = m_source.find('\n', oldChangeEnd);
+        size_t last = first;
+        while (last < old.size() &&
+               (newline == std::string::npos || old[last].offset <= newline)) {
+            last++;
+        }
+
+        for (size_t i = 0; i < first; i++) {
+            m_chunks.push_back(std::move(old[i]));
+        }
+
+        // The first chunk is lexed from the very beginning, so that leading
+        //  blank lines and comments are covered as well
+        size_t from = first == 0 ? 0 : old[first].offset;
+        Position pos = first == 0 ? Position{1, 1} : old[first].begin;
+
+        std::vector<Chunk> reusable(
+            std::make_move_iterator(old.begin() +
+                                    static_cast<std::ptrdiff_t>(first)),
+            std::make_move_iterator(old.end()));
+
+        LineShifter shifter(lineDelta);
+        auto shiftAll = [&shifter](const auto& nodes) {
+            for (auto& node : nodes) {
+                if (node != nullptr) {
+                    node->accept(shifter);
+                }
+            }
+        };
+
+        bool done = false;
+        if (last - first < reusable.size()) {
+            Chunk& next = reusable[last - first];
+            Position eofPos = next.begin;
+            shifter.move(eofPos);
+            auto to = static_cast<size_t>(
+                static_cast<std::ptrdiff_t>(next.offset) + sizeDelta);
+            done =
+                parseRegion(source, from, pos, to, eofPos, reusable, m_chunks);
+        }
+
+        if (!done) {
+            // Either nothing follows the edited chunks or they have errors. In
+            //  both cases everything up to the end of the source is parsed
+            m_chunks.resize(first);
+            parseRegion(source, from, pos, newSize, Position{}, reusable,
+                        m_chunks);
+            last = first + reusable.size();
+        }
+
+        for (size_t i = last - first; i < reusable.size(); i++) {
+            Chunk& chunk = reusable[i];
+            chunk.offset =
+                static_cast<size_t>(static_cast<std::ptrdiff_t>(chunk.offset) +
+                                    sizeDelta);
+            if (lineDelta != 0) {
+                shifter.move(chunk.begin);
+                shiftAll(chunk.routines);
+                shiftAll(chunk.variables);
+                shiftAll(chunk.types);
+                for (auto& error : chunk.errors) {
+                    shifter.move(error.pos);
+                }
+            }
+            m_chunks.push_back(std::move(chunk));
+        }
+    } catch (...) {
+        m_source.clear();
+        m_chunks.clear();
+        m_program = nullptr;
+        throw;
+    }
+
+    m_source = std::move(source);
+
+    auto programNode = std::make_shared<ast::Program>();
+    programNode->begin = m_begin;
+    programNode->end = Position{}; // the end of file has no position
+    for (auto& chunk : m_chunks) {
+        programNode->routines.insert(programNode->routines.end(),
+                                     chunk.routines.begin(),
+                                     chunk.routines.end());
+        programNode->variables.insert(programNode->variables.end(),
+                                      chunk.variables.begin(),
+                                      chunk.variables.end());
+        programNode->types.insert(programNode->types.end(),
+                                  chunk.types.begin(), chunk.types.end());
+    }
+
+    m_program = programNode;
+    return programNode;
+}
+
+/**
+ * Lexes and parses source[from, to), whose first token is at `pos`, and
+ *  appends the resulting chunks. Chunks in `reusable` with the same tokens at
+ *  the same position are taken over instead of being parsed again.
+ *
+ * Returns false if a chunk has errors and the region stops short of the end
+ *  of the source, as the outcome of error recovery then depends on what
+ *  follows the region.
+ */
+bool IncrementalParser::parseRegion(const std::string& source, size_t from,
+                                    Position pos, size_t to, Position eofPos,
+                                    std::vector<Chunk>& reusable,
+                                    std::vector<Chunk>& chunks) {
+    auto text = std::string_view(source).substr(from, to - from);
+
+    std::vector<size_t> lineStarts{0};
+    for (size_t i = text.find('\n'); i != std::string_view::npos;
+         i = text.find('\n', i + 1)) {
+        lineStarts.push_back(i + 1);
+    }
+
+    // Tokens are lexed as if the region was a file of its own and moved to
+    //  where the region starts afterwards
+    std::vector<Token> tokens;
+    std::vector<size_t> offsets;
+    lexer::Lexer lx{text};
+    for (Token tok = lx.Next(); tok.type != TokenType::Eof; tok = lx.Next()) {
+        offsets.push_back(from + lineStarts[tok.pos.line - 1] +
+                          tok.pos.column - 1);
+        if (tok.pos.line == 1) {
+            tok.pos.column += pos.column - 1;
+        }
+        tok.pos.line += pos.line - 1;
+        tokens.push_back(std::move(tok));
+    }
+    tokens.push_back(Token{.type = TokenType::Eof, .pos = eofPos});
+
+    if (from == 0) {
+        m_begin = tokens.front().pos;
+    }
+
+    auto segments = Parser::splitTopLevel(tokens, 0);
+    for (size_t k = 0; k < segments.size(); k++) {
+        size_t begin = segments[k].first;
+        size_t end = segments[k].second;
+        uint64_t fingerprint = Fingerprint(tokens, begin, end);
+
+        auto reused = std::find_if(
+            reusable.begin(), reusable.end(), [&](const Chunk& chunk) {
+                return chunk.fingerprint == fingerprint &&
+                       chunk.begin == tokens[begin].pos && chunk.errors.empty();
+            });
+        if (reused != reusable.end()) {
+            chunks.push_back(*reused);
+            chunks.back().offset = offsets[begin];
+            continue;
+        }
+
+        auto parseTokens = [&](size_t end) {
+            std::vector<Token> segment(
+                tokens.begin() + static_cast<std::ptrdiff_t>(begin),
+                tokens.begin() + static_cast<std::ptrdiff_t>(end));
+            segment.push_back(
+                Token{.type = TokenType::Eof, .pos = tokens[end].pos});
+
+            Parser parser(std::move(segment));
+            auto program = parser.parseProgram();
+            return Chunk{
+                .offset = offsets[begin],
+                .begin = tokens[begin].pos,
+                .fingerprint = Fingerprint(tokens, begin, end),
+                .routines = std::move(program->routines),
+                .variables = std::move(program->variables),
+                .types = std::move(program->types),
+                .errors = parser.getErrors(),
+            };
+        };
+
+        Chunk chunk{};
+        bool failed = false;
+        try {
+            chunk = parseTokens(end);
+            failed = !chunk.errors.empty();
+        } catch (const std::overflow_error&) {
+            // error recovery ran into the end of the segment
+            failed = true;
+        }
+
+        if (failed) {
+            if (to != source.size()) {
+                return false;
+            }
+
+            // Error recovery may run into the segments that follow, so they
+            //  are all parsed in one go
+            chunk = parseTokens(tokens.size() - 1);
+            chunks.push_back(std::move(chunk));
+            break;
+        }
+
+        chunks.push_back(std::move(chunk));
+    }
+
+    return true;
+}
+
+std::vector<ast::Error> IncrementalParser::getErrors() {
+    std::vector<ast::Error> errors;
+    for (auto& chunk : m_chunks) {
+        errors.insert(errors.end(), chunk.errors.begin(), chunk.errors.end());
+    }
+    return errors;
+}
+
+} // namespace parser
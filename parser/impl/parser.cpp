@@ -1,18 +1,22 @@
 #include "token.hpp"
 #include <algorithm>
+#include <atomic>
+#include <iterator>
 #include <memory>
+#include <stdexcept>
+#include <thread>
 
 #include "parser.hpp"
 
 #define RETURN_ON_FAIL()                                                       \
     {                                                                          \
-        if (m_current.type == lexer::TokenType::Illegal) {                     \
+        if (m_current->type == lexer::TokenType::Illegal) {                    \
             return nullptr;                                                    \
         }                                                                      \
     }
 #define ADVANCE_ON_FAIL(...)                                                   \
     {                                                                          \
-        if (m_current.type == lexer::TokenType::Illegal) {                     \
+        if (m_current->type == lexer::TokenType::Illegal) {                    \
             advance(__VA_ARGS__);                                              \
             return nullptr;                                                    \
         }                                                                      \
@@ -21,56 +25,114 @@
 namespace parser {
 
 using lexer::Token;
+using lexer::TokenSet;
 using lexer::TokenType;
 
-static const std::array<TokenType, 3> primitives{
+static constexpr TokenSet primitives{
     TokenType::IntegerType,
     TokenType::RealType,
     TokenType::Boolean,
 };
 
-namespace util {
+// Every construct that is closed by an 'end'
+static constexpr TokenSet blockOpeners{
+    TokenType::Routine,
+    TokenType::Record,
+    TokenType::Loop,
+    TokenType::If,
+};
 
-inline bool HasPrimitiveType(Token tok) {
-    return std::count(primitives.begin(), primitives.end(), tok.type) != 0;
-}
+const Token Parser::s_illegal{.type = TokenType::Illegal};
 
-template <typename Container, typename T>
-inline auto Contains(const Container& data, const T& value)
-    -> decltype(std::end(data), true) {
-    return std::end(data) != std::find(std::begin(data), std::end(data), value);
+Parser::Parser(lexer::Lexer lexer)
+    : m_current(&s_illegal),
+      m_bodyErrors(std::make_shared<BodyErrors>()) {
+    for (;;) {
+        m_tokens.push_back(lexer.Next());
+        if (m_tokens.back().type == TokenType::Eof) {
+            break;
+        }
+    }
 }
 
-std::string GenExpectMessage(const std::vector<TokenType>& types) {
-    if (types.size() == 0) {
-        return "expected nothing";
+Parser::Parser(std::vector<Token> tokens)
+    : m_tokens(std::move(tokens)), m_current(&s_illegal),
+      m_bodyErrors(std::make_shared<BodyErrors>()) {
+    if (m_tokens.empty() || m_tokens.back().type != TokenType::Eof) {
+        m_tokens.push_back(Token{.type = TokenType::Eof});
     }
+}
 
-    if (types.size() == 1) {
-        return fmt::format("expected {}", lexer::to_string(types[0]));
-    }
+namespace util {
 
-    if (types.size() == 2) {
-        return fmt::format("expected {} or {}", lexer::to_string(types[0]),
-                           lexer::to_string(types[1]));
-    }
+inline bool HasPrimitiveType(const Token& tok) {
+    return primitives.Contains(tok.type);
+}
 
-    std::string msg = "expected ";
-    for (int i = 0; i < (int)types.size() - 1; i++) {
-        msg += lexer::to_string(types[i]) + ", ";
+std::string GenExpectMessage(TokenSet types) {
+    if (types.Empty()) {
+        return "expected nothing";
     }
 
-    return msg + ", or " + lexer::to_string(types.back());
+    return "expected " + lexer::to_string(types);
 }
 
 } // namespace util
 
+/**
+ * Cuts the tokens in [from, Eof) into independently parsable pieces. Every
+ *  top-level routine, from `routine` up to its matching `end`, becomes a
+ *  segment of its own; the declarations between routines are kept together.
+ *  Segments made of line breaks only are dropped.
+ */
+std::vector<std::pair<size_t, size_t>>
+Parser::splitTopLevel(const std::vector<Token>& tokens, size_t from) {
+    std::vector<std::pair<size_t, size_t>> segments;
+    size_t begin = from;
+    size_t eof = tokens.size() - 1;
+
+    auto cut = [&](size_t end) {
+        bool blank = std::all_of(
+            tokens.begin() + static_cast<std::ptrdiff_t>(begin),
+            tokens.begin() + static_cast<std::ptrdiff_t>(end),
+            [](const Token& tok) { return tok.type == TokenType::NewLine; });
+        if (!blank) {
+            segments.emplace_back(begin, end);
+        }
+        begin = end;
+    };
+
+    size_t depth = 0;
+    bool inRoutine = false;
+    for (size_t i = from; i < eof; i++) {
+        TokenType type = tokens[i].type;
+
+        if (depth == 0 && type == TokenType::Routine) {
+            cut(i);
+            inRoutine = true;
+        }
+
+        if (blockOpeners.Contains(type)) {
+            depth++;
+        } else if (type == TokenType::End && depth > 0) {
+            depth--;
+            if (depth == 0 && inRoutine) {
+                cut(i + 1);
+                inRoutine = false;
+            }
+        }
+    }
+
+    cut(eof);
+    return segments;
+}
+
 sPtr<ast::Program> Parser::parseProgram() {
     ast::Program programNode;
-    peek();
-    programNode.begin = m_current.pos;
-    while (m_current.type != TokenType::Eof) {
-        switch (m_current.type) {
+    peekCurrent();
+    programNode.begin = m_current->pos;
+    while (m_current->type != TokenType::Eof) {
+        switch (m_current->type) {
         case TokenType::Routine:
             programNode.routines.push_back(parseRoutineDecl());
             break;
@@ -89,27 +151,123 @@ sPtr<ast::Program> Parser::parseProgram() {
             error("unexpected token");
             advance(TokenType::NewLine);
         }
-        if (m_current.type != TokenType::Eof) {
-            peek();
+        if (m_current->type != TokenType::Eof) {
+            peekCurrent();
         }
     }
 
-    programNode.end = m_current.pos;
+    programNode.end = m_current->pos;
     return std::make_shared<ast::Program>(programNode);
 }
 
+/**
+ * Same as `parseProgram`, but the top-level declarations are parsed
+ *  concurrently on `threads` threads (one per hardware thread by default).
+ *  Each segment found by `splitTopLevel` is handed to a parser of its own and
+ *  the results are merged back in source order.
+ *
+ * Error recovery may skip past the end of a segment, so as soon as any
+ *  segment fails to parse, the whole program is parsed again sequentially.
+ *  Errors are sorted by position either way.
+ */
+sPtr<ast::Program> Parser::parseProgramParallel(unsigned threads) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    auto sortErrors = [this] {
+        std::stable_sort(m_errors.begin(), m_errors.end(),
+                         [](const ast::Error& a, const ast::Error& b) {
+                             return a.pos < b.pos;
+                         });
+    };
+
+    size_t start = m_cursor;
+    auto segments = splitTopLevel(m_tokens, start);
+    if (threads == 1 || segments.size() < 2) {
+        auto programNode = parseProgram();
+        sortErrors();
+        return programNode;
+    }
+
+    std::vector<sPtr<ast::Program>> parts(segments.size());
+    std::atomic<size_t> nextSegment{0};
+    std::atomic<bool> failed{false};
+
+    auto worker = [&] {
+        for (size_t i = nextSegment++; i < segments.size() && !failed;
+             i = nextSegment++) {
+            auto [begin, end] = segments[i];
+            std::vector<Token> tokens(
+                m_tokens.begin() + static_cast<std::ptrdiff_t>(begin),
+                m_tokens.begin() + static_cast<std::ptrdiff_t>(end));
+            // The segment's end of file is where the next one starts
+            tokens.push_back(
+                Token{.type = TokenType::Eof, .pos = m_tokens[end].pos});
+
+            try {
+                Parser parser(std::move(tokens));
+                parser.m_lazyBodies = m_lazyBodies;
+                parser.m_bodyErrors = m_bodyErrors;
+                parts[i] = parser.parseProgram();
+                if (!parser.m_errors.empty()) {
+                    failed = true;
+                }
+            } catch (const std::exception&) {
+                failed = true;
+            }
+        }
+    };
+
+    threads = static_cast<unsigned>(
+        std::min(static_cast<size_t>(threads), segments.size()));
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads; t++) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : pool) {
+        thread.join();
+    }
+
+    if (failed) {
+        m_cursor = start;
+        auto programNode = parseProgram();
+        sortErrors();
+        return programNode;
+    }
+
+    auto programNode = std::make_shared<ast::Program>();
+    programNode->begin = peek().pos;
+    for (auto& part : parts) {
+        std::move(part->routines.begin(), part->routines.end(),
+                  std::back_inserter(programNode->routines));
+        std::move(part->variables.begin(), part->variables.end(),
+                  std::back_inserter(programNode->variables));
+        std::move(part->types.begin(), part->types.end(),
+                  std::back_inserter(programNode->types));
+    }
+
+    // Leave the parser at the end of file, as `parseProgram` does
+    m_cursor = m_tokens.size() - 1;
+    peekCurrent();
+
+    programNode->end = m_current->pos;
+    return programNode;
+}
+
 sPtr<ast::RoutineDecl> Parser::parseRoutineDecl() {
 
     expect(TokenType::Routine);
     RETURN_ON_FAIL();
 
     ast::RoutineDecl routineNode;
-    routineNode.begin = m_current.pos;
+    routineNode.begin = m_current->pos;
 
     expect(TokenType::Identifier);
     ADVANCE_ON_FAIL(TokenType::End);
 
-    routineNode.name = m_current.lit;
+    routineNode.name = m_current->lit;
 
     expect(TokenType::OpenParen);
     ADVANCE_ON_FAIL(TokenType::End);
@@ -117,13 +275,13 @@ sPtr<ast::RoutineDecl> Parser::parseRoutineDecl() {
     skipWhitespace();
 
     // handle the case of no parameters
-    peek();
+    peekCurrent();
 
-    if (m_current.type == TokenType::CloseParen) {
-        m_lexer.Next();
+    if (m_current->type == TokenType::CloseParen) {
+        consume();
     }
 
-    while (m_current.type != TokenType::CloseParen) {
+    while (m_current->type != TokenType::CloseParen) {
         routineNode.parameters.push_back(parseParameter());
 
         expect({TokenType::Comma, TokenType::CloseParen});
@@ -133,7 +291,7 @@ sPtr<ast::RoutineDecl> Parser::parseRoutineDecl() {
     expect({TokenType::Colon, TokenType::Is});
     ADVANCE_ON_FAIL(TokenType::End);
 
-    if (m_current.type == TokenType::Colon) {
+    if (m_current->type == TokenType::Colon) {
         skipWhitespace();
         routineNode.returnType = parseType();
         expect(TokenType::Is);
@@ -142,23 +300,91 @@ sPtr<ast::RoutineDecl> Parser::parseRoutineDecl() {
 
     skipWhitespace();
 
-    routineNode.body = parseBody();
+    if (!m_lazyBodies || !skipBody(routineNode)) {
+        routineNode.body = parseBody();
+    }
 
     expect(TokenType::End);
     ADVANCE_ON_FAIL(TokenType::End);
 
-    routineNode.end = m_current.pos;
+    routineNode.end = m_current->pos;
     return std::make_shared<ast::RoutineDecl>(routineNode);
 }
 
+/**
+ * Moves the cursor onto the 'end' closing the routine body that starts at the
+ *  cursor. The skipped tokens are handed to `routine.bodyLoader`, which parses
+ *  them on demand. Returns false without moving if the end of the body cannot
+ *  be told from its nesting, so that it is parsed right away instead.
+ */
+bool Parser::skipBody(ast::RoutineDecl& routine) {
+    size_t depth = 0;
+    size_t end = m_cursor;
+    for (;; end++) {
+        TokenType type = m_tokens[end].type;
+        if (type == TokenType::Eof) {
+            return false;
+        }
+        if (blockOpeners.Contains(type)) {
+            depth++;
+        } else if (type == TokenType::End) {
+            if (depth == 0) {
+                break;
+            }
+            depth--;
+        } else if (type == TokenType::Else && depth == 0) {
+            return false;
+        }
+    }
+
+    // The closing 'end' is kept, so the body stops at the same token as when
+    //  it is parsed right away
+    std::vector<Token> tokens(
+        m_tokens.begin() + static_cast<std::ptrdiff_t>(m_cursor),
+        m_tokens.begin() + static_cast<std::ptrdiff_t>(end + 1));
+    Token closing = m_tokens[end];
+    auto begin = m_tokens[m_cursor].pos;
+
+    routine.bodyLoader = [tokens = std::move(tokens), closing, begin,
+                          errors = m_bodyErrors]() mutable {
+        Parser parser(std::move(tokens));
+        sPtr<ast::Body> body;
+        try {
+            body = parser.parseBody();
+            if (parser.peek().type != TokenType::End ||
+                parser.peek(1).type != TokenType::Eof) {
+                parser.error(parser.peek(), "unexpected token");
+            }
+        } catch (const std::overflow_error&) {
+            // error recovery ran into the end of the body
+            parser.error(closing, "unexpected end of routine body");
+        }
+
+        if (!parser.m_errors.empty()) {
+            // Whoever accessed the body is not prepared for holes in the
+            //  tree, so it only gets to see an empty body
+            body = std::make_shared<ast::Body>();
+            body->begin = closing.pos;
+            body->end = closing.pos;
+            std::lock_guard<std::mutex> lock(errors->mutex);
+            errors->bodies.emplace_back(begin, std::move(parser.m_errors));
+        }
+
+        return body;
+    };
+
+    m_cursor = end;
+    return true;
+}
+
 sPtr<ast::VariableDecl> Parser::parseParameter() {
     expect(TokenType::Identifier);
     ADVANCE_ON_FAIL(
         {TokenType::CloseParen, TokenType::Comma, TokenType::NewLine});
 
     ast::VariableDecl parameterNode;
-    parameterNode.begin = m_current.pos;
-    parameterNode.name = m_current.lit;
+    parameterNode.begin = m_current->pos;
+    parameterNode.name = m_current->lit;
 
     expect(TokenType::Colon);
     // Note: the following is not correct as it will consume the ) or ,
@@ -180,12 +406,12 @@ sPtr<ast::TypeDecl> Parser::parseTypeDecl() {
     RETURN_ON_FAIL();
 
     ast::TypeDecl typeDeclNode;
-    typeDeclNode.begin = m_current.pos;
+    typeDeclNode.begin = m_current->pos;
 
     expect(TokenType::Identifier);
     ADVANCE_ON_FAIL({TokenType::Semicolon, TokenType::NewLine});
 
-    typeDeclNode.name = m_current.lit;
+    typeDeclNode.name = m_current->lit;
 
     expect(TokenType::Is);
     ADVANCE_ON_FAIL({TokenType::Semicolon, TokenType::NewLine});
@@ -196,16 +422,16 @@ sPtr<ast::TypeDecl> Parser::parseTypeDecl() {
     expect({TokenType::Semicolon, TokenType::NewLine});
     ADVANCE_ON_FAIL({TokenType::Semicolon, TokenType::NewLine});
 
-    typeDeclNode.end = m_current.pos;
+    typeDeclNode.end = m_current->pos;
     return std::make_shared<ast::TypeDecl>(typeDeclNode);
 }
 
 sPtr<ast::Type> Parser::parseType() {
-    peek();
+    peekCurrent();
 
-    if (util::HasPrimitiveType(m_current)) {
+    if (util::HasPrimitiveType(*m_current)) {
         sPtr<ast::PrimitiveType> typeNode;
-        switch (m_current.type) {
+        switch (m_current->type) {
         case TokenType::IntegerType:
             typeNode = std::make_shared<ast::IntegerType>();
             break;
@@ -219,24 +445,24 @@ sPtr<ast::Type> Parser::parseType() {
             error("unknown primitive type");
             return nullptr;
         }
-        typeNode->begin = m_current.pos;
+        typeNode->begin = m_current->pos;
         next();
-        typeNode->end = m_current.pos;
+        typeNode->end = m_current->pos;
         return typeNode;
-    } else if (m_current.type == TokenType::Array) {
+    } else if (m_current->type == TokenType::Array) {
         return parseArrayType();
-    } else if (m_current.type == TokenType::Record) {
+    } else if (m_current->type == TokenType::Record) {
         return parseRecordType();
-    } else if (m_current.type == TokenType::Identifier) {
+    } else if (m_current->type == TokenType::Identifier) {
         ast::AliasedType typeNode;
-        typeNode.begin = m_current.pos;
-        typeNode.name = m_current.lit;
+        typeNode.begin = m_current->pos;
+        typeNode.name = m_current->lit;
         next();
-        typeNode.end = m_current.pos;
+        typeNode.end = m_current->pos;
         return std::make_shared<ast::AliasedType>(typeNode);
     } else {
         error("unknown type");
-        m_lexer.Next();
+        consume();
         return nullptr;
     }
 }
@@ -246,11 +472,11 @@ sPtr<ast::ArrayType> Parser::parseArrayType() {
     RETURN_ON_FAIL();
 
     ast::ArrayType arrayNode;
-    arrayNode.begin = m_current.pos;
+    arrayNode.begin = m_current->pos;
 
     skipWhitespace();
-    if (m_lexer.Peek().type == TokenType::OpenBrack) {
-        m_lexer.Next();
+    if (peek().type == TokenType::OpenBrack) {
+        consume();
         arrayNode.length = parseExpression();
         expect(TokenType::CloseBrack);
         ADVANCE_ON_FAIL(TokenType::CloseBrack);
@@ -271,17 +497,17 @@ sPtr<ast::RecordType> Parser::parseRecordType() {
     RETURN_ON_FAIL();
 
     ast::RecordType recordNode;
-    recordNode.begin = m_current.pos;
+    recordNode.begin = m_current->pos;
 
     skipWhitespace();
-    while (m_lexer.Peek().type != TokenType::End) {
+    while (peek().type != TokenType::End) {
         recordNode.fields.push_back(parseVariableDecl());
         skipWhitespace();
     }
 
     next(); // consume "end"
 
-    recordNode.end = m_current.pos;
+    recordNode.end = m_current->pos;
     return std::make_shared<ast::RecordType>(recordNode);
 }
 
@@ -290,43 +516,43 @@ sPtr<ast::VariableDecl> Parser::parseVariableDecl() {
     RETURN_ON_FAIL();
 
     ast::VariableDecl variableNode;
-    variableNode.begin = m_current.pos;
+    variableNode.begin = m_current->pos;
 
     expect(TokenType::Identifier); // ... after 'var'"
     ADVANCE_ON_FAIL({TokenType::Semicolon, TokenType::NewLine});
 
-    variableNode.name = m_current.lit;
+    variableNode.name = m_current->lit;
 
     expect({TokenType::Colon, TokenType::Is}); // ... after identifier"
     ADVANCE_ON_FAIL({TokenType::Semicolon, TokenType::NewLine});
 
-    if (m_current.type == TokenType::Colon) {
+    if (m_current->type == TokenType::Colon) {
         variableNode.type = parseType();
 
-        if (m_lexer.Peek().type == TokenType::Is) {
-            m_lexer.Next(); // consume the "is"
+        if (peek().type == TokenType::Is) {
+            consume(); // consume the "is"
             variableNode.initialValue = parseExpression();
         }
-    } else if (m_current.type == TokenType::Is) {
+    } else if (m_current->type == TokenType::Is) {
         variableNode.initialValue = parseExpression();
     }
 
     expect({TokenType::Semicolon, TokenType::NewLine});
     ADVANCE_ON_FAIL({TokenType::Semicolon, TokenType::NewLine});
 
-    variableNode.end = m_current.pos;
+    variableNode.end = m_current->pos;
     return std::make_shared<ast::VariableDecl>(variableNode);
 }
 
 sPtr<ast::Body> Parser::parseBody() {
     skipWhitespace();
-    peek();
+    peekCurrent();
 
     ast::Body bodyNode;
-    bodyNode.begin = m_current.pos;
-    while (m_current.type != TokenType::End &&
-           m_current.type != TokenType::Else) {
-        switch (m_current.type) {
+    bodyNode.begin = m_current->pos;
+    while (m_current->type != TokenType::End &&
+           m_current->type != TokenType::Else) {
+        switch (m_current->type) {
         case TokenType::Var:
             bodyNode.variables.push_back(parseVariableDecl());
             break;
@@ -334,27 +560,27 @@ sPtr<ast::Body> Parser::parseBody() {
             bodyNode.types.push_back(parseTypeDecl());
             break;
         case TokenType::NewLine:
-            m_lexer.Next();
+            consume();
             break;
         default:
             bodyNode.statements.push_back(parseStatement());
         }
 
-        peek();
+        peekCurrent();
     }
 
-    bodyNode.end = m_current.pos;
+    bodyNode.end = m_current->pos;
     return std::make_shared<ast::Body>(bodyNode);
 }
 
 sPtr<ast::Statement> Parser::parseStatement() {
     skipWhitespace();
-    peek();
+    peekCurrent();
 
-    switch (m_current.type) {
+    switch (m_current->type) {
     case TokenType::Identifier: {
         auto expression = parseExpression();
-        if (m_lexer.Peek().type == TokenType::Assign) {
+        if (peek().type == TokenType::Assign) {
             return parseAssignment(expression);
         }
         // If a line starts with an identifier, it must be a routine call.
@@ -416,7 +642,7 @@ sPtr<ast::WhileLoop> Parser::parseWhileLoop() {
     RETURN_ON_FAIL();
 
     ast::WhileLoop whileNode;
-    whileNode.begin = m_current.pos;
+    whileNode.begin = m_current->pos;
     whileNode.condition = parseExpression();
 
     expect(TokenType::Loop);
@@ -429,7 +655,7 @@ sPtr<ast::WhileLoop> Parser::parseWhileLoop() {
     expect(TokenType::End);
     ADVANCE_ON_FAIL(TokenType::End);
 
-    whileNode.end = m_current.pos;
+    whileNode.end = m_current->pos;
     return std::make_shared<ast::WhileLoop>(whileNode);
 }
 
@@ -443,22 +669,22 @@ sPtr<ast::ForLoop> Parser::parseForLoop() {
     RETURN_ON_FAIL();
 
     ast::ForLoop forNode;
-    forNode.begin = m_current.pos;
+    forNode.begin = m_current->pos;
 
     expect(TokenType::Identifier);
     ADVANCE_ON_FAIL(TokenType::End);
 
     forNode.loopVar = std::make_shared<ast::VariableDecl>();
-    forNode.loopVar->begin = m_current.pos;
-    forNode.loopVar->name = m_current.lit;
+    forNode.loopVar->begin = m_current->pos;
+    forNode.loopVar->name = m_current->lit;
     forNode.loopVar->type = std::make_shared<ast::IntegerType>();
-    forNode.loopVar->end = m_current.pos;
+    forNode.loopVar->end = m_current->pos;
 
     expect(TokenType::In);
     ADVANCE_ON_FAIL(TokenType::End);
 
     skipWhitespace();
-    forNode.reverse = (m_lexer.Peek().type == TokenType::Reverse);
+    forNode.reverse = (peek().type == TokenType::Reverse);
     if (forNode.reverse) {
         next(); // consume "reverse" keyword
     }
@@ -480,7 +706,7 @@ sPtr<ast::ForLoop> Parser::parseForLoop() {
     expect(TokenType::End);
     ADVANCE_ON_FAIL(TokenType::End);
 
-    forNode.end = m_current.pos;
+    forNode.end = m_current->pos;
     return std::make_shared<ast::ForLoop>(forNode);
 }
 
@@ -492,7 +718,7 @@ sPtr<ast::IfStatement> Parser::parseIfStatement() {
     RETURN_ON_FAIL();
 
     ast::IfStatement ifNode;
-    ifNode.begin = m_current.pos;
+    ifNode.begin = m_current->pos;
 
     skipWhitespace();
     ifNode.condition = parseExpression();
@@ -506,13 +732,13 @@ sPtr<ast::IfStatement> Parser::parseIfStatement() {
     expect({TokenType::Else, TokenType::End});
     ADVANCE_ON_FAIL(TokenType::End);
 
-    if (m_current.type == TokenType::Else) {
+    if (m_current->type == TokenType::Else) {
         ifNode.elseBody = parseBody();
         expect(TokenType::End);
         ADVANCE_ON_FAIL(TokenType::End);
     }
 
-    ifNode.end = m_current.pos;
+    ifNode.end = m_current->pos;
     return std::make_shared<ast::IfStatement>(ifNode);
 }
 
@@ -521,7 +747,7 @@ sPtr<ast::ReturnStatement> Parser::parseReturnStatement() {
     RETURN_ON_FAIL();
 
     ast::ReturnStatement returnNode;
-    returnNode.begin = m_current.pos;
+    returnNode.begin = m_current->pos;
 
     skipWhitespace();
     returnNode.expression = parseExpression();
@@ -529,7 +755,7 @@ sPtr<ast::ReturnStatement> Parser::parseReturnStatement() {
     expect({TokenType::Semicolon, TokenType::NewLine});
     ADVANCE_ON_FAIL({TokenType::Semicolon, TokenType::NewLine});
 
-    returnNode.end = m_current.pos;
+    returnNode.end = m_current->pos;
     return std::make_shared<ast::ReturnStatement>(returnNode);
 }
 
@@ -537,188 +763,243 @@ sPtr<ast::Expression> Parser::parseExpression() {
     return parseBinaryExpression();
 }
 
+/**
+ * Prefix parselets, indexed by the type of the first token of an operand.
+ * Token types without a parselet cannot start an expression.
+ */
+constexpr std::array<Parser::PrefixParselet, lexer::g_tokenTypeCount>
+    Parser::s_prefixRules = [] {
+        std::array<PrefixParselet, lexer::g_tokenTypeCount> rules{};
+        auto set = [&](TokenType type, PrefixParselet parselet) {
+            rules[static_cast<size_t>(type)] = parselet;
+        };
+
+        set(TokenType::Not, &Parser::parseUnaryOperator);
+        set(TokenType::Sub, &Parser::parseUnaryOperator);
+        set(TokenType::Add, &Parser::parseUnaryOperator);
+        set(TokenType::OpenParen, &Parser::parseParenthesized);
+
+        set(TokenType::Identifier, &Parser::parsePrimary);
+        set(TokenType::Int, &Parser::parsePrimary);
+        set(TokenType::Real, &Parser::parsePrimary);
+        set(TokenType::True, &Parser::parsePrimary);
+        set(TokenType::False, &Parser::parsePrimary);
+
+        // Binary operators cannot start an operand
+        for (auto type :
+             {TokenType::Or, TokenType::Xor, TokenType::And, TokenType::Eq,
+              TokenType::Neq, TokenType::Less, TokenType::Leq,
+              TokenType::Greater, TokenType::Geq, TokenType::Mul,
+              TokenType::Div, TokenType::Mod, TokenType::Dot,
+              TokenType::OpenBrack}) {
+            set(type, &Parser::parseMisplacedOperator);
+        }
+
+        return rules;
+    }();
+
+/**
+ * Infix parselets together with the binding power of the operator, indexed by
+ * the type of the operator token. Token types without a parselet end an
+ * expression.
+ */
+constexpr std::array<Parser::InfixRule, lexer::g_tokenTypeCount>
+    Parser::s_infixRules = [] {
+        std::array<InfixRule, lexer::g_tokenTypeCount> rules{};
+        auto set = [&](TokenType type, int prec, InfixParselet parselet) {
+            rules[static_cast<size_t>(type)] = {prec, parselet};
+        };
+
+        set(TokenType::Or, 1, &Parser::parseBinaryOperator);
+        set(TokenType::Xor, 1, &Parser::parseBinaryOperator);
+        set(TokenType::And, 2, &Parser::parseBinaryOperator);
+        set(TokenType::Eq, 3, &Parser::parseBinaryOperator);
+        set(TokenType::Neq, 3, &Parser::parseBinaryOperator);
+        set(TokenType::Less, 4, &Parser::parseBinaryOperator);
+        set(TokenType::Leq, 4, &Parser::parseBinaryOperator);
+        set(TokenType::Greater, 4, &Parser::parseBinaryOperator);
+        set(TokenType::Geq, 4, &Parser::parseBinaryOperator);
+        set(TokenType::Add, 5, &Parser::parseBinaryOperator);
+        set(TokenType::Sub, 5, &Parser::parseBinaryOperator);
+        set(TokenType::Mul, 6, &Parser::parseBinaryOperator);
+        set(TokenType::Div, 6, &Parser::parseBinaryOperator);
+        set(TokenType::Mod, 6, &Parser::parseBinaryOperator);
+        set(TokenType::Dot, 8, &Parser::parseBinaryOperator);
+        set(TokenType::OpenBrack, 8, &Parser::parseIndex);
+
+        return rules;
+    }();
+
 sPtr<ast::Expression> Parser::parseUnaryExpression() {
     skipWhitespace();
-    peek();
+    peekCurrent();
 
-    if (opPrec(m_current.type) >= 0) {
-        // if has operations on primary
-        if (m_current.type == TokenType::Not ||
-            m_current.type == TokenType::Sub ||
-            m_current.type == TokenType::Add) {
+    auto parselet = s_prefixRules[static_cast<size_t>(m_current->type)];
+    if (parselet == nullptr) {
+        return nullptr;
+    }
 
-            // math unary operations
-            ast::UnaryExpression exprNode;
-            exprNode.begin = m_current.pos;
+    return (this->*parselet)();
+}
 
-            next();
-            exprNode.operation = m_current.type;
+/**
+ * Precedence climbing: keeps folding operators that bind at least as tight as
+ * `prec1` into the left operand.
+ */
+sPtr<ast::Expression> Parser::parseBinaryExpression(int prec1) {
+    auto lhs = parseUnaryExpression();
 
-            exprNode.operand = parseUnaryExpression();
-            if (exprNode.operand != nullptr) {
-                exprNode.end = exprNode.operand->end;
-            }
+    for (;;) {
+        const Token& op = peek();
+        const InfixRule& rule = s_infixRules[static_cast<size_t>(op.type)];
 
-            return std::make_shared<ast::UnaryExpression>(exprNode);
+        if (rule.parselet == nullptr || rule.prec < prec1) {
+            return lhs;
+        }
 
-        } else if (m_current.type == TokenType::OpenParen) {
-            skipWhitespace();
-            // parenthesis -> more priority
-            next();
+        next(); // the infix parselet finds the operator in `m_current`
 
-            auto exprNode = parseBinaryExpression();
+        lhs = (this->*rule.parselet)(std::move(lhs), rule.prec);
+        if (lhs == nullptr) {
+            return nullptr;
+        }
+    }
+}
 
-            expect(TokenType::CloseParen);
-            ADVANCE_ON_FAIL(TokenType::CloseParen);
+sPtr<ast::Expression> Parser::parseUnaryOperator() {
+    auto exprNode = std::make_shared<ast::UnaryExpression>();
+    exprNode->begin = m_current->pos;
 
-            return exprNode;
-        }
+    next();
+    exprNode->operation = m_current->type;
 
-        error("expected unary operator");
-        return nullptr;
+    exprNode->operand = parseUnaryExpression();
+    if (exprNode->operand != nullptr) {
+        exprNode->end = exprNode->operand->end;
+    }
 
-    } else if (isPrimary(m_current.type)) {
-        // if is pure primary
-        next();
+    return exprNode;
+}
 
-        // check if parametrized routine call
-        if (m_current.type == TokenType::Identifier &&
-            m_lexer.Peek().type == TokenType::OpenParen) {
-            return parseRoutineCall(m_current);
-        }
+sPtr<ast::Expression> Parser::parseParenthesized() {
+    next(); // consume the '('
 
-        sPtr<ast::Expression> primNode;
-        switch (m_current.type) {
-        case TokenType::Int:
-            primNode = std::make_shared<ast::IntegerLiteral>(
-                std::stoll(m_current.lit));
-            break;
-        case TokenType::Real:
-            primNode =
-                std::make_shared<ast::RealLiteral>(std::stod(m_current.lit));
-            break;
-        case TokenType::True:
-            primNode = std::make_shared<ast::BooleanLiteral>(true);
-            break;
-        case TokenType::False:
-            primNode = std::make_shared<ast::BooleanLiteral>(false);
-            break;
-        case TokenType::Identifier: // can possibly be a routine call
-            primNode = std::make_shared<ast::Identifier>(m_current.lit);
-            break;
-        default:
-            error("unknown primary expression");
-            return nullptr;
-        }
+    auto exprNode = parseBinaryExpression();
+
+    expect(TokenType::CloseParen);
+    ADVANCE_ON_FAIL(TokenType::CloseParen);
+
+    return exprNode;
+}
 
-        primNode->begin = m_current.pos;
-        primNode->end = m_current.pos;
+sPtr<ast::Expression> Parser::parsePrimary() {
+    next();
 
-        return primNode;
+    // check if parametrized routine call
+    if (m_current->type == TokenType::Identifier &&
+        peek().type == TokenType::OpenParen) {
+        return parseRoutineCall(*m_current);
     }
 
-    return nullptr;
+    sPtr<ast::Expression> primNode;
+    switch (m_current->type) {
+    case TokenType::Int:
+        primNode =
+            std::make_shared<ast::IntegerLiteral>(std::stoll(m_current->lit));
+        break;
+    case TokenType::Real:
+        primNode =
+            std::make_shared<ast::RealLiteral>(std::stod(m_current->lit));
+        break;
+    case TokenType::True:
+        primNode = std::make_shared<ast::BooleanLiteral>(true);
+        break;
+    case TokenType::False:
+        primNode = std::make_shared<ast::BooleanLiteral>(false);
+        break;
+    case TokenType::Identifier: // can possibly be a routine call
+        primNode = std::make_shared<ast::Identifier>(m_current->lit);
+        break;
+    default:
+        error("unknown primary expression");
+        return nullptr;
+    }
+
+    primNode->begin = m_current->pos;
+    primNode->end = m_current->pos;
+
+    return primNode;
 }
 
-sPtr<ast::Expression> Parser::parseBinaryExpression(int prec1) {
-    auto lhs = parseUnaryExpression();
+sPtr<ast::Expression> Parser::parseMisplacedOperator() {
+    error("expected unary operator");
+    return nullptr;
+}
 
-    for (;;) {
-        auto op = m_lexer.Peek();
-        int prec = opPrec(op.type);
+sPtr<ast::Expression> Parser::parseBinaryOperator(sPtr<ast::Expression> lhs,
+                                                  int prec) {
+    auto exprNode = std::make_shared<ast::BinaryExpression>();
+    if (lhs != nullptr) {
+        exprNode->begin = lhs->begin;
+    }
 
-        if (prec < prec1) {
-            return lhs;
-        }
+    exprNode->operand1 = std::move(lhs);
+    exprNode->operation = m_current->type;
 
-        op = m_lexer.Next();
+    // Operators are left-associative, so the right operand must bind tighter
+    exprNode->operand2 = parseBinaryExpression(prec + 1);
+    if (exprNode->operand2 != nullptr) {
+        exprNode->end = exprNode->operand2->end;
+    }
 
-        ast::BinaryExpression expr;
-        if (lhs != nullptr) {
-            expr.begin = lhs->begin;
-        }
+    return exprNode;
+}
 
-        expr.operand1 = lhs;
-        expr.operation = op.type;
+sPtr<ast::Expression> Parser::parseIndex(sPtr<ast::Expression> lhs, int) {
+    auto exprNode = std::make_shared<ast::BinaryExpression>();
+    if (lhs != nullptr) {
+        exprNode->begin = lhs->begin;
+    }
 
-        if (op.type == TokenType::OpenBrack) {
-            expr.operand2 = parseBinaryExpression(0);
+    exprNode->operand1 = std::move(lhs);
+    exprNode->operation = TokenType::OpenBrack;
+    exprNode->operand2 = parseBinaryExpression(0);
 
-            expect(TokenType::CloseBrack);
-            ADVANCE_ON_FAIL(TokenType::CloseBrack);
-        } else {
-            expr.operand2 = parseBinaryExpression(prec + 1);
-        }
+    expect(TokenType::CloseBrack);
+    ADVANCE_ON_FAIL(TokenType::CloseBrack);
 
-        expr.end = expr.operand2->end;
-        lhs = std::make_shared<ast::BinaryExpression>(expr);
+    if (exprNode->operand2 != nullptr) {
+        exprNode->end = exprNode->operand2->end;
     }
+
+    return exprNode;
 }
 
-sPtr<ast::RoutineCall> Parser::parseRoutineCall(Token routineName) {
-    ast::RoutineCall rountineCallNode;
-    rountineCallNode.routineName = routineName.lit; // save the function name
-    rountineCallNode.begin = routineName.pos;
+sPtr<ast::RoutineCall> Parser::parseRoutineCall(const Token& routineName) {
+    auto rountineCallNode = std::make_shared<ast::RoutineCall>();
+    rountineCallNode->routineName = routineName.lit; // save the function name
+    rountineCallNode->begin = routineName.pos;
 
-    peek();
+    peekCurrent();
     // '(' is optional when calling a routine without params
-    if (m_current.type == TokenType::OpenParen) {
+    if (m_current->type == TokenType::OpenParen) {
         next(); // consume the '('
         // handle the case of no parameters
-        peek();
-        if (m_current.type == TokenType::CloseParen) {
-            m_lexer.Next(); // consume the ')'
+        peekCurrent();
+        if (m_current->type == TokenType::CloseParen) {
+            consume(); // consume the ')'
         }
 
-        while (m_current.type != TokenType::CloseParen) {
-            rountineCallNode.args.push_back(parseExpression());
+        while (m_current->type != TokenType::CloseParen) {
+            rountineCallNode->args.push_back(parseExpression());
 
             expect({TokenType::Comma, TokenType::CloseParen});
             ADVANCE_ON_FAIL(TokenType::CloseParen);
         }
     }
 
-    rountineCallNode.end = m_current.pos;
-    return std::make_shared<ast::RoutineCall>(rountineCallNode);
-}
-
-int Parser::opPrec(const TokenType& token) {
-    switch (token) {
-    case TokenType::Or:  // or
-    case TokenType::Xor: // xor
-        return 1;
-    case TokenType::And: // and
-        return 2;
-    case TokenType::Eq:  // =
-    case TokenType::Neq: // /=
-        return 3;
-    case TokenType::Less:    // <
-    case TokenType::Leq:     // <=
-    case TokenType::Greater: // >
-    case TokenType::Geq:     // >=
-        return 4;
-    case TokenType::Add: // +
-    case TokenType::Sub: // -
-        return 5;
-    case TokenType::Mul: // *
-    case TokenType::Div: // /
-    case TokenType::Mod: // %
-        return 6;
-    case TokenType::Not:       // not
-    case TokenType::OpenParen: // ()
-        return 7;
-    case TokenType::Dot:       // .
-    case TokenType::OpenBrack: // []
-        return 8;
-    default:
-        return -1; // unknown op
-    }
-}
-
-bool Parser::isPrimary(const TokenType& token) {
-    return token == TokenType::Identifier || token == TokenType::Int ||
-           token == TokenType::Real || token == TokenType::True ||
-           token == TokenType::False;
+    rountineCallNode->end = m_current->pos;
+    return rountineCallNode;
 }
 
 /**
@@ -727,41 +1008,55 @@ bool Parser::isPrimary(const TokenType& token) {
  * token. The next token is consumed (along with any whitespace before it)
  * regardless of whether or not it was a desired token.
  */
-void Parser::expect(const std::vector<TokenType>& types, std::string errMsg) {
+void Parser::expect(TokenSet types, std::string_view errMsg) {
     // if "new line" is not one of the characters we are looking for, then skip
     // any occurence of it
-    if (!util::Contains(types, TokenType::NewLine)) {
+    if (!types.Contains(TokenType::NewLine)) {
         skipWhitespace();
     }
 
-    auto next = m_lexer.Next();
-    if (!util::Contains(types, next.type)) {
+    m_current = &consume();
+    if (!types.Contains(m_current->type)) {
+        // The message is only built here, on the error path.
         if (errMsg.empty()) {
-            errMsg = util::GenExpectMessage(types) + ", got " +
-                     lexer::to_string(next.type);
+            error(*m_current, util::GenExpectMessage(types) + ", got " +
+                                  lexer::to_string(m_current->type));
+        } else {
+            error(*m_current, std::string(errMsg));
         }
-        error(next, errMsg);
-        next = Token{.type = TokenType::Illegal};
+        m_current = &s_illegal;
+    }
+}
+
+/**
+ * Returns the token `k` positions after the next one without consuming
+ * anything. Looking past the end of the stream yields the Eof token.
+ */
+const Token& Parser::peek(size_t k) const {
+    if (m_cursor >= m_tokens.size()) {
+        throw std::overflow_error("End-of-file already consumed");
     }
 
-    m_current = next;
+    return m_tokens[std::min(m_cursor + k, m_tokens.size() - 1)];
 }
 
 /**
- * An overload of `expect` that allows passing just one type for ease of use.
- * Wraps that token type in a vector
+ * Consumes the next token and returns a reference to it inside the token
+ * buffer. `m_current` is left untouched.
  */
-void Parser::expect(const TokenType& type, std::string errMsg) {
-    return expect(std::vector{type}, errMsg);
+const Token& Parser::consume() {
+    const Token& tok = peek();
+    m_cursor++;
+    return tok;
 }
 
-void Parser::next() { m_current = m_lexer.Next(); }
+void Parser::next() { m_current = &consume(); }
 
-void Parser::peek() { m_current = m_lexer.Peek(); }
+void Parser::peekCurrent() { m_current = &peek(); }
 
 void Parser::skipWhitespace() {
-    while (m_lexer.Peek().type == TokenType::NewLine) {
-        m_lexer.Next();
+    while (peek().type == TokenType::NewLine) {
+        consume();
     }
 }
 
@@ -769,24 +1064,16 @@ void Parser::skipWhitespace() {
  * Keeps consuming tokens until it finds one of the desired token types, and
  *  consumes that one as well.
  */
-void Parser::advance(const std::vector<TokenType>& types) {
-    Token next = m_lexer.Next();
-    while (next.type != TokenType::Eof && !util::Contains(types, next.type)) {
-        next = m_lexer.Next();
+void Parser::advance(TokenSet types) {
+    const Token* next = &consume();
+    while (next->type != TokenType::Eof && !types.Contains(next->type)) {
+        next = &consume();
     }
 }
 
-/**
- * An overload of `advance` that allows passing just one type for ease of use.
- * Wraps that token type in a vector.
- */
-void Parser::advance(const TokenType& type) {
-    return advance(std::vector{type});
-}
-
 void Parser::error(const std::string& msg) {
     m_errors.push_back(ast::Error{
-        .pos = m_current.pos,
+        .pos = m_current->pos,
         .message = msg,
     });
 }
@@ -798,6 +1085,25 @@ void Parser::error(const lexer::Token& tok, const std::string& msg) {
     });
 }
 
-std::vector<ast::Error> Parser::getErrors() { return m_errors; }
+void Parser::setLazyBodies(bool lazy) { m_lazyBodies = lazy; }
+
+/**
+ * Returns the errors found so far, followed by those found in lazily parsed
+ *  routine bodies. The bodies are ordered by position, so the result does not
+ *  depend on the order they were accessed in.
+ */
+std::vector<ast::Error> Parser::getErrors() {
+    auto errors = m_errors;
+    std::lock_guard<std::mutex> lock(m_bodyErrors->mutex);
+    auto bodies = m_bodyErrors->bodies;
+    std::stable_sort(bodies.begin(), bodies.end(),
+                     [](const auto& a, const auto& b) {
+                         return a.first < b.first;
+                     });
+    for (auto& body : bodies) {
+        errors.insert(errors.end(), body.second.begin(), body.second.end());
+    }
+    return errors;
+}
 
 } // namespace parser
@@ -3,6 +3,13 @@
 #include "ast.hpp"
 #include "lexer.hpp"
 #include "token.hpp"
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
 
 namespace parser {
 
@@ -10,8 +17,11 @@ template <typename T> using sPtr = std::shared_ptr<T>;
 
 class Parser {
 public:
-    Parser(lexer::Lexer lexer) : m_lexer(lexer) {}
+    Parser(lexer::Lexer lexer);
+    Parser(std::vector<lexer::Token> tokens);
     sPtr<ast::Program> parseProgram();
+    sPtr<ast::Program> parseProgramParallel(unsigned threads = 0);
+    void setLazyBodies(bool lazy = true);
     sPtr<ast::RoutineDecl> parseRoutineDecl();
     sPtr<ast::VariableDecl> parseParameter();
     sPtr<ast::TypeDecl> parseTypeDecl();
@@ -30,27 +40,112 @@ public:
     sPtr<ast::Expression> parseExpression();
     sPtr<ast::Expression> parseUnaryExpression();
     sPtr<ast::Expression> parseBinaryExpression(int prec1 = 0);
-    sPtr<ast::RoutineCall> parseRoutineCall(lexer::Token);
+    sPtr<ast::RoutineCall> parseRoutineCall(const lexer::Token&);
     std::vector<ast::Error> getErrors();
 
+    static std::vector<std::pair<size_t, size_t>>
+    splitTopLevel(const std::vector<lexer::Token>& tokens, size_t from);
+
 private:
-    lexer::Lexer m_lexer;
-    lexer::Token m_current;
+    // The whole token stream is lexed upfront and always ends with an Eof
+    // token. `m_cursor` points to the next token to be consumed.
+    std::vector<lexer::Token> m_tokens;
+    size_t m_cursor = 0;
+
+    // Points either into `m_tokens` or to `s_illegal` after a failed
+    // `expect`.
+    const lexer::Token* m_current;
+
+    static const lexer::Token s_illegal;
 
     std::vector<ast::Error> m_errors;
 
-    void expect(const std::vector<lexer::TokenType>&, std::string = "");
-    void expect(const lexer::TokenType&, std::string = "");
+    // With lazy bodies, routine bodies are only scanned for their closing
+    // 'end' and parsed when first accessed. Errors found then are collected
+    // here, as the parser may already be gone. Bodies of different routines
+    // may be accessed from different threads.
+    bool m_lazyBodies = false;
+    struct BodyErrors {
+        std::mutex mutex;
+        // The errors of every body that failed to parse, by where it starts
+        std::vector<std::pair<lexer::Token::Position, std::vector<ast::Error>>>
+            bodies;
+    };
+    sPtr<BodyErrors> m_bodyErrors;
+
+    bool skipBody(ast::RoutineDecl& routine);
+
+    void expect(lexer::TokenSet, std::string_view = {});
+    const lexer::Token& peek(size_t k = 0) const;
+    const lexer::Token& consume();
     void next();
-    void peek();
+    void peekCurrent();
 
     void skipWhitespace();
-    void advance(const std::vector<lexer::TokenType>&);
-    void advance(const lexer::TokenType&);
+    void advance(lexer::TokenSet);
     void error(const std::string& msg);
     void error(const lexer::Token& pos, const std::string& msg);
-    bool isPrimary(const lexer::TokenType&);
-    int opPrec(const lexer::TokenType&);
+
+    // Expression parsing is table-driven (Pratt parser). Prefix parselets are
+    // invoked with the first token of an operand peeked, infix ones right
+    // after the operator has been consumed.
+    using PrefixParselet = sPtr<ast::Expression> (Parser::*)();
+    using InfixParselet = sPtr<ast::Expression> (Parser::*)(
+        sPtr<ast::Expression> lhs, int prec);
+
+    struct InfixRule {
+        int prec = -1;
+        InfixParselet parselet = nullptr;
+    };
+
+    static const std::array<PrefixParselet, lexer::g_tokenTypeCount>
+        s_prefixRules;
+    static const std::array<InfixRule, lexer::g_tokenTypeCount> s_infixRules;
+
+    sPtr<ast::Expression> parseUnaryOperator();
+    sPtr<ast::Expression> parseParenthesized();
+    sPtr<ast::Expression> parsePrimary();
+    sPtr<ast::Expression> parseMisplacedOperator();
+    sPtr<ast::Expression> parseBinaryOperator(sPtr<ast::Expression> lhs,
+                                              int prec);
+    sPtr<ast::Expression> parseIndex(sPtr<ast::Expression> lhs, int prec);
+};
+
+/**
+ * IncrementalParser keeps the program it parsed last, cut into top-level
+ * chunks. Given an edited version of the source, it only lexes and parses the
+ * chunks the edit touched and reuses the declaration nodes of all the others.
+ * The result is the same as parsing the new source from scratch.
+ *
+ * Reused nodes that moved are updated in place. Semantic passes rewrite and
+ * share nodes across declarations, so they should not run on the returned
+ * declarations if the program is to be parsed incrementally again.
+ */
+class IncrementalParser {
+public:
+    sPtr<ast::Program> parse(std::string source);
+    std::vector<ast::Error> getErrors();
+
+private:
+    struct Chunk {
+        size_t offset;                // of the first token in the source
+        lexer::Token::Position begin; // of the first token
+        uint64_t fingerprint;         // of the tokens, relative to `begin`
+        std::vector<sPtr<ast::RoutineDecl>> routines;
+        std::vector<sPtr<ast::VariableDecl>> variables;
+        std::vector<sPtr<ast::TypeDecl>> types;
+        std::vector<ast::Error> errors;
+    };
+
+    std::string m_source;
+    std::vector<Chunk> m_chunks;
+    lexer::Token::Position m_begin{};
+    sPtr<ast::Program> m_program;
+
+    bool parseRegion(const std::string& source, size_t from,
+                     lexer::Token::Position pos, size_t to,
+                     lexer::Token::Position eofPos,
+                     std::vector<Chunk>& reusable, std::vector<Chunk>& chunks);
 };
 
 } // namespace parser
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstddef>
+
+/**
+ * Number of allocations made so far by all threads. The compiler replaces the
+ *  global `operator new` to count them, which is how the time report
+ *  attributes allocations to the passes that make them.
+ */
+std::size_t allocationCount();
@@ -0,0 +1,115 @@
+#include "compilation_cache.hpp"
+#include "fmt/core.h"
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wconversion"
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SHA1.h"
+#pragma GCC diagnostic pop
+#include <chrono>
+#include <cstdlib>
+
+namespace fs = llvm::sys::fs;
+
+namespace {
+
+// Name of the file of an entry
+constexpr const char* objectName = "program.o";
+
+// Any function of the compiler will do to find its executable
+void anchor() {}
+
+/** Identifies the running compiler by its executable and the LLVM it uses */
+std::string compilerIdentity() {
+    auto executable =
+        fs::getMainExecutable(nullptr, reinterpret_cast<void*>(&anchor));
+    fs::file_status status;
+    if (executable.empty() || fs::status(executable, status)) {
+        return LLVM_VERSION_STRING;
+    }
+    auto modified = status.getLastModificationTime().time_since_epoch();
+    return fmt::format(
+        "{} {} {} {}", LLVM_VERSION_STRING, executable, status.getSize(),
+        std::chrono::duration_cast<std::chrono::nanoseconds>(modified).count());
+}
+
+void update(llvm::SHA1& hash, std::string_view data) {
+    // Every part is preceded by its length, so different parts never hash
+    //  the same by moving characters from one to the next
+    hash.update(std::to_string(data.size()) + ':');
+    hash.update(llvm::StringRef(data.data(), data.size()));
+}
+
+std::string entryFile(const std::string& directory, const std::string& key,
+                      const char* name) {
+    llvm::SmallString<128> path(directory);
+    llvm::sys::path::append(path, key, name);
+    return std::string(path.str());
+}
+
+} // namespace
+
+CompilationCache::CompilationCache(std::string directory)
+    : m_compiler(compilerIdentity()) {
+    // Unique names are made from an absolute model, a relative one ends up
+    //  in the system's temporary directory
+    llvm::SmallString<128> path(directory);
+    fs::make_absolute(path);
+    m_directory = std::string(path.str());
+}
+
+std::string CompilationCache::defaultDirectory() {
+    if (auto directory = std::getenv("RIDDLE_CACHE_DIR")) {
+        return directory;
+    }
+    llvm::SmallString<128> path;
+    if (!llvm::sys::path::cache_directory(path)) {
+        return ".riddle-cache";
+    }
+    llvm::sys::path::append(path, "riddle");
+    return std::string(path.str());
+}
+
+std::string CompilationCache::key(std::string_view source,
+                                  std::string_view options) const {
+    llvm::SHA1 hash;
+    update(hash, m_compiler);
+    update(hash, options);
+    update(hash, source);
+    return llvm::toHex(hash.final(), true);
+}
+
+bool CompilationCache::fetch(const std::string& key,
+                             const std::string& objectFile) {
+    if (fs::copy_file(entryFile(m_directory, key, objectName), objectFile)) {
+        m_misses++;
+        return false;
+    }
+    m_hits++;
+    return true;
+}
+
+bool CompilationCache::store(const std::string& key,
+                             const std::string& objectFile) {
+    llvm::SmallString<128> staging;
+    if (fs::create_directories(m_directory) ||
+        fs::createUniqueDirectory(m_directory + "/tmp", staging)) {
+        return false;
+    }
+
+    std::string stagingDir(staging.str());
+    llvm::SmallString<128> entry(m_directory);
+    llvm::sys::path::append(entry, key);
+    // Renaming fails if another compiler has filed the same entry meanwhile,
+    //  which is just as good
+    if (fs::copy_file(objectFile, stagingDir + "/" + objectName) ||
+        fs::rename(stagingDir, entry)) {
+        fs::remove_directories(stagingDir);
+        return fs::exists(entryFile(m_directory, key, objectName));
+    }
+    return true;
+}
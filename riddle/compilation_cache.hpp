@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+/**
+ * On-disk cache of compiled programs. An entry holds the object file
+ *  generated for a source file, filed under a hash of everything it depends
+ *  on: the source, the compiler that produced it and the options it was run
+ *  with. The key changes whenever any of these does, so entries never go
+ *  stale and are never invalidated.
+ *
+ * Entries are assembled under a temporary name and renamed into place, so
+ *  compilers sharing the directory never see an entry half-written.
+ */
+class CompilationCache {
+public:
+    /**
+     * Keeps the entries in `directory`, which is created when first needed. A
+     *  relative directory is taken from the current working directory.
+     */
+    explicit CompilationCache(std::string directory);
+
+    /**
+     * Directory of the cache unless told otherwise: $RIDDLE_CACHE_DIR if set,
+     *  the riddle directory in the user's cache directory otherwise
+     */
+    static std::string defaultDirectory();
+
+    /** Key of `source` compiled by this compiler with `options` */
+    std::string key(std::string_view source, std::string_view options) const;
+
+    /**
+     * Copies the entry filed under `key` to `objectFile`. Returns false,
+     *  counting a miss, if there is no such entry.
+     */
+    bool fetch(const std::string& key, const std::string& objectFile);
+    /** Files a copy of `objectFile` under `key` */
+    bool store(const std::string& key, const std::string& objectFile);
+
+    std::size_t hits() const { return m_hits; }
+    std::size_t misses() const { return m_misses; }
+    const std::string& directory() const { return m_directory; }
+
+private:
+    std::string m_directory;
+    // Identifies the compiler binary, anything built by another one is
+    //  filed under other keys
+    std::string m_compiler;
+    std::size_t m_hits = 0;
+    std::size_t m_misses = 0;
+};
@@ -0,0 +1,129 @@
+#include "diagnostic_engine.hpp"
+#include "fmt/color.h"
+#include <iterator>
+#include <utility>
+
+namespace {
+
+// Large batches are written out in chunks of about this size
+constexpr std::size_t flushThreshold = 1 << 16;
+
+void appendJsonString(fmt::memory_buffer& buffer, std::string_view text) {
+    auto out = std::back_inserter(buffer);
+    buffer.push_back('"');
+    for (char c : text) {
+        switch (c) {
+        case '"':
+            fmt::format_to(out, "\\\"");
+            break;
+        case '\\':
+            fmt::format_to(out, "\\\\");
+            break;
+        case '\n':
+            fmt::format_to(out, "\\n");
+            break;
+        case '\t':
+            fmt::format_to(out, "\\t");
+            break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                fmt::format_to(out, "\\u{:04x}", static_cast<unsigned>(c));
+            } else {
+                buffer.push_back(c);
+            }
+        }
+    }
+    buffer.push_back('"');
+}
+
+} // namespace
+
+DiagnosticEngine::DiagnosticEngine(std::string_view source, std::string path,
+                                   Format format, std::FILE* sink)
+    : m_source(source), m_path(std::move(path)), m_format(format),
+      m_sink(sink) {}
+
+DiagnosticEngine::~DiagnosticEngine() { flush(); }
+
+void DiagnosticEngine::report(std::string_view stage,
+                              const std::vector<ast::Error>& errors) {
+    if (errors.empty()) {
+        return;
+    }
+
+    if (m_format == Format::Text) {
+        fmt::format_to(std::back_inserter(m_buffer),
+                       fg(fmt::color::indian_red) | fmt::emphasis::bold,
+                       "{} errors:\n", stage);
+    }
+    for (auto& error : errors) {
+        if (m_format == Format::Json) {
+            printJson(stage, error);
+        } else {
+            printText(stage, error);
+        }
+        if (m_buffer.size() > flushThreshold) {
+            flush();
+        }
+    }
+    // Whatever the stages print next comes after their errors
+    flush();
+}
+
+void DiagnosticEngine::flush() {
+    std::fwrite(m_buffer.data(), 1, m_buffer.size(), m_sink);
+    std::fflush(m_sink);
+    m_buffer.clear();
+}
+
+std::string_view DiagnosticEngine::line(std::size_t number) {
+    if (m_lineStarts.empty()) {
+        m_lineStarts.push_back(0);
+        for (std::size_t i = 0; i < m_source.size(); i++) {
+            if (m_source[i] == '\n') {
+                m_lineStarts.push_back(i + 1);
+            }
+        }
+    }
+
+    if (number == 0 || number > m_lineStarts.size()) {
+        return {};
+    }
+    auto begin = m_lineStarts[number - 1];
+    auto end = number < m_lineStarts.size() ? m_lineStarts[number] - 1
+                                            : m_source.size();
+    auto text = m_source.substr(begin, end - begin);
+    if (!text.empty() && text.back() == '\r') {
+        text.remove_suffix(1);
+    }
+    return text;
+}
+
+void DiagnosticEngine::printText(std::string_view, const ast::Error& error) {
+    auto out = std::back_inserter(m_buffer);
+    auto text = line(error.pos.line);
+    // The caret goes under the column, the dashes fill up the line
+    auto before = error.pos.column > 0 ? error.pos.column - 1 : 0;
+    auto after = text.size() > before + 2 ? text.size() - before - 2 : 0;
+
+    fmt::format_to(out, "*\t{}\n", text);
+    fmt::format_to(out, "\t{:->{}}^{:-<{}}\n", "", before, "", after);
+    fmt::format_to(out, fg(fmt::color::indian_red),
+                   "\t[line: {}, column: {}]: {}\n\n", error.pos.line,
+                   error.pos.column, error.message);
+}
+
+void DiagnosticEngine::printJson(std::string_view stage,
+                                 const ast::Error& error) {
+    auto out = std::back_inserter(m_buffer);
+    fmt::format_to(out, "{{\"file\":");
+    appendJsonString(m_buffer, m_path);
+    fmt::format_to(out, ",\"stage\":");
+    appendJsonString(m_buffer, stage);
+    fmt::format_to(out, ",\"line\":{},\"column\":{},\"message\":",
+                   error.pos.line, error.pos.column);
+    appendJsonString(m_buffer, error.message);
+    fmt::format_to(out, ",\"source\":");
+    appendJsonString(m_buffer, line(error.pos.line));
+    fmt::format_to(out, "}}\n");
+}
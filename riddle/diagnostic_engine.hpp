@@ -0,0 +1,46 @@
+#pragma once
+
+#include "ast.hpp"
+#include "fmt/format.h"
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Prints the errors of the compilation stages along with the source lines
+ *  they point to, either for people or as JSON Lines for tools.
+ *
+ * The lines are found through an index of their offsets in the source, built
+ *  the first time one is needed, and printed straight out of the source.
+ *  Output is collected in a buffer and written to the sink a batch at a time.
+ */
+class DiagnosticEngine {
+public:
+    enum class Format { Text, Json };
+
+    /** `source` has to outlive the engine */
+    DiagnosticEngine(std::string_view source, std::string path,
+                     Format format = Format::Text, std::FILE* sink = stdout);
+    ~DiagnosticEngine();
+
+    /** Reports the errors of the stage called `stage`, if there are any */
+    void report(std::string_view stage, const std::vector<ast::Error>& errors);
+    /** Writes whatever is buffered to the sink */
+    void flush();
+
+private:
+    std::string_view m_source;
+    std::string m_path;
+    Format m_format;
+    std::FILE* m_sink;
+    fmt::memory_buffer m_buffer;
+    // Offset of the first character of every line, built by `line`
+    std::vector<std::size_t> m_lineStarts;
+
+    /** Text of the line `number` (starting at 1) without its line break */
+    std::string_view line(std::size_t number);
+    void printText(std::string_view stage, const ast::Error& error);
+    void printJson(std::string_view stage, const ast::Error& error);
+};
@@ -1,4 +1,7 @@
+#include "allocation_counter.hpp"
 #include "code_generator.hpp"
+#include "compilation_cache.hpp"
+#include "diagnostic_engine.hpp"
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wconversion"
 #pragma GCC diagnostic ignored "-Wunused-parameter"
@@ -9,36 +12,56 @@
 #include "lexer.hpp"
 #include "parser.hpp"
 #include "san.hpp"
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wconversion"
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FileUtilities.h"
+#include "llvm/Support/Program.h"
+#pragma GCC diagnostic pop
+#include <algorithm>
 #include <fstream>
 #include <iostream>
-#include <sstream>
-
-void printError(std::string line, ast::Error error) {
-    fmt::print("*\t{}\n", line);
-    fmt::print("\t{:->{}}^{:-<{}}\n", "", error.pos.column - 1, "",
-               line.length() - error.pos.column - 1);
-    fmt::print(fg(fmt::color::indian_red), "\t[line: {}, column: {}]: {}\n\n",
-               error.pos.line, error.pos.column, error.message);
-}
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
 
-std::vector<std::string> splitLines(std::string code) {
-    std::vector<std::string> lines;
-    std::string line;
-    std::istringstream codeStream(code);
-    while (std::getline(codeStream, line, '\n')) {
-        lines.push_back(line);
-    }
-    return lines;
-}
+// Where the build leaves the runtime library, unless told otherwise
+#ifndef RIDDLE_RUNTIME_LIBRARY
+#define RIDDLE_RUNTIME_LIBRARY "libriddle_runtime.a"
+#endif
 
-void printErrors(std::string source_code, std::vector<ast::Error> errors) {
-    auto lines = splitLines(source_code);
-    for (auto error : errors) {
-        printError(lines[error.pos.line - 1], error);
+/** Prints where the fields of the records are and how much space they waste */
+static void printRecordLayouts(const std::vector<cg::RecordLayout>& layouts) {
+    for (auto& layout : layouts) {
+        fmt::print(fmt::emphasis::bold, "Record {}: ",
+                   !layout.name.empty()
+                       ? layout.name
+                       : fmt::format("at line {}, column {}", layout.pos.line,
+                                     layout.pos.column));
+        fmt::print("{} bytes, {}-byte aligned, {} bytes of padding ({} bytes "
+                   "in declaration order)\n",
+                   layout.size, layout.alignment, layout.padding,
+                   layout.declaredSize);
+        fmt::print("    offset  size  field\n");
+        for (auto& field : layout.fields) {
+            fmt::print("    {:>6}  {:>4}  {}\n", field.offset, field.size,
+                       field.name);
+        }
     }
 }
 
 int main(int argc, char* argv[]) {
+    // `riddle run <file> <routine> [args...]` calls the routine right away
+    //  instead of building an executable
+    bool runMode = argc > 1 && std::string_view(argv[1]) == "run";
+    if (runMode) {
+        argc--;
+        argv++;
+    }
+
     cxxopts::Options options("riddle", "A compiler for I-lang");
     options.add_options() // Define the options
         ("f,file", "File name", cxxopts::value<std::string>()) // source code
@@ -52,10 +75,61 @@ int main(int argc, char* argv[]) {
          cxxopts::value<int>()->default_value("0")->implicit_value("1")) //
         ("keep-temp", "Keep temporary files created during compilation",
          cxxopts::value<bool>()->default_value("false")) //
+        ("linker",
+         "Program that links the object file into an executable, such as "
+         "a C compiler driver",
+         cxxopts::value<std::string>()->default_value("cc"),
+         "<program>") //
+        ("runtime", "Runtime library to link executables with",
+         cxxopts::value<std::string>()->default_value(RIDDLE_RUNTIME_LIBRARY),
+         "<file>") //
+        ("O,optimize", "Optimization level (0-3)",
+         cxxopts::value<unsigned>()->default_value("0"), "<level>") //
+        ("march",
+         "CPU to generate code for, 'native' for the host with all its "
+         "features",
+         cxxopts::value<std::string>()->default_value("generic"), "<cpu>") //
+        ("mcpu", "Same as --march",
+         cxxopts::value<std::string>(), "<cpu>") //
+        ("mattr",
+         "Comma-separated CPU features to turn on (+name) or off (-name)",
+         cxxopts::value<std::string>()->default_value(""), "<features>") //
+        ("no-reorder-fields",
+         "Keep the fields of records in the order they are declared in",
+         cxxopts::value<bool>()->default_value("false")) //
+        ("soa",
+         "Store arrays of records of a static length as an array for every "
+         "field",
+         cxxopts::value<bool>()->default_value("false")) //
+        ("print-layouts",
+         "Print the size, padding and field offsets of every record type",
+         cxxopts::value<bool>()->default_value("false")) //
+        ("j,jobs", "Number of threads to use (0 for one per hardware thread)",
+         cxxopts::value<unsigned>()->default_value("1"), "<n>") //
+        ("keep-going",
+         "Report the errors of every analysis that can run instead of "
+         "stopping at the first one that fails",
+         cxxopts::value<bool>()->default_value("false")) //
+        ("time-report",
+         "Print the time and allocations of every analysis pass",
+         cxxopts::value<bool>()->default_value("false")) //
+        ("cache-dir",
+         "Directory of the compilation cache (default: $RIDDLE_CACHE_DIR or "
+         "the user's cache directory)",
+         cxxopts::value<std::string>(), "<dir>") //
+        ("no-cache", "Compile without looking up or filling the cache",
+         cxxopts::value<bool>()->default_value("false")) //
+        ("diagnostics-format",
+         "Print errors as 'text' or as 'json', one object per line",
+         cxxopts::value<std::string>()->default_value("text"),
+         "<format>") //
         ("h,help", "Print usage")                        // help
         ;
-    options.parse_positional("file");
-    options.positional_help("<path to file>");
+    options.add_options()("args", "Routine to run and its arguments",
+                          cxxopts::value<std::vector<std::string>>());
+    options.parse_positional({"file", "args"});
+    options.positional_help(
+        "<path to file> | run <path to file> <routine> [--] [args...]");
 
     auto result = options.parse(argc, argv);
 
@@ -71,10 +145,57 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
+    std::vector<std::string> runArgs;
+    if (result.count("args") > 0) {
+        runArgs = result["args"].as<std::vector<std::string>>();
+    }
+    if (runMode && runArgs.empty()) {
+        fmt::print(fg(fmt::color::indian_red),
+                   "Error: expected a routine to run\n");
+        return 1;
+    }
+    if (!runMode && !runArgs.empty()) {
+        fmt::print(fg(fmt::color::indian_red),
+                   "Error: expected 1 input file, got {}\n",
+                   1 + runArgs.size());
+        return 1;
+    }
+
     auto path = result["file"].as<std::string>();
     auto verbosity = result["verbosity"].as<int>();
     auto outFile = result["out"].as<std::string>();
     auto keepTemp = result["keep-temp"].as<bool>();
+    auto linkerName = result["linker"].as<std::string>();
+    auto runtimeLibrary = result["runtime"].as<std::string>();
+    auto jobs = result["jobs"].as<unsigned>();
+    auto optLevel = result["optimize"].as<unsigned>();
+    if (optLevel > 3) {
+        fmt::print(fg(fmt::color::indian_red),
+                   "Error: optimization level should be 0-3, got {}\n",
+                   optLevel);
+        return 1;
+    }
+    cg::TargetConfig target;
+    target.cpu = result.count("mcpu") > 0 ? result["mcpu"].as<std::string>()
+                                          : result["march"].as<std::string>();
+    target.features = result["mattr"].as<std::string>();
+    target.optLevel = optLevel;
+    target.reorderFields = !result["no-reorder-fields"].as<bool>();
+    target.structOfArrays = result["soa"].as<bool>();
+    // The cache has to tell apart what "native" means on different hosts
+    target = target.resolved();
+    auto keepGoing = result["keep-going"].as<bool>();
+    auto timeReport = result["time-report"].as<bool>();
+    auto printLayouts = result["print-layouts"].as<bool>();
+    // Nothing is written to disk when running, so there is nothing to cache
+    auto noCache = result["no-cache"].as<bool>() || runMode;
+    auto diagnosticsFormat = result["diagnostics-format"].as<std::string>();
+    if (diagnosticsFormat != "text" && diagnosticsFormat != "json") {
+        fmt::print(fg(fmt::color::indian_red),
+                   "Error: unknown diagnostics format '{}'\n",
+                   diagnosticsFormat);
+        return 1;
+    }
 
     std::ifstream f(path);
     std::string code((std::istreambuf_iterator<char>(f)),
@@ -84,16 +205,100 @@ int main(int argc, char* argv[]) {
         fmt::print("Input:\n");
         fmt::print(fg(fmt::color::aqua), "{}\n\n", code);
     }
+    DiagnosticEngine diagnostics(code, path,
+                                 diagnosticsFormat == "json"
+                                     ? DiagnosticEngine::Format::Json
+                                     : DiagnosticEngine::Format::Text);
+
+    // The object file gets a name of its own, so builds running side by side
+    //  in one directory never clobber each other's
+    llvm::SmallString<128> objectFile;
+    if (!runMode) {
+        if (auto error = llvm::sys::fs::createTemporaryFile("riddle", "o",
+                                                            objectFile)) {
+            fmt::print(fg(fmt::color::indian_red),
+                       "Error: cannot create a temporary file: {}\n",
+                       error.message());
+            return 1;
+        }
+    }
+    std::string objectFileName(objectFile.str());
+    // Removed however compilation ends
+    llvm::FileRemover objectRemover(objectFileName, !keepTemp);
+    // The object has its own entry point and only needs the runtime and the
+    //  C library, with its math functions for rounding reals, so the linker
+    //  is all there is to run
+    auto link = [&] {
+        auto linker = llvm::sys::findProgramByName(linkerName);
+        int status = -1;
+        std::string error;
+        if (!linker) {
+            error = fmt::format("cannot find '{}'", linkerName);
+        } else {
+            llvm::StringRef args[] = {*linker, objectFileName, runtimeLibrary,
+                                      "-lm", "-o", outFile};
+            status = llvm::sys::ExecuteAndWait(*linker, args, llvm::None, {},
+                                               0, 0, &error);
+        }
+        if (keepTemp) {
+            fmt::print("Object file: {}\n", objectFileName);
+        }
+        if (status != 0) {
+            fmt::print(fg(fmt::color::indian_red), "Error: linking failed{}\n",
+                       error.empty() ? "" : ": " + error);
+            return 1;
+        }
+        if (verbosity > 0) {
+            fmt::print(fmt::emphasis::bold, "Executable: creation: ");
+            fmt::print(fmt::fg(fmt::color::green), "success\n");
+        }
+        return 0;
+    };
+
+    // ----- Compilation cache -----
+    // Everything that changes the generated code goes into the key. The
+    //  module is named after the path, which ends up in the object file.
+    std::optional<CompilationCache> cache;
+    std::string cacheKey;
+    if (!noCache) {
+        cache.emplace(result.count("cache-dir") > 0
+                          ? result["cache-dir"].as<std::string>()
+                          : CompilationCache::defaultDirectory());
+        cacheKey = cache->key(
+            code, fmt::format(
+                      "path={} O={} cpu={} features={} reorder={} soa={}",
+                      path, target.optLevel, target.cpu, target.features,
+                      target.reorderFields, target.structOfArrays));
+    }
+    auto printCacheStats = [&] {
+        if (cache && verbosity > 0) {
+            fmt::print(fmt::emphasis::bold, "Compilation cache: ");
+            fmt::print("{} hits, {} misses ({})\n", cache->hits(),
+                       cache->misses(), cache->directory());
+        }
+    };
+    // The output of the stages is only there if they run
+    if (cache && verbosity < 2 && !printLayouts &&
+        cache->fetch(cacheKey, objectFileName)) {
+        printCacheStats();
+        return link();
+    }
 
     // ----- Parse program -----
     lexer::Lexer lx{code};
     parser::Parser parser(lx);
-    auto ast = parser.parseProgram();
-    auto errors = parser.getErrors();
-    if (!errors.empty()) {
-        fmt::print(fg(fmt::color::indian_red) | fmt::emphasis::bold,
-                   "Parsing Errors:\n");
-        printErrors(code, errors);
+    // Routine bodies are parsed when the identifier resolver first visits
+    //  them, so clashing top-level declarations are reported without parsing
+    //  any body. The printers need the whole tree upfront.
+    parser.setLazyBodies(verbosity < 2);
+    auto ast = parser.parseProgramParallel(jobs);
+    std::vector<ast::Error> errors;
+    auto parsingFailed = [&] {
+        errors = parser.getErrors();
+        diagnostics.report("Parsing", errors);
+        return !errors.empty();
+    };
+    if (parsingFailed()) {
         return 1;
     }
     if (verbosity > 0) {
@@ -111,83 +316,110 @@ int main(int argc, char* argv[]) {
         fmt::print("\n");
     }
 
-    // ----- Resolve identifiers to their declarations -----
-    san::IdentifierResolver idResolver;
-    ast->accept(idResolver);
-    errors = idResolver.getErrors();
-    if (!errors.empty()) {
-        fmt::print(fg(fmt::color::indian_red) | fmt::emphasis::bold,
-                   "Identifier resolution errors:\n");
-        printErrors(code, errors);
-        return 1;
-    }
-    if (verbosity > 0) {
-        fmt::print(fmt::emphasis::bold, "Identifier resolution: ");
-        fmt::print(fg(fmt::color::green), "success!\n");
-    }
-    if (verbosity > 2) {
-        san::PrettyPrinter prettyPrinter;
-        ast->accept(prettyPrinter);
-        fmt::print("\n");
+    // ----- Semantic analysis -----
+    san::PassManager passes;
+    passes.setJobs(jobs);
+    passes.setFailFast(!keepGoing);
+    if (timeReport) {
+        passes.setAllocationCounter(allocationCount);
     }
 
-    // -- Check that all array types have the length defined if not in params --
-    san::ArrayLengthEnforcer arrLenEnforcer;
-    ast->accept(arrLenEnforcer);
-    errors = arrLenEnforcer.getErrors();
-    if (!errors.empty()) {
-        fmt::print(fg(fmt::color::indian_red) | fmt::emphasis::bold,
-                   "Errors:\n");
-        printErrors(code, errors);
-        return 1;
-    }
-    if (verbosity > 0) {
-        fmt::print(fmt::emphasis::bold, "Array length defined: ");
-        fmt::print(fmt::fg(fmt::color::green), "pass\n");
-    }
+    passes.add({
+        .name = "Identifier resolution",
+        .provided = san::PassManager::ResolvedIdentifiers,
+        .run =
+            [&](ast::Program& program) {
+                san::IdentifierResolver idResolver;
+                idResolver.setJobs(jobs);
+                program.accept(idResolver);
+                // Routine bodies skipped by the parser are parsed on the way,
+                //  nothing else can run on a body that fails to parse
+                if (!parser.getErrors().empty()) {
+                    return parser.getErrors();
+                }
+                return idResolver.takeErrors();
+            },
+    });
+    // Array lengths, missing returns and routine call arguments share a
+    //  single traversal of the tree
+    passes.add({
+        .name = "Semantic checks",
+        .required = san::PassManager::ResolvedIdentifiers,
+        .provided = san::PassManager::CallTypes,
+        .run =
+            [&](ast::Program& program) {
+                san::ArrayLengthEnforcer arrLenEnforcer;
+                san::MissingReturn missingReturn;
+                san::ParamsValidator paramsValidator;
+                san::CheckGroup checks{arrLenEnforcer, missingReturn,
+                                       paramsValidator};
+                checks.setJobs(jobs);
+                program.accept(checks);
 
-    // ----- Check that a function with return type always returns -----
-    san::MissingReturn missingReturn;
-    ast->accept(missingReturn);
-    errors = missingReturn.getErrors();
-    if (!errors.empty()) {
-        fmt::print(fmt::fg(fmt::color::indian_red), "Missing return errors:\n");
-        printErrors(code, errors);
-        return 1;
-    }
-    if (verbosity > 0) {
-        fmt::print(fmt::emphasis::bold, "Missing return: ");
-        fmt::print(fmt::fg(fmt::color::green), "pass\n");
-    }
+                auto errors = arrLenEnforcer.takeErrors();
+                for (auto& more : {missingReturn.takeErrors(),
+                                   paramsValidator.takeErrors()}) {
+                    errors.insert(errors.end(), more.begin(), more.end());
+                }
+                std::stable_sort(errors.begin(), errors.end(),
+                                 [](const ast::Error& a, const ast::Error& b) {
+                                     return a.pos < b.pos;
+                                 });
+                return errors;
+            },
+    });
+    passes.add({
+        .name = "Type conformance/inference",
+        .required = san::PassManager::ResolvedIdentifiers |
+                    san::PassManager::CallTypes,
+        .provided = san::PassManager::ExpressionTypes,
+        .run =
+            [&](ast::Program& program) {
+                san::TypeDeriver deriveType;
+                deriveType.setJobs(jobs);
+                program.accept(deriveType);
+                return deriveType.takeErrors();
+            },
+    });
+    // Rewrites expressions, so no other pass may run alongside it
+    passes.add({
+        .name = "Constant folding",
+        .required = san::PassManager::ExpressionTypes,
+        .provided = san::PassManager::ConstantValues,
+        .preserved = san::PassManager::ResolvedIdentifiers |
+                     san::PassManager::CallTypes |
+                     san::PassManager::ExpressionTypes,
+        .run =
+            [&](ast::Program& program) {
+                san::ConstantFolder folder;
+                folder.setJobs(jobs);
+                program.accept(folder);
+                return folder.takeErrors();
+            },
+    });
 
-    // --- Check if amount of params is equal to routine's amount of params ---
-    san::ParamsValidator paramsValidator;
-    ast->accept(paramsValidator);
-    errors = paramsValidator.getErrors();
-    if (!errors.empty()) {
-        fmt::print(fg(fmt::color::indian_red) | fmt::emphasis::bold,
-                   "Errors:\n");
-        printErrors(code, errors);
+    bool analyzed = passes.run(*ast);
+    if (timeReport) {
+        fmt::print(stderr, "{}", passes.timeReport());
+    }
+    if (parsingFailed()) {
         return 1;
     }
-    if (verbosity > 0) {
-        fmt::print(fmt::emphasis::bold, "Routine call arguments: ");
-        fmt::print(fmt::fg(fmt::color::green), "pass\n");
+    for (std::size_t i = 0; i < passes.getPasses().size(); i++) {
+        auto& result = passes.getResults()[i];
+        auto& name = passes.getPasses()[i].name;
+        if (!result.ran) {
+            continue;
+        }
+        diagnostics.report(name, result.errors);
+        if (result.errors.empty() && verbosity > 0) {
+            fmt::print(fmt::emphasis::bold, "{}: ", name);
+            fmt::print(fg(fmt::color::green), "success!\n");
+        }
     }
-
-    // ----- Check for types conformance and fill expression types -----
-    san::TypeDeriver deriveType;
-    ast->accept(deriveType);
-    errors = deriveType.getErrors();
-    if (!errors.empty()) {
-        fmt::print(fmt::fg(fmt::color::indian_red), "Type conformance: fail\n");
-        printErrors(code, errors);
+    if (!analyzed) {
         return 1;
     }
-    if (verbosity > 0) {
-        fmt::print(fmt::emphasis::bold, "Type conformance/inference: ");
-        fmt::print(fmt::fg(fmt::color::green), "success\n");
-    }
     if (verbosity > 2) {
         san::PrettyPrinter prettyPrinter;
         ast->accept(prettyPrinter);
@@ -195,17 +427,29 @@ int main(int argc, char* argv[]) {
     }
 
     // ----- Generate LLVM IR and executable -----
-    cg::CodeGenerator codeGen(path);
-    ast->accept(codeGen);
+    // The routines are split across modules generated on separate threads.
+    //  Any split links into the same executable, so the cache ignores it.
+    cg::ParallelCodeGenerator codeGen(path, target, jobs);
+    codeGen.generate(ast.get());
     errors = codeGen.getErrors();
-    if (!errors.empty()) {
-        fmt::print("Code generation errors:\n");
-        printErrors(code, errors);
-    }
+    diagnostics.report("Code generation", errors);
     if (verbosity > 0) {
         fmt::print(fmt::emphasis::bold, "Code generation: ");
         fmt::print(fmt::fg(fmt::color::green), "success\n");
     }
+    if (printLayouts) {
+        printRecordLayouts(codeGen.getLayouts());
+    }
+    if (!runMode && errors.empty() && !codeGen.generateMain()) {
+        fmt::print(fg(fmt::color::indian_red),
+                   "Error: 'main' is reserved for the entry point of the "
+                   "executable, run the program with `riddle run` instead\n");
+        return 1;
+    }
+    // The optimizer expects valid IR
+    if (errors.empty()) {
+        codeGen.optimize();
+    }
     if (verbosity > 1) {
         fmt::print("Generated code:\n");
         std::string buffer;
@@ -214,21 +458,32 @@ int main(int argc, char* argv[]) {
         fmt::print(fg(fmt::color::aqua), "{}\n", ir_ss.str());
     }
 
-    std::string tempCppFileName = "_temp_.cpp";
-    std::string tempObjFileName = "_temp_output_.o";
-    codeGen.emitCode(tempObjFileName);
-    cg::generateIntermediateCpp(tempCppFileName, codeGen);
-    system(fmt::format("clang++ {} {} -o {}", tempCppFileName, tempObjFileName,
-                       outFile)
-               .c_str());
-    if (!keepTemp) {
-        system(
-            fmt::format("rm {} {}", tempCppFileName, tempObjFileName).c_str());
-    }
-    if (verbosity > 0) {
-        fmt::print(fmt::emphasis::bold, "Executable: creation: ");
-        fmt::print(fmt::fg(fmt::color::green), "success\n");
+    if (runMode) {
+        if (!errors.empty()) {
+            return 1;
+        }
+        cg::Jit jit;
+        std::string value;
+        if (!jit.load(codeGen, runArgs.front()) ||
+            !jit.call({runArgs.begin() + 1, runArgs.end()}, value)) {
+            fmt::print(fg(fmt::color::indian_red), "Error: {}\n",
+                       jit.getError());
+            return 1;
+        }
+        if (!value.empty()) {
+            fmt::print("{}\n", value);
+        }
+        return 0;
     }
 
-    return 0;
+    // There is no point linking code that is known to be broken
+    if (!errors.empty()) {
+        return 1;
+    }
+    codeGen.emitCode(objectFileName);
+    if (cache) {
+        cache->store(cacheKey, objectFileName);
+    }
+    printCacheStats();
+    return link();
 }
@@ -0,0 +1,142 @@
+#include "runtime.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+    STATUS_NO_ROUTINE = 1,
+    STATUS_ARITY = 2,
+    STATUS_BAD_ARGUMENT = 3,
+};
+
+static char output[1 << 12];
+static size_t outputSize = 0;
+
+static void append(const char* text, size_t size) {
+    if (outputSize + size > sizeof(output)) {
+        riddle_flush();
+    }
+    memcpy(output + outputSize, text, size);
+    outputSize += size;
+}
+
+static int32_t badArgument(const char* kind, const char* text) {
+    fprintf(stderr, "Invalid %s: '%s'\n", kind, text);
+    return STATUS_BAD_ARGUMENT;
+}
+
+uint64_t riddle_hash(const char* name) {
+    uint64_t hash = 0xcbf29ce484222325u;
+    for (; *name; name++) {
+        hash ^= (unsigned char)*name;
+        hash *= 0x100000001b3u;
+    }
+    return hash;
+}
+
+int32_t riddle_main(int32_t argc, const char* const* argv,
+                    const riddle_routine* routines, uint64_t count) {
+    if (argc < 2) {
+        fputs("Expected at least one argument\n", stderr);
+        return STATUS_NO_ROUTINE;
+    }
+
+    // First routine with the hash, then on through those sharing it
+    uint64_t hash = riddle_hash(argv[1]);
+    uint64_t low = 0;
+    uint64_t high = count;
+    while (low < high) {
+        uint64_t middle = low + (high - low) / 2;
+        if (routines[middle].hash < hash) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    for (; low < count && routines[low].hash == hash; low++) {
+        const riddle_routine* routine = &routines[low];
+        if (strcmp(routine->name, argv[1]) != 0) {
+            continue;
+        }
+        if ((uint64_t)argc != routine->arity + 2u) {
+            fputs("Unexpected number of arguments\n", stderr);
+            return STATUS_ARITY;
+        }
+        int32_t status = routine->entry(argv + 2);
+        riddle_flush();
+        return status;
+    }
+
+    fputs("Unknown routine\n", stderr);
+    return STATUS_NO_ROUTINE;
+}
+
+int32_t riddle_parse_integer(const char* text, int64_t* value) {
+    char* end;
+    errno = 0;
+    long long parsed = strtoll(text, &end, 10);
+    if (end == text || *end != '\0' || errno == ERANGE) {
+        return badArgument("integer", text);
+    }
+    *value = parsed;
+    return 0;
+}
+
+int32_t riddle_parse_real(const char* text, double* value) {
+    char* end;
+    double parsed = strtod(text, &end);
+    if (end == text || *end != '\0') {
+        return badArgument("real", text);
+    }
+    *value = parsed;
+    return 0;
+}
+
+int32_t riddle_parse_boolean(const char* text, uint8_t* value) {
+    if (strcmp(text, "true") == 0) {
+        *value = 1;
+    } else if (strcmp(text, "false") == 0) {
+        *value = 0;
+    } else {
+        return badArgument("boolean", text);
+    }
+    return 0;
+}
+
+void riddle_print_integer(int64_t value) {
+    // Digits are written from the back, the magnitude is unsigned so the
+    //  smallest integer has one too
+    char digits[21];
+    char* begin = digits + sizeof(digits);
+    uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+    *--begin = '\n';
+    do {
+        *--begin = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+    if (value < 0) {
+        *--begin = '-';
+    }
+    append(begin, (size_t)(digits + sizeof(digits) - begin));
+}
+
+void riddle_print_real(double value) {
+    char text[32];
+    int size = snprintf(text, sizeof(text), "%g\n", value);
+    append(text, (size_t)size);
+}
+
+void riddle_print_boolean(uint8_t value) {
+    if (value) {
+        append("true\n", 5);
+    } else {
+        append("false\n", 6);
+    }
+}
+
+void riddle_flush(void) {
+    fwrite(output, 1, outputSize, stdout);
+    fflush(stdout);
+    outputSize = 0;
+}
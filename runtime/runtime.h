@@ -0,0 +1,64 @@
+#pragma once
+
+/*
+ * Runtime linked into every executable riddle builds. The generated `main`
+ *  hands its arguments and a table of the program's routines to
+ *  `riddle_main`, which picks the routine named by the first argument and
+ *  calls it through its entry in the table.
+ *
+ * Nothing here allocates: arguments are parsed in place and the output is
+ *  collected in a fixed buffer that is written out when it fills up and
+ *  before `riddle_main` returns.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Parses the arguments of a routine, calls it and prints what it returns.
+ *  Returns 0, or the status `riddle_main` should exit with if an argument
+ *  does not parse.
+ */
+typedef int32_t (*riddle_entry)(const char* const* args);
+
+/* A routine `riddle_main` can call. Tables are sorted by `hash`. */
+typedef struct riddle_routine {
+    uint64_t hash;
+    const char* name;
+    uint32_t arity;
+    riddle_entry entry;
+} riddle_routine;
+
+/* Hash of a routine's name, 64-bit FNV-1a */
+uint64_t riddle_hash(const char* name);
+
+/*
+ * Calls the routine of `routines` named by `argv[1]` with the rest of the
+ *  arguments. Returns the status the program should exit with.
+ */
+int32_t riddle_main(int32_t argc, const char* const* argv,
+                    const riddle_routine* routines, uint64_t count);
+
+/*
+ * Parse `text` into `value`. Return 0 on success, or report the argument
+ *  and return the status to exit with.
+ */
+int32_t riddle_parse_integer(const char* text, int64_t* value);
+int32_t riddle_parse_real(const char* text, double* value);
+int32_t riddle_parse_boolean(const char* text, uint8_t* value);
+
+/* Buffer a value followed by a line break */
+void riddle_print_integer(int64_t value);
+void riddle_print_real(double value);
+void riddle_print_boolean(uint8_t value);
+
+/* Writes out whatever output is buffered */
+void riddle_flush(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -4,90 +4,26 @@ using namespace ast;
 
 namespace san {
 
-void ArrayLengthEnforcer::visit(Program* node) {
-    for (auto var : node->variables) {
-        var->accept(*this);
-    }
-    for (auto routine : node->routines) {
-        routine->accept(*this);
-    }
-}
-
-void ArrayLengthEnforcer::visit(RoutineDecl* node) {
-    m_insideParameters = true;
-    for (auto param : node->parameters) {
-        param->accept(*this);
-    }
-    m_insideParameters = false;
+void ArrayLengthEnforcer::enter(RoutineDecl*) { m_inSignature = true; }
 
-    if (node->returnType != nullptr) {
-        node->returnType->accept(*this);
+void ArrayLengthEnforcer::enter(ArrayType* node) {
+    if (m_typeDecls > 0) {
+        return;
     }
-    node->body->accept(*this);
-}
-
-void ArrayLengthEnforcer::visit(AliasedType*) {}
-
-void ArrayLengthEnforcer::visit(IntegerType*) {}
-
-void ArrayLengthEnforcer::visit(RealType*) {}
-
-void ArrayLengthEnforcer::visit(BooleanType*) {}
-
-void ArrayLengthEnforcer::visit(ArrayType* node) {
-    if (!m_insideParameters && node->length == nullptr) {
+    bool insideParameters = m_inSignature && m_variables > 0;
+    if (!insideParameters && node->length == nullptr) {
         error(node->begin, "array size omitted in non-signature context");
     }
-    node->elementType->accept(*this);
-}
-
-void ArrayLengthEnforcer::visit(RecordType* node) {
-    for (auto field : node->fields) {
-        field->accept(*this);
-    }
-}
-
-void ArrayLengthEnforcer::visit(VariableDecl* node) {
-    if (node->type != nullptr) {
-        node->type->accept(*this);
-    }
-}
-
-void ArrayLengthEnforcer::visit(TypeDecl*) {}
-
-void ArrayLengthEnforcer::visit(Body* node) {
-    for (auto var : node->variables) {
-        var->accept(*this);
-    }
 }
 
-void ArrayLengthEnforcer::visit(ReturnStatement*) {}
-
-void ArrayLengthEnforcer::visit(Assignment*) {}
-
-void ArrayLengthEnforcer::visit(WhileLoop* node) { node->body->accept(*this); }
-
-void ArrayLengthEnforcer::visit(ForLoop* node) { node->body->accept(*this); }
-
-void ArrayLengthEnforcer::visit(IfStatement* node) {
-    node->ifBody->accept(*this);
-    if (node->elseBody != nullptr) {
-        node->elseBody->accept(*this);
-    }
-}
-
-void ArrayLengthEnforcer::visit(UnaryExpression*) {}
-
-void ArrayLengthEnforcer::visit(BinaryExpression*) {}
-
-void ArrayLengthEnforcer::visit(IntegerLiteral*) {}
+void ArrayLengthEnforcer::enter(VariableDecl*) { m_variables++; }
 
-void ArrayLengthEnforcer::visit(RealLiteral*) {}
+void ArrayLengthEnforcer::leave(VariableDecl*) { m_variables--; }
 
-void ArrayLengthEnforcer::visit(BooleanLiteral*) {}
+void ArrayLengthEnforcer::enter(TypeDecl*) { m_typeDecls++; }
 
-void ArrayLengthEnforcer::visit(Identifier*) {}
+void ArrayLengthEnforcer::leave(TypeDecl*) { m_typeDecls--; }
 
-void ArrayLengthEnforcer::visit(RoutineCall*) {}
+void ArrayLengthEnforcer::enter(Body*) { m_inSignature = false; }
 
 } // namespace san
@@ -45,7 +45,7 @@ void AstPrinter::visit(RoutineDecl* node) {
         parameter->accept(*this);
     }
 
-    node->body->accept(*this);
+    node->getBody()->accept(*this);
 
     if (node->returnType != nullptr) {
         node->returnType->accept(*this);
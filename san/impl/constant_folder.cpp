@@ -0,0 +1,442 @@
+#include "san.hpp"
+#include <cmath>
+#include <limits>
+#include <memory>
+
+using namespace ast;
+
+namespace san {
+
+namespace {
+
+/** Collects the variables that are assigned to anywhere in the program */
+class AssignedVariables : public Check<AssignedVariables> {
+public:
+    static constexpr bool needsExpressions = false;
+    using Check::enter;
+    using Check::leave;
+
+    std::unordered_set<const VariableDecl*> variables;
+
+    void enter(Assignment* node) {
+        if (auto target = std::dynamic_pointer_cast<Identifier>(node->lhs)) {
+            variables.insert(target->variable.get());
+        }
+    }
+};
+
+template <typename T, typename Value> T as(const Value& value) {
+    return std::visit([](auto v) { return static_cast<T>(v); }, value);
+}
+
+bool isBooleanConvertible(std::size_t kind) {
+    return kind == 0 || kind == 1;
+}
+
+} // namespace
+
+void ConstantFolder::setJobs(unsigned jobs) { m_jobs = jobs; }
+
+void ConstantFolder::visit(Program* node) {
+    // Globals can only be constant if nothing assigns to them
+    AssignedVariables assigned;
+    CheckGroup group{assigned};
+    node->accept(group);
+
+    m_globals = std::make_shared<Globals>();
+
+    for (auto& var : node->variables) {
+        foldType(var->type);
+        auto value = fold(var->initialValue);
+        if (!value || assigned.variables.count(var.get()) != 0) {
+            continue;
+        }
+
+        // The initial value is converted to the declared type
+        if (var->type != nullptr) {
+            switch (var->type->getTypeKind()) {
+            case TypeKind::Boolean:
+                if (value->index() != 0) {
+                    continue;
+                }
+                break;
+            case TypeKind::Integer:
+                if (value->index() == 2) {
+                    continue;
+                }
+                value = as<std::int64_t>(*value);
+                break;
+            case TypeKind::Real:
+                value = as<double>(*value);
+                break;
+            default:
+                continue;
+            }
+        }
+        m_globals->constants.emplace(var.get(), *value);
+    }
+
+    for (auto& type : node->types) {
+        type->accept(*this);
+    }
+
+    for (auto& routine : node->routines) {
+        for (auto& parameter : routine->parameters) {
+            foldType(parameter->type);
+        }
+        foldType(routine->returnType);
+    }
+
+    // Routines only read the global types from here on
+    m_globals->arrays = std::move(m_arrays);
+    m_arrays.clear();
+
+    auto errors = visitRoutines(node, m_jobs, [this] {
+        ConstantFolder folder;
+        folder.m_globals = m_globals;
+        return folder;
+    });
+    m_errors.insert(m_errors.end(), errors.begin(), errors.end());
+
+    m_globals = nullptr;
+}
+
+void ConstantFolder::visit(RoutineDecl* node) {
+    for (auto& parameter : node->parameters) {
+        foldType(parameter->type);
+    }
+    foldType(node->returnType);
+
+    node->getBody()->accept(*this);
+}
+
+void ConstantFolder::visit(AliasedType*) {}
+
+void ConstantFolder::visit(IntegerType*) {}
+
+void ConstantFolder::visit(RealType*) {}
+
+void ConstantFolder::visit(BooleanType*) {}
+
+void ConstantFolder::visit(ArrayType* node) {
+    if ((m_globals != nullptr && m_globals->arrays.count(node) != 0) ||
+        !m_arrays.insert(node).second) {
+        return;
+    }
+
+    auto length = fold(node->length);
+    if (length && length->index() == 1) {
+        auto value = std::get<std::int64_t>(*length);
+        if (value < 1) {
+            error(node->length->begin, "array length must be positive");
+        } else {
+            node->staticLength = static_cast<uint64_t>(value);
+        }
+    }
+
+    foldType(node->elementType);
+}
+
+void ConstantFolder::visit(RecordType* node) {
+    for (auto& field : node->fields) {
+        field->accept(*this);
+    }
+}
+
+void ConstantFolder::visit(VariableDecl* node) {
+    foldType(node->type);
+    fold(node->initialValue);
+}
+
+void ConstantFolder::visit(TypeDecl* node) { foldType(node->type); }
+
+void ConstantFolder::visit(Body* node) {
+    for (auto& type : node->types) {
+        type->accept(*this);
+    }
+
+    for (auto& variable : node->variables) {
+        variable->accept(*this);
+    }
+
+    for (auto& statement : node->statements) {
+        statement->accept(*this);
+    }
+}
+
+void ConstantFolder::visit(ReturnStatement* node) { fold(node->expression); }
+
+void ConstantFolder::visit(Assignment* node) {
+    // The target is never replaced, but its indices can be folded
+    node->lhs->accept(*this);
+    fold(node->rhs);
+}
+
+void ConstantFolder::visit(WhileLoop* node) {
+    fold(node->condition);
+    node->body->accept(*this);
+}
+
+void ConstantFolder::visit(ForLoop* node) {
+    fold(node->rangeFrom);
+    fold(node->rangeTo);
+    node->body->accept(*this);
+}
+
+void ConstantFolder::visit(IfStatement* node) {
+    fold(node->condition);
+    node->ifBody->accept(*this);
+
+    if (node->elseBody != nullptr) {
+        node->elseBody->accept(*this);
+    }
+}
+
+void ConstantFolder::visit(UnaryExpression* node) {
+    auto operand = fold(node->operand);
+    m_value = std::nullopt;
+    if (!operand) {
+        return;
+    }
+
+    if (node->operation == lexer::TokenType::Not) {
+        if (isBooleanConvertible(operand->index())) {
+            m_value = !as<bool>(*operand);
+        }
+    } else if (node->operation == lexer::TokenType::Sub) {
+        if (operand->index() == 1) {
+            // Wraps around like the generated code does
+            m_value = static_cast<std::int64_t>(
+                -static_cast<uint64_t>(std::get<std::int64_t>(*operand)));
+        } else if (operand->index() == 2) {
+            m_value = -std::get<double>(*operand);
+        }
+    } else if (node->operation == lexer::TokenType::Add) {
+        if (operand->index() != 0) {
+            m_value = operand;
+        }
+    }
+}
+
+void ConstantFolder::visit(BinaryExpression* node) {
+    if (node->operation == lexer::TokenType::Dot) {
+        // The field name is not an expression of its own
+        fold(node->operand1);
+        m_value = std::nullopt;
+        return;
+    }
+
+    auto lhs = fold(node->operand1);
+    auto rhs = fold(node->operand2);
+    m_value = std::nullopt;
+
+    // Dividing by zero is reported whether the dividend is known or not
+    if ((node->operation == lexer::TokenType::Div ||
+         node->operation == lexer::TokenType::Mod) &&
+        rhs && rhs->index() != 2 && !as<bool>(*rhs)) {
+        bool real = node->type != nullptr
+                        ? node->type->getTypeKind() == TypeKind::Real
+                        : lhs && lhs->index() == 2;
+        if (!real) {
+            error(node->operand2->begin, "division by zero");
+            return;
+        }
+    }
+
+    if (lhs && rhs) {
+        m_value = evaluate(node, *lhs, *rhs);
+    }
+}
+
+void ConstantFolder::visit(IntegerLiteral* node) {
+    m_value = static_cast<std::int64_t>(node->value);
+}
+
+void ConstantFolder::visit(RealLiteral* node) { m_value = node->value; }
+
+void ConstantFolder::visit(BooleanLiteral* node) { m_value = node->value; }
+
+void ConstantFolder::visit(Identifier* node) {
+    m_value = std::nullopt;
+    if (m_globals == nullptr || node->variable == nullptr) {
+        return;
+    }
+
+    auto constant = m_globals->constants.find(node->variable.get());
+    if (constant != m_globals->constants.end()) {
+        m_value = constant->second;
+    }
+}
+
+void ConstantFolder::visit(RoutineCall* node) {
+    for (auto& arg : node->args) {
+        fold(arg);
+    }
+    m_value = std::nullopt;
+}
+
+/**
+ * Visits `expr` and, if its value turns out to be known, replaces it with a
+ *  literal of that value unless it is one already. Returns the value.
+ */
+std::optional<ConstantFolder::Value>
+ConstantFolder::fold(sPtr<Expression>& expr) {
+    if (expr == nullptr) {
+        return std::nullopt;
+    }
+
+    m_value = std::nullopt;
+    expr->accept(*this);
+    auto value = m_value;
+    m_value = std::nullopt;
+    if (!value || expr->constant) {
+        return value;
+    }
+
+    sPtr<Expression> literal;
+    switch (value->index()) {
+    case 0:
+        literal = std::make_shared<BooleanLiteral>(std::get<bool>(*value));
+        break;
+    case 1:
+        literal =
+            std::make_shared<IntegerLiteral>(std::get<std::int64_t>(*value));
+        break;
+    default:
+        literal = std::make_shared<RealLiteral>(std::get<double>(*value));
+        break;
+    }
+    literal->begin = expr->begin;
+    literal->end = expr->end;
+    expr = literal;
+    return value;
+}
+
+void ConstantFolder::foldType(const sPtr<Type>& type) {
+    if (type != nullptr) {
+        type->accept(*this);
+    }
+}
+
+/**
+ * Computes the value of a binary operation on constants the way the generated
+ *  code would, or nothing if it is not known until run time
+ */
+std::optional<ConstantFolder::Value>
+ConstantFolder::evaluate(BinaryExpression* node, const Value& lhs,
+                         const Value& rhs) {
+    using lexer::TokenType;
+
+    // Operands are converted to the greater of their types
+    auto kind = std::max(lhs.index(), rhs.index());
+
+    switch (node->operation) {
+    case TokenType::And:
+    case TokenType::Or:
+    case TokenType::Xor: {
+        if (!isBooleanConvertible(lhs.index()) ||
+            !isBooleanConvertible(rhs.index())) {
+            return std::nullopt;
+        }
+        auto a = as<bool>(lhs);
+        auto b = as<bool>(rhs);
+        if (node->operation == TokenType::And) {
+            return a && b;
+        }
+        if (node->operation == TokenType::Or) {
+            return a || b;
+        }
+        return a != b;
+    }
+
+    case TokenType::Eq:
+    case TokenType::Neq:
+    case TokenType::Less:
+    case TokenType::Greater:
+    case TokenType::Leq:
+    case TokenType::Geq: {
+        auto compare = [&](auto a, auto b) {
+            switch (node->operation) {
+            case TokenType::Eq:
+                return a == b;
+            case TokenType::Neq:
+                return a != b;
+            case TokenType::Less:
+                return a < b;
+            case TokenType::Greater:
+                return a > b;
+            case TokenType::Leq:
+                return a <= b;
+            default:
+                return a >= b;
+            }
+        };
+        if (kind == 2) {
+            return compare(as<double>(lhs), as<double>(rhs));
+        }
+        return compare(as<std::int64_t>(lhs), as<std::int64_t>(rhs));
+    }
+
+    case TokenType::Add:
+    case TokenType::Sub:
+    case TokenType::Mul:
+    case TokenType::Div:
+    case TokenType::Mod:
+        break;
+
+    default:
+        return std::nullopt;
+    }
+
+    if (kind == 2) {
+        auto a = as<double>(lhs);
+        auto b = as<double>(rhs);
+        switch (node->operation) {
+        case TokenType::Add:
+            return a + b;
+        case TokenType::Sub:
+            return a - b;
+        case TokenType::Mul:
+            return a * b;
+        case TokenType::Div:
+            return a / b;
+        default:
+            return std::fmod(a, b);
+        }
+    }
+
+    if (kind == 0) {
+        // Arithmetic on two booleans stays boolean, which has no sensible
+        //  value to fold to
+        return std::nullopt;
+    }
+
+    // Integers wrap around on overflow like the generated code does
+    auto a = as<std::int64_t>(lhs);
+    auto b = as<std::int64_t>(rhs);
+    auto ua = static_cast<uint64_t>(a);
+    auto ub = static_cast<uint64_t>(b);
+    switch (node->operation) {
+    case TokenType::Add:
+        return static_cast<std::int64_t>(ua + ub);
+    case TokenType::Sub:
+        return static_cast<std::int64_t>(ua - ub);
+    case TokenType::Mul:
+        return static_cast<std::int64_t>(ua * ub);
+    default:
+        break;
+    }
+
+    if (b == 0 ||
+        (a == std::numeric_limits<std::int64_t>::min() && b == -1)) {
+        // Division by zero is reported already, and the overflow is left for
+        //  run time
+        return std::nullopt;
+    }
+    if (node->operation == TokenType::Div) {
+        return a / b;
+    }
+    return a % b;
+}
+
+} // namespace san
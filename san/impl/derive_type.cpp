@@ -4,6 +4,8 @@ using namespace ast;
 
 namespace san {
 
+void TypeDeriver::setJobs(unsigned jobs) { m_jobs = jobs; }
+
 void TypeDeriver::visit(Program* node) {
     // check variables with both type and initial value
     for (auto& var : node->variables) {
@@ -13,10 +15,30 @@ void TypeDeriver::visit(Program* node) {
     for (auto& type : node->types) {
         type->accept(*this);
     }
-    // routine has an expression
+    // Routine signatures are shared by every routine calling them
     for (auto& routine : node->routines) {
-        routine->accept(*this);
+        m_inRoutineParams = true;
+        for (auto& parameter : routine->parameters) {
+            parameter->type->accept(*this);
+        }
+        m_inRoutineParams = false;
+        if (routine->returnType != nullptr) {
+            routine->returnType->accept(*this);
+        }
     }
+
+    // Routines only read the global declarations from here on
+    auto globalTypes = std::make_shared<std::unordered_set<const Type*>>(
+        std::move(m_derived));
+    m_derived.clear();
+
+    // routine has an expression
+    auto errors = visitRoutines(node, m_jobs, [&globalTypes] {
+        TypeDeriver deriver;
+        deriver.m_globalTypes = globalTypes;
+        return deriver;
+    });
+    m_errors.insert(m_errors.end(), errors.begin(), errors.end());
 }
 
 void TypeDeriver::visit(RoutineDecl* node) {
@@ -29,10 +51,14 @@ void TypeDeriver::visit(RoutineDecl* node) {
     if (node->returnType != nullptr) {
         node->returnType->accept(*this);
     }
-    node->body->accept(*this);
+    node->getBody()->accept(*this);
 }
 
-void TypeDeriver::visit(AliasedType* node) { node->actualType->accept(*this); }
+void TypeDeriver::visit(AliasedType* node) {
+    if (node->actualType != nullptr) {
+        node->actualType->accept(*this);
+    }
+}
 
 void TypeDeriver::visit(IntegerType*) {}
 
@@ -41,29 +67,32 @@ void TypeDeriver::visit(RealType*) {}
 void TypeDeriver::visit(BooleanType*) {}
 
 void TypeDeriver::visit(ArrayType* node) {
+    if (isDerived(node)) {
+        return;
+    }
+
     if (node->length != nullptr) {
         node->length->accept(*this);
         // any primitive type can be converted to int
         if (!typeIsPrimitive(node->length->type)) {
             error(node->begin, "invalid array length type, should be integer");
         }
-    } else if (!m_inRoutineParams && !m_searchArray) {
+    } else if (!m_inRoutineParams) {
         error(node->begin, "length of array should be always defined");
     } // length can be absent in case of routine parameter
 
     node->elementType->accept(*this);
-    if (m_searchArray) {
-        m_arrayInnerType = node->elementType;
-    }
 }
 
 void TypeDeriver::visit(RecordType* node) {
+    if (isDerived(node)) {
+        return;
+    }
+
     for (auto& field : node->fields) {
         field->accept(*this);
-        if (m_searchRecord && field->name == m_recordField) {
-            m_recordInnerType = field->type;
-        }
     }
+    node->indexFields();
 }
 
 void TypeDeriver::visit(VariableDecl* node) {
@@ -115,6 +144,9 @@ void TypeDeriver::visit(ReturnStatement* node) {
 void TypeDeriver::visit(Assignment* node) {
     node->rhs->accept(*this);
     node->lhs->accept(*this);
+    if (node->lhs->type == nullptr || node->rhs->type == nullptr) {
+        return;
+    }
     // check the type conformance
     if (node->lhs->type->getTypeKind() == TypeKind::Boolean &&
         !typeIsBooleanconvertible(node->rhs->type)) {
@@ -182,43 +214,47 @@ void TypeDeriver::visit(UnaryExpression* node) {
 }
 
 void TypeDeriver::visit(BinaryExpression* node) {
-    //  set correct type
+    // Every operand is derived exactly once, before the expression itself.
+    //  An operand whose type could not be derived was reported already and
+    //  leaves the type of the expression unknown as well.
     if (node->operation == lexer::TokenType::OpenBrack) {
         // if operation is array access
-        // find the type of array
-        m_searchArray = true;
         node->operand1->accept(*this);
-        if (m_arrayInnerType == nullptr) {
+        auto arrayType = node->operand1->type;
+        auto array = arrayType != nullptr ? arrayType->asArray() : nullptr;
+        if (array == nullptr && arrayType != nullptr) {
             error(node->operand1->begin,
                   "invalid operation [] on the given type");
         }
-        m_searchArray = false;
         node->operand2->accept(*this);
         if (!typeIsPrimitive(node->operand2->type)) {
             error(node->operand2->begin, "invalid type for array index");
         }
-        node->type = m_arrayInnerType;
+        node->type = array != nullptr ? array->elementType : nullptr;
     } else if (node->operation == lexer::TokenType::Dot) {
         // if operation is dot notation
-        // find record field name
-        m_searchField = true;
-        node->operand2->accept(*this);
-        m_searchField = false;
-        if (m_recordField == "") {
-            error(node->operand2->begin, "field name of record not found");
-        }
-        // search for the type of key arg
-        m_searchRecord = true;
         node->operand1->accept(*this);
-        m_searchRecord = false;
-        m_recordField = "";
+        auto recordType = node->operand1->type;
+        auto record = recordType != nullptr ? recordType->asRecord() : nullptr;
+        if (record == nullptr) {
+            if (recordType != nullptr) {
+                error(node->operand1->begin,
+                      "invalid operation '.' on the given type");
+            }
+            node->type = nullptr;
+            return;
+        }
 
-        if (m_recordInnerType == nullptr) {
-            error(node->operand1->begin,
-                  "invalid operation '.' on the given type");
+        // the field name is an identifier, but not linked to a variable
+        auto name = std::dynamic_pointer_cast<Identifier>(node->operand2);
+        auto field = name != nullptr ? record->findField(name->name) : nullptr;
+        if (field == nullptr) {
+            error(node->operand2->begin, "field name of record not found");
+            node->type = nullptr;
+            return;
         }
-        node->type = m_recordInnerType;
-        m_recordInnerType = nullptr;
+        name->type = field->type;
+        node->type = field->type;
     } else if (node->operation == lexer::TokenType::Or ||
                node->operation == lexer::TokenType::Xor ||
                node->operation == lexer::TokenType::And) {
@@ -260,14 +296,15 @@ void TypeDeriver::visit(BinaryExpression* node) {
     } else {
         node->operand1->accept(*this);
         node->operand2->accept(*this);
-        if (node->operand1->type->getTypeKind() !=
-            node->operand2->type->getTypeKind()) {
-            sPtr<Type> type1 = node->operand1->type;
+        sPtr<Type> type1 = node->operand1->type;
+        sPtr<Type> type2 = node->operand2->type;
+        if (type1 == nullptr || type2 == nullptr) {
+            node->type = nullptr;
+        } else if (type1->getTypeKind() != type2->getTypeKind()) {
             if (!typeIsPrimitive(type1)) {
                 error(node->operand1->begin, "invalid type of expression");
             }
 
-            sPtr<Type> type2 = node->operand2->type;
             if (!typeIsPrimitive(type2)) {
                 error(node->operand2->begin, "invalid type of expression");
             }
@@ -275,7 +312,7 @@ void TypeDeriver::visit(BinaryExpression* node) {
             node->type = getGreaterType(type1, type2);
         } else {
             // types are equal
-            node->type = node->operand1->type;
+            node->type = type1;
         }
     }
 }
@@ -288,13 +325,15 @@ void TypeDeriver::visit(BooleanLiteral*) {}
 
 void TypeDeriver::visit(Identifier* node) {
     // field name is an identifier, but not linked to a variable
-    if (node->variable != nullptr) {
-        node->variable->accept(*this);
-        node->type = node->variable->type;
+    if (node->variable == nullptr) {
+        return;
     }
-
-    if (m_searchField) {
-        m_recordField = node->name;
+    // Declarations are derived before they can be referred to, so the type
+    //  is known unless the identifier is part of its own initial value
+    node->type = node->variable->type;
+    if (node->type == nullptr && node->variable->initialValue != nullptr) {
+        error(node->begin, "'{}' is used in its own initial value",
+              node->name);
     }
 }
 
@@ -304,6 +343,13 @@ void TypeDeriver::visit(RoutineCall* node) {
     }
 }
 
+bool TypeDeriver::isDerived(const Type* type) {
+    if (m_globalTypes != nullptr && m_globalTypes->count(type) != 0) {
+        return true;
+    }
+    return !m_derived.insert(type).second;
+}
+
 sPtr<Type> TypeDeriver::getGreaterType(sPtr<Type> type1, sPtr<Type> type2) {
     // int  & real = real
     // bool & int  = int
@@ -326,11 +372,18 @@ sPtr<Type> TypeDeriver::getGreaterType(sPtr<Type> type1, sPtr<Type> type2) {
     return type1;
 }
 bool TypeDeriver::typeIsPrimitive(sPtr<Type> type) {
+    // An unknown type was reported where it came from
+    if (type == nullptr) {
+        return true;
+    }
     TypeKind kind = type->getTypeKind();
     return (kind == TypeKind::Integer) || (kind == TypeKind::Boolean) ||
            (kind == TypeKind::Real);
 }
 bool TypeDeriver::typeIsBooleanconvertible(sPtr<Type> type) {
+    if (type == nullptr) {
+        return true;
+    }
     TypeKind conditionType = type->getTypeKind();
     return conditionType == TypeKind::Integer ||
            conditionType == TypeKind::Boolean;
@@ -5,33 +5,37 @@ using namespace ast;
 
 namespace san {
 
+void IdentifierResolver::setJobs(unsigned jobs) { m_jobs = jobs; }
+
 void IdentifierResolver::visit(Program* node) {
     // Check if anything is declared twice in global scope and visit
     // all routines.
 
     bool ok = true;
+    GlobalDecls globals{firstDecls(node->routines),
+                        firstDecls(node->variables), firstDecls(node->types)};
 
     for (auto routine : node->routines) {
-        if (isRedeclared(node, routine)) {
+        if (isRedeclared(globals, routine)) {
             ok = false;
         }
 
-        m_routines.insert({routine->name, routine});
+        m_routines->insert({routine->name, routine});
     }
 
     for (auto& typeDecl : node->types) {
-        if (isRedeclared(node, typeDecl)) {
+        if (isRedeclared(globals, typeDecl)) {
             ok = false;
         }
 
         typeDecl->accept(*this);
         checkReplacementType(typeDecl->type);
 
-        m_types.push_back(typeDecl);
+        m_types.declare(typeDecl->name, typeDecl);
     }
 
     for (auto& var : node->variables) {
-        if (isRedeclared(node, var)) {
+        if (isRedeclared(globals, var)) {
             ok = false;
         }
 
@@ -45,36 +49,43 @@ void IdentifierResolver::visit(Program* node) {
             checkReplacementType(var->type);
         }
 
-        m_variables.push_back(var);
+        m_variables.declare(var->name, var);
     }
 
     if (!ok) {
         return;
     }
 
-    for (auto routine : node->routines) {
-        routine->accept(*this);
-    }
+    // Routines only share the global declarations, which are not modified
+    //  from here on
+    auto errors = visitRoutines(node, m_jobs, [this] {
+        IdentifierResolver resolver;
+        resolver.m_routines = m_routines;
+        resolver.m_variables = decltype(m_variables)(&m_variables);
+        resolver.m_types = decltype(m_types)(&m_types);
+        return resolver;
+    });
+    m_errors.insert(m_errors.end(), errors.begin(), errors.end());
 
     m_variables.clear();
-    m_routines.clear();
+    m_routines->clear();
     m_types.clear();
 }
 
 void IdentifierResolver::visit(RoutineDecl* node) {
     // To keep track of the scope, each function that introduces a new scope
-    //  will append its declarations to the `m_variables` vector and then remove
-    //  them again before returning.
-    // When searching for the closest variable declaration later on, the same
-    //  vector will be iterated on from end to start
+    //  will open a scope in `m_variables` for its declarations and then close
+    //  it again before returning.
+    // A declaration hides the ones of the same name made before it until its
+    //  scope is closed
 
-    auto oldSize = m_variables.size();
+    m_variables.pushScope();
 
     for (auto& parameter : node->parameters) {
         parameter->type->accept(*this);
         checkReplacementType(parameter->type);
 
-        m_variables.push_back(parameter);
+        m_variables.declare(parameter->name, parameter);
     }
 
     if (node->returnType != nullptr) {
@@ -82,18 +93,15 @@ void IdentifierResolver::visit(RoutineDecl* node) {
         checkReplacementType(node->returnType);
     }
 
-    node->body->accept(*this);
+    node->getBody()->accept(*this);
 
-    m_variables.resize(oldSize);
+    m_variables.popScope();
 }
 
 void IdentifierResolver::visit(AliasedType* node) {
-    for (auto it = m_types.rbegin(); it != m_types.rend(); it++) {
-        auto typeDecl = *it;
-        if (typeDecl->name == node->name) {
-            m_toReplaceType = typeDecl->type;
-            return;
-        }
+    if (auto typeDecl = m_types.find(node->name)) {
+        m_toReplaceType = (*typeDecl)->type;
+        return;
     }
     error(node->begin, "{} does not name a type", node->name);
 }
@@ -158,14 +166,16 @@ void IdentifierResolver::visit(Body* node) {
 
     bool ok = true;
 
+    auto variables = firstDecls(node->variables);
     for (auto var : node->variables) {
-        if (hasRedecl(node->variables, var, "variable")) {
+        if (hasRedecl(variables, var, "variable")) {
             ok = false;
         }
     }
 
+    auto types = firstDecls(node->types);
     for (auto type : node->types) {
-        if (hasRedecl(node->types, type, "type")) {
+        if (hasRedecl(types, type, "type")) {
             ok = false;
         }
     }
@@ -176,18 +186,18 @@ void IdentifierResolver::visit(Body* node) {
 
     // Traverse
 
-    auto oldVarsSize = m_variables.size();
-    auto oldTypesSize = m_types.size();
+    m_variables.pushScope();
+    m_types.pushScope();
 
     for (auto& type : node->types) {
         type->accept(*this);
         checkReplacementType(type->type);
 
-        m_types.push_back(type);
+        m_types.declare(type->name, type);
     }
 
     for (auto& variable : node->variables) {
-        m_variables.push_back(variable);
+        m_variables.declare(variable->name, variable);
 
         if (variable->initialValue != nullptr) {
             variable->initialValue->accept(*this);
@@ -204,8 +214,8 @@ void IdentifierResolver::visit(Body* node) {
         statement->accept(*this);
     }
 
-    m_variables.resize(oldVarsSize);
-    m_types.resize(oldTypesSize);
+    m_variables.popScope();
+    m_types.popScope();
 }
 
 void IdentifierResolver::visit(ReturnStatement* node) {
@@ -229,15 +239,15 @@ void IdentifierResolver::visit(WhileLoop* node) {
 }
 
 void IdentifierResolver::visit(ForLoop* node) {
-    auto oldSize = m_variables.size();
     node->rangeFrom->accept(*this);
     node->rangeTo->accept(*this);
 
-    m_variables.push_back(node->loopVar);
+    m_variables.pushScope();
+    m_variables.declare(node->loopVar->name, node->loopVar);
 
     node->body->accept(*this);
 
-    m_variables.resize(oldSize);
+    m_variables.popScope();
 }
 
 void IdentifierResolver::visit(IfStatement* node) {
@@ -351,8 +361,8 @@ void IdentifierResolver::visit(Identifier* node) {
 }
 
 void IdentifierResolver::visit(RoutineCall* node) {
-    auto routineIt = m_routines.find(node->routineName);
-    if (routineIt == m_routines.end()) {
+    auto routineIt = m_routines->find(node->routineName);
+    if (routineIt == m_routines->end()) {
         error(node->begin, "undeclared routine: {}", node->routineName);
         return;
     }
@@ -387,15 +397,9 @@ void IdentifierResolver::checkReplacementType(sPtr<Type>& type) {
     }
 }
 
-sPtr<VariableDecl> IdentifierResolver::findVarDecl(std::string name) {
-    for (auto it = m_variables.rbegin(); it != m_variables.rend(); it++) {
-        auto variable = *it;
-        if (variable->name == name) {
-            return variable;
-        }
-    }
-
-    return nullptr;
+sPtr<VariableDecl> IdentifierResolver::findVarDecl(const std::string& name) {
+    auto variable = m_variables.find(name);
+    return variable != nullptr ? *variable : nullptr;
 }
 
 } // namespace san
@@ -6,107 +6,52 @@ using namespace ast;
 
 namespace san {
 
-void MissingReturn::visit(Program* node) {
-    for (auto routine : node->routines) {
-        // Routines that don't return anything, can return nothing.
-        if (routine->returnType == nullptr) {
-            continue;
-        }
-
-        m_hasReturn = false;
-
-        routine->accept(*this);
-
-        if (!m_hasReturn) {
-            error(routine->begin,
-                  "missing a return statement on some execution paths");
-        }
+// A body always returns if any of its statements does. A return statement
+//  always returns, and an if statement does if both of its branches do.
+//
+// Loops are treated as possibly not returning, since we can not tell whether
+//  they run at all. That is, this will be treated as possibly not returning:
+// while true loop
+//     return
+// end
+
+void MissingReturn::enter(Body*) { m_bodies.push_back(false); }
+
+void MissingReturn::leave(Body*) {
+    m_lastBody = m_bodies.back();
+    m_bodies.pop_back();
+
+    if (!m_ifs.empty() && m_ifs.back().depth == m_bodies.size()) {
+        m_ifs.back().count++;
+        m_ifs.back().allReturn = m_ifs.back().allReturn && m_lastBody;
     }
 }
 
-void MissingReturn::visit(RoutineDecl* node) { node->body->accept(*this); }
-
-void MissingReturn::visit(AliasedType*) {}
-
-void MissingReturn::visit(IntegerType*) {}
-
-void MissingReturn::visit(RealType*) {}
-
-void MissingReturn::visit(BooleanType*) {}
-
-void MissingReturn::visit(ArrayType*) {}
-
-void MissingReturn::visit(RecordType*) {}
-
-void MissingReturn::visit(VariableDecl*) {}
-
-void MissingReturn::visit(TypeDecl*) {}
-
-void MissingReturn::visit(Body* node) {
-    m_hasReturn = false;
-
-    for (auto statement : node->statements) {
-        statement->accept(*this);
-
-        if (m_hasReturn) {
-            return;
-        }
+void MissingReturn::enter(ReturnStatement*) {
+    if (!m_bodies.empty()) {
+        m_bodies.back() = true;
     }
 }
 
-void MissingReturn::visit(ReturnStatement*) { m_hasReturn = true; }
-
-void MissingReturn::visit(Assignment*) {}
-
-void MissingReturn::visit(WhileLoop*) {
-    // We will ignore loops and pretend that we can not
-    // determine if it always returns unconditionally.
-    // That is, this will be treated as possibly not returning:
-    // whil true loop
-    //     return
-    // end
-}
-
-void MissingReturn::visit(ForLoop*) {
-    // As well as this:
-    // for i in 1..9 loop
-    //     return
-    // end
+void MissingReturn::enter(IfStatement*) {
+    m_ifs.push_back(Branches{m_bodies.size(), 0, true});
 }
 
-void MissingReturn::visit(IfStatement* node) {
-    // If statements can be determined to be always returning.
-    // It is if all two branches return.
-
-    m_hasReturn = false;
+void MissingReturn::leave(IfStatement*) {
+    auto branches = m_ifs.back();
+    m_ifs.pop_back();
 
-    if (node->elseBody == nullptr) {
-        return;
+    if (branches.count == 2 && branches.allReturn && !m_bodies.empty()) {
+        m_bodies.back() = true;
     }
+}
 
-    node->ifBody->accept(*this);
-
-    // Don't waste our time on else branch, if we already know that if may
-    // not return.
-    if (!m_hasReturn) {
-        return;
+void MissingReturn::leave(RoutineDecl* node) {
+    // Routines that don't return anything, can return nothing.
+    if (node->returnType != nullptr && !m_lastBody) {
+        error(node->begin,
+              "missing a return statement on some execution paths");
     }
-
-    node->elseBody->accept(*this);
 }
 
-void MissingReturn::visit(UnaryExpression*) {}
-
-void MissingReturn::visit(BinaryExpression*) {}
-
-void MissingReturn::visit(IntegerLiteral*) {}
-
-void MissingReturn::visit(RealLiteral*) {}
-
-void MissingReturn::visit(BooleanLiteral*) {}
-
-void MissingReturn::visit(Identifier*) {}
-
-void MissingReturn::visit(RoutineCall*) {}
-
 } // namespace san
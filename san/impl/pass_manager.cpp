@@ -0,0 +1,221 @@
+#include "san.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <numeric>
+#include <set>
+#include <stdexcept>
+#include <thread>
+
+namespace san {
+
+namespace {
+
+bool isIndependent(const PassManager::Pass& a, const PassManager::Pass& b) {
+    return a.preserved == PassManager::AllAnalyses &&
+           b.preserved == PassManager::AllAnalyses &&
+           (a.provided & (b.required | b.provided)) == 0 &&
+           (b.provided & a.required) == 0;
+}
+
+} // namespace
+
+void PassManager::add(Pass pass) {
+    if ((pass.required & ~m_available) != 0) {
+        throw std::logic_error(fmt::format(
+            "pass \"{}\" requires an analysis that no earlier pass provides",
+            pass.name));
+    }
+    m_available = (m_available & pass.preserved) | pass.provided;
+
+    std::vector<std::size_t> dependencies;
+    for (std::size_t i = 0; i < m_passes.size(); i++) {
+        if (!isIndependent(m_passes[i], pass)) {
+            dependencies.push_back(i);
+        }
+    }
+    m_passes.push_back(std::move(pass));
+    m_dependencies.push_back(std::move(dependencies));
+}
+
+void PassManager::setJobs(unsigned jobs) { m_jobs = jobs; }
+
+void PassManager::setFailFast(bool failFast) { m_failFast = failFast; }
+
+void PassManager::setAllocationCounter(std::size_t (*counter)()) {
+    m_allocationCounter = counter;
+}
+
+PassManager::Result PassManager::execute(std::size_t pass,
+                                         ast::Program& program) const {
+    Result result;
+    result.ran = true;
+    std::size_t allocations =
+        m_allocationCounter != nullptr ? m_allocationCounter() : 0;
+    auto start = std::chrono::steady_clock::now();
+    result.errors = m_passes[pass].run(program);
+    result.time = std::chrono::steady_clock::now() - start;
+    if (m_allocationCounter != nullptr) {
+        result.allocations = m_allocationCounter() - allocations;
+    }
+    return result;
+}
+
+/**
+ * Passes are started as soon as the passes they depend on are done, lowest
+ *  index first, so with a single job they run in the order they were added.
+ *  The calling thread is one of the jobs.
+ *
+ * A pass that reports errors does not provide its analyses: the passes that
+ *  need them are skipped, as are all passes after one that does not preserve
+ *  everything. An exception thrown by a pass stops the run and is rethrown
+ *  once the running passes are done.
+ */
+bool PassManager::run(ast::Program& program) {
+    auto start = std::chrono::steady_clock::now();
+    auto count = m_passes.size();
+    m_results.assign(count, Result{});
+
+    std::vector<std::size_t> waitingFor(count);
+    std::vector<std::vector<std::size_t>> dependents(count);
+    std::set<std::size_t> ready;
+    for (std::size_t i = 0; i < count; i++) {
+        waitingFor[i] = m_dependencies[i].size();
+        for (auto dependency : m_dependencies[i]) {
+            dependents[dependency].push_back(i);
+        }
+        if (waitingFor[i] == 0) {
+            ready.insert(i);
+        }
+    }
+
+    std::vector<bool> skipped(count, false);
+    bool stop = false;
+    bool ok = true;
+    std::size_t running = 0;
+    std::exception_ptr exception;
+    std::mutex mutex;
+    std::condition_variable changed;
+
+    // Called with the mutex held
+    auto finish = [&](std::size_t pass, bool failed) {
+        for (auto dependent : dependents[pass]) {
+            if (failed && ((m_passes[pass].provided &
+                            m_passes[dependent].required) != 0 ||
+                           m_passes[pass].preserved != AllAnalyses)) {
+                skipped[dependent] = true;
+            }
+            if (--waitingFor[dependent] == 0) {
+                ready.insert(dependent);
+            }
+        }
+    };
+
+    auto worker = [&] {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            changed.wait(lock, [&] {
+                return stop || !ready.empty() || running == 0;
+            });
+            if (stop || ready.empty()) {
+                break;
+            }
+            auto pass = *ready.begin();
+            ready.erase(ready.begin());
+            if (skipped[pass]) {
+                ok = false;
+                finish(pass, true);
+                continue;
+            }
+
+            running++;
+            lock.unlock();
+            Result result;
+            try {
+                result = execute(pass, program);
+            } catch (...) {
+                lock.lock();
+                exception = std::current_exception();
+                stop = true;
+                running--;
+                break;
+            }
+            lock.lock();
+            running--;
+
+            bool failed = !result.errors.empty();
+            m_results[pass] = std::move(result);
+            if (failed) {
+                ok = false;
+                stop = stop || m_failFast;
+            }
+            finish(pass, failed);
+            changed.notify_all();
+        }
+        changed.notify_all();
+    };
+
+    auto jobs = m_jobs;
+    if (jobs == 0) {
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+    }
+    jobs = static_cast<unsigned>(std::min(static_cast<std::size_t>(jobs),
+                                          std::max<std::size_t>(count, 1)));
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < jobs; t++) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : pool) {
+        thread.join();
+    }
+
+    m_elapsed = std::chrono::steady_clock::now() - start;
+    if (exception) {
+        std::rethrow_exception(exception);
+    }
+    // Passes that were never started in fail-fast mode did not succeed either
+    return ok && std::all_of(m_results.begin(), m_results.end(),
+                             [](const Result& result) { return result.ran; });
+}
+
+std::string PassManager::timeReport() const {
+    auto total = std::accumulate(
+        m_results.begin(), m_results.end(), std::chrono::duration<double>{},
+        [](auto sum, const Result& result) { return sum + result.time; });
+    auto allocations =
+        std::accumulate(m_results.begin(), m_results.end(), std::size_t{0},
+                        [](auto sum, const Result& result) {
+                            return sum + result.allocations;
+                        });
+    auto percent = [](double part, double whole) {
+        return whole > 0 ? 100 * part / whole : 0.0;
+    };
+
+    std::string title = "Pass execution timing report";
+    auto report = fmt::format("{:=<72}\n{:>{}}\n{:=<72}\n", "", title,
+                              (72 + title.size()) / 2, "");
+    report += fmt::format("  Total execution time: {:.4f} seconds (wall)\n\n",
+                          m_elapsed.count());
+    report += fmt::format("  {:>17}  {:>19}  {}\n", "---Wall Time---",
+                          "---Allocations---", "--- Name ---");
+    auto row = [&](double time, std::size_t count, const std::string& name) {
+        report += fmt::format(
+            "  {:8.4f} ({:5.1f}%)  {:>10} ({:5.1f}%)  {}\n", time,
+            percent(time, total.count()), count,
+            percent(static_cast<double>(count),
+                    static_cast<double>(allocations)),
+            name);
+    };
+    for (std::size_t i = 0; i < m_passes.size(); i++) {
+        if (m_results[i].ran) {
+            row(m_results[i].time.count(), m_results[i].allocations,
+                m_passes[i].name);
+        }
+    }
+    row(total.count(), allocations, "Total");
+    return report;
+}
+
+} // namespace san
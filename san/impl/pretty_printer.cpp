@@ -55,7 +55,7 @@ void PrettyPrinter::visit(RoutineDecl* node) {
 
     fmt::print(" is");
 
-    node->body->accept(*this);
+    node->getBody()->accept(*this);
 
     newline();
     fmt::print("end");
@@ -1,10 +1,411 @@
 #include "ast.hpp"
+#include "parallel.hpp"
+#include "scoped_table.hpp"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <variant>
+#include <vector>
 
 namespace san {
 
 template <typename T> using sPtr = std::shared_ptr<T>;
 
+/**
+ * Visits every routine of `program` with a visitor of its own, made by
+ *  `makeVisitor`, on `jobs` threads (one per hardware thread if 0). The
+ *  visitor holds the state of a single routine, so routines can be visited
+ *  concurrently as long as they only read what they share.
+ *
+ * Returns the errors of all visitors in the order of the routines, which is
+ *  the order a single visitor would have found them in.
+ */
+template <typename MakeVisitor>
+std::vector<ast::Error> visitRoutines(ast::Program* program, unsigned jobs,
+                                      MakeVisitor makeVisitor) {
+    auto& routines = program->routines;
+    std::vector<std::vector<ast::Error>> errors(routines.size());
+    common::parallelFor(routines.size(), jobs, [&](std::size_t i) {
+        auto visitor = makeVisitor();
+        routines[i]->accept(visitor);
+        errors[i] = visitor.takeErrors();
+    });
+
+    std::vector<ast::Error> merged;
+    for (auto& routineErrors : errors) {
+        merged.insert(merged.end(), routineErrors.begin(), routineErrors.end());
+    }
+    return merged;
+}
+
+template <typename... Checks> class CheckGroup;
+
+/**
+ * A semantic check that shares its traversal of the tree with other checks.
+ *
+ * Checks do not descend into the tree themselves. A `CheckGroup` walks the
+ *  tree once and calls `enter` on each of its checks before visiting the
+ *  children of a node and `leave` after them, so a group of independent
+ *  checks touches every node once instead of once per check.
+ *
+ * `Derived` defines the hooks it needs and brings the empty ones into scope
+ *  with `using Check::enter` and `using Check::leave`. The hooks are resolved
+ *  at compile time, so the ones a check does not define cost nothing.
+ *
+ * Accepting a check on its own runs it in a group of one.
+ */
+template <typename Derived> class Check : public ast::Visitor {
+public:
+    /**
+     * Whether the check looks at expressions. They make up most of the tree,
+     *  so a group does not walk them unless one of its checks needs them.
+     */
+    static constexpr bool needsExpressions = true;
+
+    void visit(ast::Program* node) final { run(node); }
+    void visit(ast::RoutineDecl* node) final { run(node); }
+    void visit(ast::AliasedType* node) final { run(node); }
+    void visit(ast::IntegerType* node) final { run(node); }
+    void visit(ast::RealType* node) final { run(node); }
+    void visit(ast::BooleanType* node) final { run(node); }
+    void visit(ast::ArrayType* node) final { run(node); }
+    void visit(ast::RecordType* node) final { run(node); }
+    void visit(ast::VariableDecl* node) final { run(node); }
+    void visit(ast::TypeDecl* node) final { run(node); }
+    void visit(ast::Body* node) final { run(node); }
+    void visit(ast::ReturnStatement* node) final { run(node); }
+    void visit(ast::Assignment* node) final { run(node); }
+    void visit(ast::WhileLoop* node) final { run(node); }
+    void visit(ast::ForLoop* node) final { run(node); }
+    void visit(ast::IfStatement* node) final { run(node); }
+    void visit(ast::UnaryExpression* node) final { run(node); }
+    void visit(ast::BinaryExpression* node) final { run(node); }
+    void visit(ast::IntegerLiteral* node) final { run(node); }
+    void visit(ast::RealLiteral* node) final { run(node); }
+    void visit(ast::BooleanLiteral* node) final { run(node); }
+    void visit(ast::Identifier* node) final { run(node); }
+    void visit(ast::RoutineCall* node) final { run(node); }
+
+    void enter(ast::Program*) {}
+    void enter(ast::RoutineDecl*) {}
+    void enter(ast::AliasedType*) {}
+    void enter(ast::IntegerType*) {}
+    void enter(ast::RealType*) {}
+    void enter(ast::BooleanType*) {}
+    void enter(ast::ArrayType*) {}
+    void enter(ast::RecordType*) {}
+    void enter(ast::VariableDecl*) {}
+    void enter(ast::TypeDecl*) {}
+    void enter(ast::Body*) {}
+    void enter(ast::ReturnStatement*) {}
+    void enter(ast::Assignment*) {}
+    void enter(ast::WhileLoop*) {}
+    void enter(ast::ForLoop*) {}
+    void enter(ast::IfStatement*) {}
+    void enter(ast::UnaryExpression*) {}
+    void enter(ast::BinaryExpression*) {}
+    void enter(ast::IntegerLiteral*) {}
+    void enter(ast::RealLiteral*) {}
+    void enter(ast::BooleanLiteral*) {}
+    void enter(ast::Identifier*) {}
+    void enter(ast::RoutineCall*) {}
+
+    void leave(ast::Program*) {}
+    void leave(ast::RoutineDecl*) {}
+    void leave(ast::AliasedType*) {}
+    void leave(ast::IntegerType*) {}
+    void leave(ast::RealType*) {}
+    void leave(ast::BooleanType*) {}
+    void leave(ast::ArrayType*) {}
+    void leave(ast::RecordType*) {}
+    void leave(ast::VariableDecl*) {}
+    void leave(ast::TypeDecl*) {}
+    void leave(ast::Body*) {}
+    void leave(ast::ReturnStatement*) {}
+    void leave(ast::Assignment*) {}
+    void leave(ast::WhileLoop*) {}
+    void leave(ast::ForLoop*) {}
+    void leave(ast::IfStatement*) {}
+    void leave(ast::UnaryExpression*) {}
+    void leave(ast::BinaryExpression*) {}
+    void leave(ast::IntegerLiteral*) {}
+    void leave(ast::RealLiteral*) {}
+    void leave(ast::BooleanLiteral*) {}
+    void leave(ast::Identifier*) {}
+    void leave(ast::RoutineCall*) {}
+
+    /** Adds the errors found by another instance of the check */
+    void merge(Derived& other) {
+        auto errors = other.takeErrors();
+        m_errors.insert(m_errors.end(), errors.begin(), errors.end());
+    }
+
+private:
+    template <typename T> void run(T* node) {
+        CheckGroup<Derived>{static_cast<Derived&>(*this)}.visit(node);
+    }
+};
+
+/**
+ * Runs several checks in a single traversal.
+ *
+ * The walk follows ownership: identifiers, routine calls and aliased types are
+ *  not followed to their declarations. Checks in one group see the tree in the
+ *  same state, so a check that needs the results of another pass has to run
+ *  after it, e.g. everything after `IdentifierResolver` and `TypeDeriver`
+ *  after `ParamsValidator`, which fills in the types of routine calls.
+ */
+template <typename... Checks> class CheckGroup : public ast::Visitor {
+public:
+    CheckGroup(Checks&... checks) : m_checks(checks...) {}
+
+    /**
+     * Number of threads routines are checked on, one per hardware thread if
+     *  0. Unless it is 1, every routine is checked by fresh checks of its own
+     *  whose errors are then added to the group's in the order of the
+     *  routines, so checks must not carry state from one routine to the next.
+     */
+    void setJobs(unsigned jobs) { m_jobs = jobs; }
+
+    void visit(ast::Program* node) override {
+        enter(node);
+        acceptAll(node->variables);
+        acceptAll(node->types);
+        if (m_jobs == 1) {
+            acceptAll(node->routines);
+        } else {
+            acceptRoutines(node->routines);
+        }
+        leave(node);
+    }
+
+    void visit(ast::RoutineDecl* node) override {
+        enter(node);
+        acceptAll(node->parameters);
+        accept(node->returnType);
+        accept(node->getBody());
+        leave(node);
+    }
+
+    void visit(ast::AliasedType* node) override {
+        enter(node);
+        leave(node);
+    }
+
+    void visit(ast::IntegerType* node) override {
+        enter(node);
+        leave(node);
+    }
+
+    void visit(ast::RealType* node) override {
+        enter(node);
+        leave(node);
+    }
+
+    void visit(ast::BooleanType* node) override {
+        enter(node);
+        leave(node);
+    }
+
+    void visit(ast::ArrayType* node) override {
+        enter(node);
+        acceptExpression(node->length);
+        accept(node->elementType);
+        leave(node);
+    }
+
+    void visit(ast::RecordType* node) override {
+        enter(node);
+        acceptAll(node->fields);
+        leave(node);
+    }
+
+    void visit(ast::VariableDecl* node) override {
+        enter(node);
+        accept(node->type);
+        acceptExpression(node->initialValue);
+        leave(node);
+    }
+
+    void visit(ast::TypeDecl* node) override {
+        enter(node);
+        accept(node->type);
+        leave(node);
+    }
+
+    void visit(ast::Body* node) override {
+        enter(node);
+        acceptAll(node->types);
+        acceptAll(node->variables);
+        acceptAll(node->statements);
+        leave(node);
+    }
+
+    void visit(ast::ReturnStatement* node) override {
+        enter(node);
+        acceptExpression(node->expression);
+        leave(node);
+    }
+
+    void visit(ast::Assignment* node) override {
+        enter(node);
+        acceptExpression(node->lhs);
+        acceptExpression(node->rhs);
+        leave(node);
+    }
+
+    void visit(ast::WhileLoop* node) override {
+        enter(node);
+        acceptExpression(node->condition);
+        accept(node->body);
+        leave(node);
+    }
+
+    void visit(ast::ForLoop* node) override {
+        enter(node);
+        accept(node->loopVar);
+        acceptExpression(node->rangeFrom);
+        acceptExpression(node->rangeTo);
+        accept(node->body);
+        leave(node);
+    }
+
+    void visit(ast::IfStatement* node) override {
+        enter(node);
+        acceptExpression(node->condition);
+        accept(node->ifBody);
+        accept(node->elseBody);
+        leave(node);
+    }
+
+    void visit(ast::UnaryExpression* node) override {
+        enter(node);
+        accept(node->operand);
+        leave(node);
+    }
+
+    void visit(ast::BinaryExpression* node) override {
+        enter(node);
+        accept(node->operand1);
+        accept(node->operand2);
+        leave(node);
+    }
+
+    void visit(ast::IntegerLiteral* node) override {
+        enter(node);
+        leave(node);
+    }
+
+    void visit(ast::RealLiteral* node) override {
+        enter(node);
+        leave(node);
+    }
+
+    void visit(ast::BooleanLiteral* node) override {
+        enter(node);
+        leave(node);
+    }
+
+    void visit(ast::Identifier* node) override {
+        enter(node);
+        leave(node);
+    }
+
+    void visit(ast::RoutineCall* node) override {
+        enter(node);
+        acceptExpressions(node->args);
+        leave(node);
+    }
+
+private:
+    std::tuple<Checks&...> m_checks;
+    unsigned m_jobs = 1;
+
+    static constexpr bool s_needsExpressions =
+        (Checks::needsExpressions || ...);
+
+    template <typename T> void enter(T* node) {
+        std::apply([node](auto&... check) { (enterOne(check, node), ...); },
+                   m_checks);
+    }
+
+    template <typename T> void leave(T* node) {
+        std::apply([node](auto&... check) { (leaveOne(check, node), ...); },
+                   m_checks);
+    }
+
+    // Expression hooks are only called on the checks that need expressions
+    template <typename Check, typename T>
+    static void enterOne(Check& check, T* node) {
+        if constexpr (!std::is_base_of_v<ast::Expression, T> ||
+                      Check::needsExpressions) {
+            check.enter(node);
+        }
+    }
+
+    template <typename Check, typename T>
+    static void leaveOne(Check& check, T* node) {
+        if constexpr (!std::is_base_of_v<ast::Expression, T> ||
+                      Check::needsExpressions) {
+            check.leave(node);
+        }
+    }
+
+    template <typename T> void accept(const sPtr<T>& node) {
+        if (node != nullptr) {
+            node->accept(*this);
+        }
+    }
+
+    template <typename T> void acceptAll(const std::vector<sPtr<T>>& nodes) {
+        for (auto& node : nodes) {
+            accept(node);
+        }
+    }
+
+    void acceptRoutines(const std::vector<sPtr<ast::RoutineDecl>>& routines) {
+        std::vector<std::tuple<Checks...>> checks(routines.size());
+        common::parallelFor(routines.size(), m_jobs, [&](std::size_t i) {
+            std::apply(
+                [&](auto&... routineChecks) {
+                    CheckGroup<Checks...> group{routineChecks...};
+                    routines[i]->accept(group);
+                },
+                checks[i]);
+        });
+        for (auto& routineChecks : checks) {
+            merge(routineChecks, std::index_sequence_for<Checks...>{});
+        }
+    }
+
+    template <std::size_t... I>
+    void merge(std::tuple<Checks...>& from, std::index_sequence<I...>) {
+        (std::get<I>(m_checks).merge(std::get<I>(from)), ...);
+    }
+
+    void acceptExpression(const sPtr<ast::Expression>& node) {
+        if constexpr (s_needsExpressions) {
+            accept(node);
+        }
+    }
+
+    void acceptExpressions(const std::vector<sPtr<ast::Expression>>& nodes) {
+        if constexpr (s_needsExpressions) {
+            acceptAll(nodes);
+        }
+    }
+};
+
 class AstPrinter : public ast::Visitor {
 public:
     AstPrinter(size_t depth = 0) : m_depth(depth) {}
@@ -102,35 +503,33 @@ private:
  *     end
  * end
  */
-class MissingReturn : public ast::Visitor {
+class MissingReturn : public Check<MissingReturn> {
 public:
-    MissingReturn() {}
-    void visit(ast::Program* node) override;
-    void visit(ast::RoutineDecl* node) override;
-    void visit(ast::AliasedType* node) override;
-    void visit(ast::IntegerType* node) override;
-    void visit(ast::RealType* node) override;
-    void visit(ast::BooleanType* node) override;
-    void visit(ast::ArrayType* node) override;
-    void visit(ast::RecordType* node) override;
-    void visit(ast::VariableDecl* node) override;
-    void visit(ast::TypeDecl* node) override;
-    void visit(ast::Body* node) override;
-    void visit(ast::ReturnStatement* node) override;
-    void visit(ast::Assignment* node) override;
-    void visit(ast::WhileLoop* node) override;
-    void visit(ast::ForLoop* node) override;
-    void visit(ast::IfStatement* node) override;
-    void visit(ast::UnaryExpression* node) override;
-    void visit(ast::BinaryExpression* node) override;
-    void visit(ast::IntegerLiteral* node) override;
-    void visit(ast::RealLiteral* node) override;
-    void visit(ast::BooleanLiteral* node) override;
-    void visit(ast::Identifier* node) override;
-    void visit(ast::RoutineCall* node) override;
+    static constexpr bool needsExpressions = false;
+    using Check::enter;
+    using Check::leave;
+
+    void enter(ast::Body* node);
+    void leave(ast::Body* node);
+    void enter(ast::ReturnStatement* node);
+    void enter(ast::IfStatement* node);
+    void leave(ast::IfStatement* node);
+    void leave(ast::RoutineDecl* node);
 
 private:
-    bool m_hasReturn = true;
+    // For each body being visited, whether it is known to always return.
+    std::vector<bool> m_bodies;
+    // Whether the body visited last always returns.
+    bool m_lastBody = false;
+
+    // The branches of an if statement seen so far. They are the bodies that
+    //  are left while `m_bodies` holds `depth` bodies.
+    struct Branches {
+        std::size_t depth;
+        unsigned count;
+        bool allReturn;
+    };
+    std::vector<Branches> m_ifs;
 };
 
 /**
@@ -143,6 +542,13 @@ private:
  */
 class IdentifierResolver : public ast::Visitor {
 public:
+    /**
+     * Number of threads routines are resolved on, one per hardware thread if
+     *  0. Every routine is resolved by a resolver of its own that starts with
+     *  the global scope.
+     */
+    void setJobs(unsigned jobs);
+
     void visit(ast::Program* node) override;
     void visit(ast::RoutineDecl* node) override;
     void visit(ast::AliasedType* node) override;
@@ -168,95 +574,133 @@ public:
     void visit(ast::RoutineCall* node) override;
 
 private:
-    // A map since we cannot have 2 routines with the same name.
-    std::map<std::string, sPtr<ast::RoutineDecl>> m_routines;
-    // Stack that holds available variables in current scope.
-    std::vector<sPtr<ast::VariableDecl>> m_variables;
-    // Just like above but for types.
-    std::vector<sPtr<ast::TypeDecl>> m_types;
+    // A map since we cannot have 2 routines with the same name. It is filled
+    //  before any routine is visited and shared by the resolvers of all
+    //  routines.
+    using Routines = std::unordered_map<std::string, sPtr<ast::RoutineDecl>>;
+    sPtr<Routines> m_routines = std::make_shared<Routines>();
+    // Variables and types available in the current scope. The resolvers of
+    //  routines nest their tables in the global ones.
+    common::ScopedTable<sPtr<ast::VariableDecl>> m_variables;
+    common::ScopedTable<sPtr<ast::TypeDecl>> m_types;
 
     sPtr<ast::RoutineCall> m_toReplaceVar = nullptr;
     sPtr<ast::Type> m_toReplaceType = nullptr;
 
-    sPtr<ast::VariableDecl> findVarDecl(std::string);
+    unsigned m_jobs = 1;
+
+    sPtr<ast::VariableDecl> findVarDecl(const std::string& name);
 
     void checkReplacementVar(sPtr<ast::Expression>&);
     void checkReplacementType(sPtr<ast::Type>&);
 
-    // Requires: `Container` to be an std container with of type
-    //  `sPtr<DeclPtr>`.
+    // The first declaration of every name among some declarations of a scope
+    template <typename Decl>
+    using FirstDecls = std::unordered_map<std::string_view, const Decl*>;
+
+    template <typename Decl>
+    static FirstDecls<Decl> firstDecls(const std::vector<sPtr<Decl>>& decls) {
+        FirstDecls<Decl> firsts;
+        firsts.reserve(decls.size());
+        for (auto& decl : decls) {
+            firsts.try_emplace(decl->name, decl.get());
+        }
+        return firsts;
+    }
+
+    // Requires: `firsts` to be built from declarations in the order they
+    //           appear in the source.
     //           `DeclPtr` should be a pointer to an ast node.
-    // Effects: returns true if there exists a declaration in the Container with
+    // Effects: returns true if there exists a declaration among `firsts` with
     //          position prior to the provided declaration and with the same
     //          name.
-    template <typename Container, typename DeclPtr>
-    bool hasRedecl(const Container& vec, DeclPtr decl,
+    template <typename Decl, typename DeclPtr>
+    bool hasRedecl(const FirstDecls<Decl>& firsts, DeclPtr decl,
                    const std::string& typeStr) {
-        auto priorDecl =
-            std::find_if(vec.begin(), vec.end(), [&](const auto& declPtr) {
-                return declPtr->name == decl->name &&
-                       declPtr->begin < decl->begin;
-            });
-
-        if (priorDecl != vec.end()) {
+        auto priorDecl = firsts.find(decl->name);
+        if (priorDecl != firsts.end() &&
+            priorDecl->second->begin < decl->begin) {
             error(decl->begin, "redeclaration of {} '{}' declared at line {}",
-                  typeStr, (*priorDecl)->name, (*priorDecl)->begin.line);
+                  typeStr, priorDecl->second->name,
+                  priorDecl->second->begin.line);
             return true;
         }
 
         return false;
     }
 
+    struct GlobalDecls {
+        FirstDecls<ast::RoutineDecl> routines;
+        FirstDecls<ast::VariableDecl> variables;
+        FirstDecls<ast::TypeDecl> types;
+    };
+
     template <typename DeclPtr>
-    bool isRedeclared(ast::Program const* node, DeclPtr decl) {
-        return hasRedecl(node->routines, decl, "routine") ||
-               hasRedecl(node->variables, decl, "variable") ||
-               hasRedecl(node->types, decl, "type");
+    bool isRedeclared(const GlobalDecls& globals, DeclPtr decl) {
+        return hasRedecl(globals.routines, decl, "routine") ||
+               hasRedecl(globals.variables, decl, "variable") ||
+               hasRedecl(globals.types, decl, "type");
     }
 };
 
 /**
- * This visitor is responsible for verifying that declarations of array type
+ * This check is responsible for verifying that declarations of array type
  *  include the size except possibly for parameters
  */
-class ArrayLengthEnforcer : public ast::Visitor {
+class ArrayLengthEnforcer : public Check<ArrayLengthEnforcer> {
 public:
-    void visit(ast::Program* node) override;
-    void visit(ast::RoutineDecl* node) override;
-    void visit(ast::AliasedType* node) override;
-    void visit(ast::IntegerType* node) override;
-    void visit(ast::RealType* node) override;
-    void visit(ast::BooleanType* node) override;
-    void visit(ast::ArrayType* node) override;
-    void visit(ast::RecordType* node) override;
-    void visit(ast::VariableDecl* node) override;
-    void visit(ast::TypeDecl* node) override;
-    void visit(ast::Body* node) override;
-    void visit(ast::ReturnStatement* node) override;
-    void visit(ast::Assignment* node) override;
-    void visit(ast::WhileLoop* node) override;
-    void visit(ast::ForLoop* node) override;
-    void visit(ast::IfStatement* node) override;
-    void visit(ast::UnaryExpression* node) override;
-    void visit(ast::BinaryExpression* node) override;
-    void visit(ast::IntegerLiteral* node) override;
-    void visit(ast::RealLiteral* node) override;
-    void visit(ast::BooleanLiteral* node) override;
-    void visit(ast::Identifier* node) override;
-    void visit(ast::RoutineCall* node) override;
+    static constexpr bool needsExpressions = false;
+    using Check::enter;
+    using Check::leave;
+
+    void enter(ast::RoutineDecl* node);
+    void enter(ast::ArrayType* node);
+    void enter(ast::VariableDecl* node);
+    void leave(ast::VariableDecl* node);
+    void enter(ast::TypeDecl* node);
+    void leave(ast::TypeDecl* node);
+    void enter(ast::Body* node);
 
 private:
-    bool m_insideParameters = false;
+    // Set from the start of a routine up to its body. Arrays in parameter
+    //  types may omit the length, the one in the return type may not.
+    bool m_inSignature = false;
+    // Numbers of enclosing variable and type declarations. Type declarations
+    //  are checked where a variable uses them.
+    unsigned m_variables = 0;
+    unsigned m_typeDecls = 0;
 };
 /**
- * This visitor is responsible for validation of parameters
+ * This check is responsible for validation of parameters
  * of the routines:
  * - check that number of parameters and their types in RoutineCalls match the
  * respective RoutineDecl
  * + assignment of the RoutineDecl's return type to the RoutineCall's type
  */
-class ParamsValidator : public ast::Visitor {
+class ParamsValidator : public Check<ParamsValidator> {
+public:
+    using Check::enter;
+    using Check::leave;
+
+    void enter(ast::RoutineCall* node);
+};
+
+/**
+ * This visitor is responsible for
+ * - detection of possibility of type conversion
+ * - determining the resulting type of the expression
+ * - checking that array index and range thresholds are integers
+ * - checking that dot is called only on records
+ */
+
+class TypeDeriver : public ast::Visitor {
 public:
+    /**
+     * Number of threads routine bodies are derived on, one per hardware thread
+     *  if 0. Every routine is derived by a deriver of its own.
+     */
+    void setJobs(unsigned jobs);
+
     void visit(ast::Program* node) override;
     void visit(ast::RoutineDecl* node) override;
     void visit(ast::AliasedType* node) override;
@@ -280,18 +724,59 @@ public:
     void visit(ast::BooleanLiteral* node) override;
     void visit(ast::Identifier* node) override;
     void visit(ast::RoutineCall* node) override;
+
+private:
+    // function, which returns the type of expression, if its lhs is of type
+    // `initialType` and rhs is of type `targetType`
+    sPtr<ast::Type> getGreaterType(sPtr<ast::Type> initialType,
+                                   sPtr<ast::Type> targetType);
+
+    // checks if the given type is an Integer, Boolean or Real
+    bool typeIsPrimitive(sPtr<ast::Type> type);
+
+    // checks if TypeKind is Integer or Boolean
+    bool typeIsBooleanconvertible(sPtr<ast::Type> type);
+
+    // checks if the visitor is inside the list of routine paramenters (used for
+    // array length check)
+    bool m_inRoutineParams = false;
+
+    unsigned m_jobs = 1;
+
+    // A type is derived once, however many declarations refer to it. The
+    //  types of globals and routine signatures are derived before any routine
+    //  and shared by the derivers of all routines.
+    std::unordered_set<const ast::Type*> m_derived;
+    sPtr<const std::unordered_set<const ast::Type*>> m_globalTypes;
+
+    // Returns true if `type` was derived already, marks it derived otherwise
+    bool isDerived(const ast::Type* type);
+
+    // bool DeriveType::checkTypesAreEqual(sPtr<ast::Type> type1,
+    //                                     sPtr<ast::Type> type2);
+    // sPtr<std::vector<ast::TypeKind>> getFullType(sPtr<ast::Type> type1);
 };
 
 /**
- * This visitor is responsible for
- * - detection of possibility of type conversion
- * - determining the resulting type of the expression
- * - checking that array index and range thresholds are integers
- * - checking that dot is called only on records
+ * This visitor evaluates the expressions whose value is known at compile
+ *  time and replaces them with literals. Global variables that are initialised
+ *  with a constant and never assigned to are constants as well.
+ *
+ * Constant array lengths are recorded in `ArrayType::staticLength`. Integer
+ *  division by a constant zero and constant array lengths below one are
+ *  reported.
+ *
+ * Identifiers have to be resolved and the types derived. The literals keep
+ *  the type of the expression they replace.
  */
-
-class TypeDeriver : public ast::Visitor {
+class ConstantFolder : public ast::Visitor {
 public:
+    /**
+     * Number of threads routines are folded on, one per hardware thread if 0.
+     *  Every routine is folded by a folder of its own.
+     */
+    void setJobs(unsigned jobs);
+
     void visit(ast::Program* node) override;
     void visit(ast::RoutineDecl* node) override;
     void visit(ast::AliasedType* node) override;
@@ -317,39 +802,133 @@ public:
     void visit(ast::RoutineCall* node) override;
 
 private:
-    // function, which returns the type of expression, if its lhs is of type
-    // `initialType` and rhs is of type `targetType`
-    sPtr<ast::Type> getGreaterType(sPtr<ast::Type> initialType,
-                                   sPtr<ast::Type> targetType);
-
-    // checks if the given type is an Integer, Boolean or Real
-    bool typeIsPrimitive(sPtr<ast::Type> type);
-
-    // checks if TypeKind is Integer or Boolean
-    bool typeIsBooleanconvertible(sPtr<ast::Type> type);
-
-    // if this variable is set to true, variable `m_arrayInnerType` will be
-    // set to the type of the array during array visiting
-    bool m_searchArray = false;
-    sPtr<ast::Type> m_arrayInnerType = nullptr;
-
-    // if this variable is set to true, variable `m_recordField` will be set to
-    // the name of the last visited identifier
-    bool m_searchField = false;
-    std::string m_recordField = "";
+    // A constant of every primitive type, ordered like the types in mixed
+    //  arithmetic: boolean, then integer, then real
+    using Value = std::variant<bool, std::int64_t, double>;
+
+    // What the folders of all routines share. It is filled before any
+    //  routine is folded.
+    struct Globals {
+        std::unordered_map<const ast::VariableDecl*, Value> constants;
+        // Array types of globals and routine signatures, folded already
+        std::unordered_set<const ast::ArrayType*> arrays;
+    };
+    sPtr<Globals> m_globals;
+
+    // Array types folded by this folder, so that types shared by several
+    //  declarations are folded and reported once
+    std::unordered_set<const ast::ArrayType*> m_arrays;
+
+    // Value of the last visited expression, unset if it is not constant
+    std::optional<Value> m_value;
+
+    unsigned m_jobs = 1;
+
+    // Folds `expr` and replaces it with a literal if it is constant
+    std::optional<Value> fold(sPtr<ast::Expression>& expr);
+    void foldType(const sPtr<ast::Type>& type);
+
+    std::optional<Value> evaluate(ast::BinaryExpression* node,
+                                  const Value& lhs, const Value& rhs);
+};
 
-    // if this variable is set to true, variable `m_recordInnerType` will be set
-    // to the type of field `m_recordField`
-    bool m_searchRecord = false;
-    sPtr<ast::Type> m_recordInnerType = nullptr;
 
-    // checks if the visitor is inside the list of routine paramenters (used for
-    // array length check)
-    bool m_inRoutineParams = false;
+/**
+ * Runs a sequence of passes over a program.
+ *
+ * Every pass declares the analyses it needs to be valid before it runs, the
+ *  ones it computes and the ones that stay valid after it. Passes are added
+ *  in the order they would run sequentially, and a pass that needs an
+ *  analysis no earlier pass provides is rejected when it is added.
+ *
+ * Passes that neither compute anything the other one reads or writes nor
+ *  invalidate any analysis are independent and may run at the same time when
+ *  more than one job is allowed. Each pass still runs on a single thread.
+ */
+class PassManager {
+public:
+    /** The results of a pass that later passes can rely on */
+    enum Analysis : unsigned {
+        /** Identifiers and aliased types point to their declarations */
+        ResolvedIdentifiers = 1u << 0,
+        /** Routine calls have the return type of the routine they call */
+        CallTypes = 1u << 1,
+        /** Expressions have their types derived */
+        ExpressionTypes = 1u << 2,
+        /** Constant expressions are literals and array lengths are known */
+        ConstantValues = 1u << 3,
+        AllAnalyses = ~0u,
+    };
+
+    struct Pass {
+        std::string name;
+        /** Analyses that have to be valid when the pass runs */
+        unsigned required = 0;
+        /** Analyses the pass computes */
+        unsigned provided = 0;
+        /**
+         * Analyses that are still valid after the pass. A pass that does not
+         *  preserve everything has to run on its own.
+         */
+        unsigned preserved = AllAnalyses;
+        std::function<std::vector<ast::Error>(ast::Program&)> run;
+    };
+
+    struct Result {
+        /**
+         * Unset if the pass was skipped, because it needs an analysis that a
+         *  failed pass did not provide or because an earlier pass failed in
+         *  fail-fast mode.
+         */
+        bool ran = false;
+        std::vector<ast::Error> errors;
+        std::chrono::duration<double> time{};
+        /** Zero unless an allocation counter is set */
+        std::size_t allocations = 0;
+    };
+
+    void add(Pass pass);
+
+    /** Number of passes that may run at once, 0 for one per hardware thread */
+    void setJobs(unsigned jobs);
+    /**
+     * In fail-fast mode, which is the default, no pass is started after one
+     *  reports errors. Otherwise every pass that does not depend on a failed
+     *  one runs, so the errors of all of them are collected.
+     */
+    void setFailFast(bool failFast);
+    /**
+     * Sets the function that returns the number of allocations made so far by
+     *  the whole process, used to report the allocations of every pass. The
+     *  count includes the worker threads a pass starts, and passes that run
+     *  at the same time are charged for each other's allocations.
+     */
+    void setAllocationCounter(std::size_t (*counter)());
+
+    /** Returns true if every pass ran without reporting errors */
+    bool run(ast::Program& program);
+
+    /** The results of the last run, in the order the passes were added */
+    const std::vector<Result>& getResults() const { return m_results; }
+    const std::vector<Pass>& getPasses() const { return m_passes; }
+
+    /** Formats the time and allocations of every pass of the last run */
+    std::string timeReport() const;
 
-    // bool DeriveType::checkTypesAreEqual(sPtr<ast::Type> type1,
-    //                                     sPtr<ast::Type> type2);
-    // sPtr<std::vector<ast::TypeKind>> getFullType(sPtr<ast::Type> type1);
+private:
+    std::vector<Pass> m_passes;
+    // Indices of the earlier passes every pass has to wait for
+    std::vector<std::vector<std::size_t>> m_dependencies;
+    std::vector<Result> m_results;
+    std::chrono::duration<double> m_elapsed{};
+    // Analyses that are valid after the last added pass
+    unsigned m_available = 0;
+
+    unsigned m_jobs = 1;
+    bool m_failFast = true;
+    std::size_t (*m_allocationCounter)() = nullptr;
+
+    Result execute(std::size_t pass, ast::Program& program) const;
 };
 
 } // namespace san
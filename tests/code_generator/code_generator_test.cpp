@@ -0,0 +1,216 @@
+#include "catch2/catch.hpp"
+#include "code_generator.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "san.hpp"
+#include <string>
+#include <vector>
+
+namespace testing {
+
+template <typename Pass> void check(const ast::sPtr<ast::Program>& program) {
+    Pass pass;
+    program->accept(pass);
+    REQUIRE(pass.getErrors().empty());
+}
+
+/**
+ * Runs the front end over `source`, which has to pass it, and generates code
+ *  for it with `codegen`
+ */
+void generate(const std::string& source, cg::ParallelCodeGenerator& codegen) {
+    parser::Parser parser(lexer::Lexer{source});
+    auto program = parser.parseProgram();
+    REQUIRE(parser.getErrors().empty());
+    check<san::IdentifierResolver>(program);
+    check<san::ArrayLengthEnforcer>(program);
+    check<san::MissingReturn>(program);
+    check<san::ParamsValidator>(program);
+    check<san::TypeDeriver>(program);
+    check<san::ConstantFolder>(program);
+    codegen.generate(program.get());
+}
+
+/** Calls `routine` of `source` with `args` and returns what it returns */
+std::string run(const std::string& source, const std::string& routine,
+                const std::vector<std::string>& args,
+                const cg::TargetConfig& target = {}) {
+    cg::ParallelCodeGenerator codegen("test", target);
+    generate(source, codegen);
+    auto errors = codegen.getErrors();
+    for (auto& error : errors) {
+        UNSCOPED_INFO(error.message);
+    }
+    REQUIRE(errors.empty());
+
+    cg::Jit jit;
+    std::string result;
+    REQUIRE(jit.load(codegen, routine));
+    REQUIRE(jit.call(args, result));
+    return result;
+}
+
+} // namespace testing
+
+SCENARIO("Booleans are stored as bytes", "[code_generator]") {
+    GIVEN("A boolean local assigned an integer") {
+        auto source = "routine f(x : integer) : boolean is\n"
+                      "    var b : boolean\n"
+                      "    b := x\n"
+                      "    return b\n"
+                      "end\n";
+
+        THEN("Any integer but 0 is true") {
+            REQUIRE(testing::run(source, "f", {"256"}) == "true");
+            REQUIRE(testing::run(source, "f", {"0"}) == "false");
+        }
+    }
+
+    GIVEN("An element of an array of booleans assigned an integer") {
+        auto source = "routine f(x : integer) : boolean is\n"
+                      "    var a : array [3] boolean\n"
+                      "    a[2] := x\n"
+                      "    return a[2]\n"
+                      "end\n";
+
+        THEN("Any integer but 0 is true") {
+            REQUIRE(testing::run(source, "f", {"512"}) == "true");
+            REQUIRE(testing::run(source, "f", {"0"}) == "false");
+        }
+    }
+
+    GIVEN("A field of a record assigned an integer") {
+        auto source = "type R is record\n"
+                      "    var n : integer\n"
+                      "    var b : boolean\n"
+                      "end\n"
+                      "routine f(x : integer) : boolean is\n"
+                      "    var r : R\n"
+                      "    r.b := x\n"
+                      "    return r.b\n"
+                      "end\n";
+
+        THEN("Any integer but 0 is true") {
+            REQUIRE(testing::run(source, "f", {"768"}) == "true");
+            REQUIRE(testing::run(source, "f", {"0"}) == "false");
+        }
+    }
+
+    GIVEN("A global boolean initialized with an integer") {
+        auto source = "var g : boolean is 256\n"
+                      "routine f() : boolean is\n"
+                      "    return g\n"
+                      "end\n";
+
+        THEN("Any integer but 0 is true") {
+            REQUIRE(testing::run(source, "f", {}) == "true");
+        }
+    }
+}
+
+SCENARIO("Results are formatted like executables print them",
+         "[code_generator]") {
+    GIVEN("A routine returning a real") {
+        auto source = "routine third(n : integer) : real is\n"
+                      "    return n / 3.0\n"
+                      "end\n";
+
+        THEN("It has six significant digits") {
+            REQUIRE(testing::run(source, "third", {"1"}) == "0.333333");
+            REQUIRE(testing::run(source, "third", {"3000000"}) == "1e+06");
+        }
+    }
+}
+
+SCENARIO("Arrays and records are generated", "[code_generator]") {
+    GIVEN("An array whose length is known at run time") {
+        auto source = "routine squares(n : integer) : array [n] integer is\n"
+                      "    var a : array [n] integer\n"
+                      "    for i in 1..n loop\n"
+                      "        a[i] := i * i\n"
+                      "    end\n"
+                      "    return a\n"
+                      "end\n"
+                      "routine sum(n : integer) : integer is\n"
+                      "    var s is 0\n"
+                      "    for i in 1..n loop\n"
+                      "        s := s + squares(n)[i]\n"
+                      "    end\n"
+                      "    return s\n"
+                      "end\n";
+
+        THEN("Its elements are returned to the caller") {
+            REQUIRE(testing::run(source, "sum", {"10"}) == "385");
+        }
+    }
+
+    GIVEN("Nested arrays of a static length") {
+        auto source = "type M is array [3] array [3] integer\n"
+                      "routine trace(n : integer) : integer is\n"
+                      "    var m : M\n"
+                      "    for i in 1..3 loop\n"
+                      "        for j in 1..3 loop\n"
+                      "            m[i][j] := i * j * n\n"
+                      "        end\n"
+                      "    end\n"
+                      "    var t : M\n"
+                      "    t := m\n"
+                      "    return t[1][1] + t[2][2] + t[3][3]\n"
+                      "end\n";
+
+        THEN("They are copied on assignment") {
+            REQUIRE(testing::run(source, "trace", {"2"}) == "28");
+        }
+    }
+
+    GIVEN("An array of records") {
+        auto source = "type P is record\n"
+                      "    var flag : boolean\n"
+                      "    var x : real\n"
+                      "    var n : integer\n"
+                      "end\n"
+                      "type Ps is array [4] P\n"
+                      "routine test(k : integer) : integer is\n"
+                      "    var ps : Ps\n"
+                      "    for i in 1..4 loop\n"
+                      "        ps[i].n := i * k\n"
+                      "        ps[i].flag := i % 2\n"
+                      "    end\n"
+                      "    var s is 0\n"
+                      "    for i in 1..4 loop\n"
+                      "        if ps[i].flag then\n"
+                      "            s := s + ps[i].n\n"
+                      "        end\n"
+                      "    end\n"
+                      "    return s\n"
+                      "end\n";
+
+        THEN("It is stored as records or as an array for every field") {
+            cg::TargetConfig soa;
+            soa.structOfArrays = true;
+            REQUIRE(testing::run(source, "test", {"3"}) == "12");
+            REQUIRE(testing::run(source, "test", {"3"}, soa) == "12");
+        }
+    }
+}
+
+SCENARIO("Modules generated in parallel report errors once",
+         "[code_generator]") {
+    GIVEN("A global array whose length is not known at compile time") {
+        auto source = "var n : integer\n"
+                      "var a : array [n] integer\n"
+                      "routine f() is end\n"
+                      "routine g() is end\n"
+                      "routine h() is end\n";
+
+        THEN("Its error is reported once for all the modules") {
+            cg::ParallelCodeGenerator codegen("test", {}, 3);
+            testing::generate(source, codegen);
+            REQUIRE(codegen.getParts().size() == 3);
+            auto errors = codegen.getErrors();
+            REQUIRE(errors.size() == 1);
+            REQUIRE(errors[0].message == "the length of a global array must "
+                                         "be known at compile time");
+        }
+    }
+}
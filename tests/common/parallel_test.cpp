@@ -0,0 +1,71 @@
+#include "catch2/catch.hpp"
+#include "parallel.hpp"
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+SCENARIO("Items are processed by several threads", "[common]") {
+    GIVEN("A single thread") {
+        std::vector<std::size_t> order;
+        common::parallelFor(5, 1, [&](std::size_t i) { order.push_back(i); });
+
+        THEN("The items are processed in order") {
+            REQUIRE(order == std::vector<std::size_t>{0, 1, 2, 3, 4});
+        }
+    }
+
+    GIVEN("More items than threads") {
+        std::vector<std::atomic<int>> visits(1000);
+        common::parallelFor(visits.size(), 4,
+                            [&](std::size_t i) { visits[i]++; });
+
+        THEN("Every item is processed exactly once") {
+            for (auto& count : visits) {
+                REQUIRE(count == 1);
+            }
+        }
+    }
+
+    GIVEN("More threads than items") {
+        std::vector<std::atomic<int>> visits(3);
+        common::parallelFor(visits.size(), 8,
+                            [&](std::size_t i) { visits[i]++; });
+
+        THEN("Every item is processed exactly once") {
+            for (auto& count : visits) {
+                REQUIRE(count == 1);
+            }
+        }
+    }
+
+    GIVEN("Calls made from inside another call") {
+        std::vector<std::atomic<int>> visits(64 * 64);
+        common::parallelFor(64, 4, [&](std::size_t outer) {
+            common::parallelFor(64, 4, [&](std::size_t inner) {
+                visits[outer * 64 + inner]++;
+            });
+        });
+
+        THEN("Every item is processed exactly once") {
+            for (auto& count : visits) {
+                REQUIRE(count == 1);
+            }
+        }
+    }
+
+    GIVEN("An item that throws") {
+        std::atomic<int> processed{0};
+        auto process = [&](std::size_t i) {
+            if (i == 10) {
+                throw std::runtime_error("item 10");
+            }
+            processed++;
+        };
+
+        THEN("The exception reaches the caller") {
+            REQUIRE_THROWS_AS(common::parallelFor(100, 4, process),
+                              std::runtime_error);
+            REQUIRE(processed < 100);
+        }
+    }
+}
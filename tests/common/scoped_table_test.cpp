@@ -0,0 +1,60 @@
+#include "catch2/catch.hpp"
+#include "scoped_table.hpp"
+#include <string>
+
+namespace testing {
+
+int lookup(const common::ScopedTable<int>& table, const std::string& name) {
+    auto value = table.find(name);
+    return value != nullptr ? *value : -1;
+}
+
+} // namespace testing
+
+SCENARIO("Names are looked up in nested scopes", "[common]") {
+    GIVEN("A table with a global declaration") {
+        common::ScopedTable<int> table;
+        table.declare("x", 1);
+
+        WHEN("An inner scope declares the same name") {
+            table.pushScope();
+            table.declare("x", 2);
+            table.declare("y", 3);
+
+            THEN("The inner declaration hides the outer one") {
+                REQUIRE(testing::lookup(table, "x") == 2);
+                REQUIRE(testing::lookup(table, "y") == 3);
+            }
+
+            AND_WHEN("The inner scope is left") {
+                table.popScope();
+
+                THEN("The outer declaration is visible again") {
+                    REQUIRE(testing::lookup(table, "x") == 1);
+                    REQUIRE(testing::lookup(table, "y") == -1);
+                }
+            }
+        }
+
+        WHEN("A table is nested in it") {
+            common::ScopedTable<int> inner(&table);
+            inner.pushScope();
+            inner.declare("y", 4);
+
+            THEN("Names it does not declare are found in the outer table") {
+                REQUIRE(testing::lookup(inner, "x") == 1);
+                REQUIRE(testing::lookup(inner, "y") == 4);
+                REQUIRE(testing::lookup(table, "y") == -1);
+            }
+
+            AND_WHEN("It hides an outer declaration") {
+                inner.declare("x", 5);
+                inner.popScope();
+
+                THEN("The outer declaration is visible again once it is left") {
+                    REQUIRE(testing::lookup(inner, "x") == 1);
+                }
+            }
+        }
+    }
+}
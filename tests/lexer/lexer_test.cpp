@@ -196,3 +196,39 @@ SCENARIO("Lexer is fed source code") {
         }
     }
 }
+
+SCENARIO("Token types are collected into a set") {
+    using lexer::TokenSet;
+    using lexer::TokenType;
+
+    GIVEN("A set built at compile time") {
+        constexpr TokenSet set{TokenType::End, TokenType::Comma,
+                               TokenType::End};
+        static_assert(set.Contains(TokenType::Comma));
+        static_assert(set.Size() == 2);
+
+        THEN("It contains only the given types") {
+            REQUIRE(set.Contains(TokenType::End));
+            REQUIRE(set.Contains(TokenType::Comma));
+            REQUIRE_FALSE(set.Contains(TokenType::Illegal));
+            REQUIRE_FALSE(set.Contains(TokenType::Return));
+        }
+
+        THEN("Types are listed in the order of declaration") {
+            REQUIRE(lexer::to_string(set) == "',' or 'end'");
+            REQUIRE(lexer::to_string(set | TokenType::Illegal |
+                                     TokenType::Return) ==
+                    "illegal token, ',', 'end', or 'return'");
+        }
+    }
+
+    GIVEN("An empty set") {
+        TokenSet set;
+
+        THEN("It has no types") {
+            REQUIRE(set.Empty());
+            REQUIRE(set.Types().empty());
+            REQUIRE(lexer::to_string(set).empty());
+        }
+    }
+}
@@ -94,6 +94,50 @@ SCENARIO("Parser builds a tree from tokens") {
             }
         }
 
+        WHEN("Tokens are given as a pre-lexed buffer for 'x[1] * 2'") {
+            using lexer::TokenType;
+            std::vector<lexer::Token> tokens{
+                {TokenType::Identifier, {1, 1}, "x"},
+                {TokenType::OpenBrack, {1, 2}, "["},
+                {TokenType::Int, {1, 3}, "1"},
+                {TokenType::CloseBrack, {1, 4}, "]"},
+                {TokenType::Mul, {1, 6}, "*"},
+                {TokenType::Int, {1, 8}, "2"},
+            };
+
+            THEN("The missing end of file is implied and it is parsed") {
+                parser::Parser parser(tokens);
+                auto tree = parser.parseExpression();
+
+                REQUIRE(parser.getErrors().empty());
+                auto rootNode =
+                    std::dynamic_pointer_cast<ast::BinaryExpression>(tree);
+                REQUIRE(rootNode != nullptr);
+                REQUIRE(rootNode->operation == TokenType::Mul);
+                REQUIRE(rootNode->end == lexer::Token::Position{1, 8});
+
+                auto index = std::dynamic_pointer_cast<ast::BinaryExpression>(
+                    rootNode->operand1);
+                REQUIRE(index != nullptr);
+                REQUIRE(index->operation == TokenType::OpenBrack);
+            }
+        }
+
+        WHEN("Tokens represent 'return a not b' in a routine") {
+            lexer::Lexer lx{"routine f(a : integer, b : boolean) : boolean "
+                            "is\nreturn a not b\nend"};
+
+            THEN("'not' is not taken for a binary operator") {
+                parser::Parser parser(lx);
+                auto tree = parser.parseRoutineDecl();
+                auto errors = parser.getErrors();
+
+                REQUIRE(!errors.empty());
+                REQUIRE(errors[0].message ==
+                        "expected semicolon or new line, got 'not'");
+            }
+        }
+
         WHEN("Tokens represent a routine") {
             lexer::Lexer lx{"routine main(num : integer) : integer is\nvar a "
                             "is 1;\nreturn a;\nend"};
@@ -565,5 +609,169 @@ SCENARIO("Parser builds a tree from tokens") {
                 auto tree = parser.parseProgram();
             }
         }
+
+        WHEN("A program with several routines is parsed in parallel") {
+            std::string code = "var n : integer\n"
+                               "routine f(x : integer) : integer is\n"
+                               "if x > 0 then\nreturn x\nend\nreturn 0\n"
+                               "end\n"
+                               "type r is record\nvar a : integer\nend\n"
+                               "routine g() is\nvar y is 1 +* 2\nend\n"
+                               "routine h() is\nwhile 1 loop\nend\nend\n";
+
+            parser::Parser sequential(lexer::Lexer{code});
+            auto expected = sequential.parseProgram();
+
+            parser::Parser parallel(lexer::Lexer{code});
+            auto tree = parallel.parseProgramParallel(4);
+
+            THEN("The result matches the sequential parse") {
+                REQUIRE(tree->routines.size() == expected->routines.size());
+                for (size_t i = 0; i < tree->routines.size(); i++) {
+                    REQUIRE(tree->routines[i]->name ==
+                            expected->routines[i]->name);
+                    REQUIRE(tree->routines[i]->begin ==
+                            expected->routines[i]->begin);
+                    REQUIRE(tree->routines[i]->end ==
+                            expected->routines[i]->end);
+                }
+                REQUIRE(tree->variables.size() == expected->variables.size());
+                REQUIRE(tree->types.size() == expected->types.size());
+                REQUIRE(tree->begin == expected->begin);
+                REQUIRE(tree->end == expected->end);
+
+                auto errors = parallel.getErrors();
+                auto expectedErrors = sequential.getErrors();
+                REQUIRE(!errors.empty());
+                REQUIRE(errors.size() == expectedErrors.size());
+                for (size_t i = 0; i < errors.size(); i++) {
+                    REQUIRE(errors[i].pos == expectedErrors[i].pos);
+                    REQUIRE(errors[i].message == expectedErrors[i].message);
+                }
+            }
+        }
+
+        WHEN("Routine bodies are parsed lazily") {
+            lexer::Lexer lx{"routine f() is\nvar a is 1\nwhile a loop\nend\n"
+                            "end\nroutine g() is\nvar b is 1 +* 2\nend\n"};
+            parser::Parser parser(lx);
+            parser.setLazyBodies();
+            auto tree = parser.parseProgram();
+
+            THEN("Only the signatures are parsed upfront") {
+                REQUIRE(parser.getErrors().empty());
+                REQUIRE(tree->routines.size() == 2);
+                REQUIRE(tree->routines[0]->body == nullptr);
+                REQUIRE(tree->routines[0]->end == lexer::Token::Position{5, 1});
+                REQUIRE(tree->routines[1]->body == nullptr);
+            }
+
+            THEN("A body is parsed when it is first accessed") {
+                auto body = tree->routines[0]->getBody();
+                REQUIRE(body != nullptr);
+                REQUIRE(body->variables.size() == 1);
+                REQUIRE(body->statements.size() == 1);
+                REQUIRE(body->end == lexer::Token::Position{5, 1});
+                REQUIRE(parser.getErrors().empty());
+            }
+
+            THEN("Errors in a body are reported once it is accessed") {
+                auto body = tree->routines[1]->getBody();
+                REQUIRE(body != nullptr);
+                REQUIRE(body->variables.empty());
+
+                auto errors = parser.getErrors();
+                REQUIRE(errors.size() == 1);
+                REQUIRE(errors[0].message == "expected unary operator");
+                REQUIRE(errors[0].pos == lexer::Token::Position{7, 13});
+            }
+        }
+    }
+}
+
+SCENARIO("Programs are reparsed incrementally") {
+    GIVEN("A program parsed by an incremental parser") {
+        std::string code = "var n : integer\n"
+                           "routine f(x : integer) : integer is\n"
+                           "return x + 1\n"
+                           "end\n"
+                           "routine g() is\n"
+                           "var y is 2\n"
+                           "end\n"
+                           "routine h() is\n"
+                           "n := 3\n"
+                           "end\n";
+
+        parser::IncrementalParser parser;
+        auto before = parser.parse(code);
+        REQUIRE(parser.getErrors().empty());
+        REQUIRE(before->routines.size() == 3);
+
+        auto requireSameAsFullParse = [](std::shared_ptr<ast::Program> tree,
+                                         const std::string& code) {
+            parser::Parser full(lexer::Lexer{code});
+            auto expected = full.parseProgram();
+
+            REQUIRE(tree->begin == expected->begin);
+            REQUIRE(tree->end == expected->end);
+            REQUIRE(tree->variables.size() == expected->variables.size());
+            REQUIRE(tree->routines.size() == expected->routines.size());
+            for (size_t i = 0; i < tree->routines.size(); i++) {
+                auto routine = tree->routines[i];
+                auto expectedRoutine = expected->routines[i];
+                REQUIRE(routine->name == expectedRoutine->name);
+                REQUIRE(routine->begin == expectedRoutine->begin);
+                REQUIRE(routine->end == expectedRoutine->end);
+                REQUIRE(routine->body->begin == expectedRoutine->body->begin);
+                REQUIRE(routine->body->end == expectedRoutine->body->end);
+            }
+        };
+
+        WHEN("A routine is edited without adding lines") {
+            code.replace(code.find("var y is 2"), 10, "var y is 42");
+            auto after = parser.parse(code);
+
+            THEN("Only that routine is parsed again") {
+                REQUIRE(parser.getErrors().empty());
+                REQUIRE(after->variables[0] == before->variables[0]);
+                REQUIRE(after->routines[0] == before->routines[0]);
+                REQUIRE(after->routines[1] != before->routines[1]);
+                REQUIRE(after->routines[2] == before->routines[2]);
+                requireSameAsFullParse(after, code);
+            }
+        }
+
+        WHEN("A line is added to a routine") {
+            code.insert(code.find("var y is 2"), "var z is 1\n");
+            auto after = parser.parse(code);
+
+            THEN("The routines below it are reused and moved down") {
+                REQUIRE(parser.getErrors().empty());
+                REQUIRE(after->routines[0] == before->routines[0]);
+                REQUIRE(after->routines[2] == before->routines[2]);
+                REQUIRE(after->routines[2]->begin ==
+                        lexer::Token::Position{9, 1});
+                requireSameAsFullParse(after, code);
+            }
+        }
+
+        WHEN("An edit breaks a routine") {
+            code.replace(code.find("x + 1"), 5, "x +");
+            auto after = parser.parse(code);
+
+            THEN("The errors are those of a full parse") {
+                parser::Parser full(lexer::Lexer{code});
+                full.parseProgram();
+                auto errors = parser.getErrors();
+                auto expectedErrors = full.getErrors();
+
+                REQUIRE(!errors.empty());
+                REQUIRE(errors.size() == expectedErrors.size());
+                for (size_t i = 0; i < errors.size(); i++) {
+                    REQUIRE(errors[i].pos == expectedErrors[i].pos);
+                    REQUIRE(errors[i].message == expectedErrors[i].message);
+                }
+            }
+        }
     }
 }
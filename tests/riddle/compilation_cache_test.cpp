@@ -0,0 +1,60 @@
+#include "catch2/catch.hpp"
+#include "compilation_cache.hpp"
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wconversion"
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#pragma GCC diagnostic pop
+#include <fstream>
+#include <iterator>
+#include <string>
+
+namespace fs = llvm::sys::fs;
+
+namespace testing {
+
+std::string read(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    return {std::istreambuf_iterator<char>(file),
+            std::istreambuf_iterator<char>()};
+}
+
+} // namespace testing
+
+SCENARIO("Compiled programs are cached on disk", "[riddle]") {
+    llvm::SmallString<128> sandbox;
+    REQUIRE(!fs::createUniqueDirectory("riddle-cache-test", sandbox));
+    std::string root(sandbox.str());
+    std::ofstream(root + "/program.o", std::ios::binary) << "object code";
+
+    GIVEN("A cache in a directory relative to the working directory") {
+        llvm::SmallString<128> workingDirectory;
+        REQUIRE(!fs::current_path(workingDirectory));
+        REQUIRE(!fs::set_current_path(root));
+        CompilationCache cache("cache");
+        auto key = cache.key("routine f() is end", "-O0");
+        bool stored = cache.store(key, "program.o");
+        bool fetched = cache.fetch(key, "fetched.o");
+        REQUIRE(!fs::set_current_path(workingDirectory));
+
+        THEN("A stored entry is fetched again") {
+            REQUIRE(stored);
+            REQUIRE(fetched);
+            REQUIRE(cache.hits() == 1);
+            REQUIRE(testing::read(root + "/fetched.o") == "object code");
+            REQUIRE(fs::is_directory(root + "/cache/" + key));
+        }
+    }
+
+    GIVEN("An empty cache") {
+        CompilationCache cache(root + "/empty");
+
+        THEN("Nothing is fetched") {
+            REQUIRE(!cache.fetch(cache.key("", ""), root + "/fetched.o"));
+            REQUIRE(cache.misses() == 1);
+        }
+    }
+
+    fs::remove_directories(root);
+}
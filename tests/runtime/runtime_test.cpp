@@ -0,0 +1,122 @@
+#include "catch2/catch.hpp"
+#include "runtime.h"
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Arguments of the last call through an entry below
+std::vector<std::string> called;
+
+int32_t record(const char* const* args) {
+    called.assign(args, args + 2);
+    return 0;
+}
+
+int32_t fail(const char* const*) { return 7; }
+
+} // namespace
+
+SCENARIO("Arguments are parsed in place", "[runtime]") {
+    GIVEN("Integers") {
+        int64_t value = 0;
+
+        THEN("Whole numbers of either sign parse") {
+            REQUIRE(riddle_parse_integer("42", &value) == 0);
+            REQUIRE(value == 42);
+            REQUIRE(riddle_parse_integer("-9223372036854775808", &value) ==
+                    0);
+            REQUIRE(value == INT64_MIN);
+        }
+
+        THEN("Anything else is rejected") {
+            REQUIRE(riddle_parse_integer("", &value) != 0);
+            REQUIRE(riddle_parse_integer("12x", &value) != 0);
+            REQUIRE(riddle_parse_integer("1.5", &value) != 0);
+            REQUIRE(riddle_parse_integer("99999999999999999999", &value) !=
+                    0);
+        }
+    }
+
+    GIVEN("Reals") {
+        double value = 0;
+
+        THEN("Decimal and exponent forms parse") {
+            REQUIRE(riddle_parse_real("1.5", &value) == 0);
+            REQUIRE(value == 1.5);
+            REQUIRE(riddle_parse_real("-2e3", &value) == 0);
+            REQUIRE(value == -2000);
+        }
+
+        THEN("Trailing characters are rejected") {
+            REQUIRE(riddle_parse_real("1.5.", &value) != 0);
+            REQUIRE(riddle_parse_real("", &value) != 0);
+        }
+    }
+
+    GIVEN("Booleans") {
+        uint8_t value = 2;
+
+        THEN("Only true and false parse") {
+            REQUIRE(riddle_parse_boolean("true", &value) == 0);
+            REQUIRE(value == 1);
+            REQUIRE(riddle_parse_boolean("false", &value) == 0);
+            REQUIRE(value == 0);
+            REQUIRE(riddle_parse_boolean("1", &value) != 0);
+            REQUIRE(riddle_parse_boolean("True", &value) != 0);
+        }
+    }
+}
+
+SCENARIO("Routines are dispatched by name", "[runtime]") {
+    GIVEN("A table of routines sorted by hash") {
+        std::vector<riddle_routine> routines{
+            {riddle_hash("sum"), "sum", 2, record},
+            {riddle_hash("broken"), "broken", 0, fail},
+            {riddle_hash("other"), "other", 2, record},
+        };
+        std::sort(routines.begin(), routines.end(),
+                  [](auto& a, auto& b) { return a.hash < b.hash; });
+        called.clear();
+
+        WHEN("A routine is named with the right number of arguments") {
+            const char* argv[] = {"program", "sum", "1", "2"};
+            auto status = riddle_main(4, argv, routines.data(), 3);
+
+            THEN("It is called with the rest of the arguments") {
+                REQUIRE(status == 0);
+                REQUIRE(called == std::vector<std::string>{"1", "2"});
+            }
+        }
+
+        WHEN("The routine fails") {
+            const char* argv[] = {"program", "broken"};
+
+            THEN("Its status is returned") {
+                REQUIRE(riddle_main(2, argv, routines.data(), 3) == 7);
+            }
+        }
+
+        WHEN("The call is wrong") {
+            const char* noRoutine[] = {"program"};
+            const char* unknown[] = {"program", "product", "1", "2"};
+            const char* arity[] = {"program", "sum", "1"};
+
+            THEN("Nothing is called and the status tells why") {
+                REQUIRE(riddle_main(1, noRoutine, routines.data(), 3) == 1);
+                REQUIRE(riddle_main(4, unknown, routines.data(), 3) == 1);
+                REQUIRE(riddle_main(3, arity, routines.data(), 3) == 2);
+                REQUIRE(called.empty());
+            }
+        }
+    }
+
+    GIVEN("Names") {
+        THEN("They are hashed with 64-bit FNV-1a") {
+            REQUIRE(riddle_hash("") == 0xcbf29ce484222325u);
+            REQUIRE(riddle_hash("a") == 0xaf63dc4c8601ec8cu);
+        }
+    }
+}
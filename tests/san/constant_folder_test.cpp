@@ -0,0 +1,127 @@
+#include "catch2/catch.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "san.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace testing {
+
+/** Parses, analyses and folds `source`, returning the folder's errors */
+std::vector<ast::Error> fold(const std::string& source,
+                             ast::sPtr<ast::Program>& program) {
+    parser::Parser parser(lexer::Lexer{source});
+    program = parser.parseProgram();
+    REQUIRE(parser.getErrors().empty());
+
+    san::IdentifierResolver resolver;
+    program->accept(resolver);
+    REQUIRE(resolver.getErrors().empty());
+    san::TypeDeriver deriver;
+    program->accept(deriver);
+    REQUIRE(deriver.getErrors().empty());
+
+    san::ConstantFolder folder;
+    program->accept(folder);
+    return folder.takeErrors();
+}
+
+ast::sPtr<ast::Expression> returned(const ast::sPtr<ast::Program>& program,
+                                    std::size_t statement = 0) {
+    auto body = program->routines[0]->getBody();
+    auto ret = std::dynamic_pointer_cast<ast::ReturnStatement>(
+        body->statements.at(statement));
+    REQUIRE(ret != nullptr);
+    return ret->expression;
+}
+
+} // namespace testing
+
+SCENARIO("Constant expressions are folded to literals", "[san]") {
+    ast::sPtr<ast::Program> program;
+
+    GIVEN("Integer arithmetic") {
+        auto errors = testing::fold("routine main() : integer is\n"
+                                    "    return -(2 + 3 * 4) / 5 % 3\n"
+                                    "end\n",
+                                    program);
+
+        THEN("It is evaluated with truncating division") {
+            REQUIRE(errors.empty());
+            auto literal = std::dynamic_pointer_cast<ast::IntegerLiteral>(
+                testing::returned(program));
+            REQUIRE(literal != nullptr);
+            REQUIRE(static_cast<int64_t>(literal->value) == -2);
+        }
+    }
+
+    GIVEN("Mixed integer and real operands") {
+        testing::fold("routine main() : real is\n"
+                      "    return 1 + 0.5\n"
+                      "end\n",
+                      program);
+
+        THEN("The result is real") {
+            auto literal = std::dynamic_pointer_cast<ast::RealLiteral>(
+                testing::returned(program));
+            REQUIRE(literal != nullptr);
+            REQUIRE(literal->value == 1.5);
+        }
+    }
+
+    GIVEN("A comparison of constants") {
+        testing::fold("routine main() : boolean is\n"
+                      "    return 3 < 4 and not false\n"
+                      "end\n",
+                      program);
+
+        THEN("It is folded to a boolean") {
+            auto literal = std::dynamic_pointer_cast<ast::BooleanLiteral>(
+                testing::returned(program));
+            REQUIRE(literal != nullptr);
+            REQUIRE(literal->value);
+        }
+    }
+
+    GIVEN("Globals initialised with constants") {
+        testing::fold("var size : integer is 4\n"
+                      "var counter : integer is 0\n"
+                      "routine main() : integer is\n"
+                      "    var row : array [size + 3] real\n"
+                      "    counter := counter + 1\n"
+                      "    return size * 2 + counter\n"
+                      "end\n",
+                      program);
+
+        THEN("Only those never assigned to are constant") {
+            auto array = std::dynamic_pointer_cast<ast::ArrayType>(
+                program->routines[0]->getBody()->variables[0]->type);
+            REQUIRE(array != nullptr);
+            REQUIRE(array->staticLength == 7u);
+
+            auto sum = std::dynamic_pointer_cast<ast::BinaryExpression>(
+                testing::returned(program, 1));
+            REQUIRE(sum != nullptr);
+            auto product =
+                std::dynamic_pointer_cast<ast::IntegerLiteral>(sum->operand1);
+            REQUIRE(product != nullptr);
+            REQUIRE(product->value == 8);
+            REQUIRE(std::dynamic_pointer_cast<ast::Identifier>(
+                        sum->operand2) != nullptr);
+        }
+    }
+
+    GIVEN("An integer division by a constant zero") {
+        auto errors = testing::fold("routine main(a : integer) : integer is\n"
+                                    "    return a / (2 - 2)\n"
+                                    "end\n",
+                                    program);
+
+        THEN("It is reported") {
+            REQUIRE(errors.size() == 1);
+            REQUIRE(errors[0].message == "division by zero");
+            REQUIRE(errors[0].pos.line == 2);
+        }
+    }
+}
@@ -0,0 +1,175 @@
+#include "catch2/catch.hpp"
+#include "catch_helpers.hpp"
+#include "san.hpp"
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using san::PassManager;
+
+namespace testing {
+
+/** Builds passes that log their names when they run */
+class PassLog {
+public:
+    PassManager::Pass pass(std::string name, unsigned required = 0,
+                           unsigned provided = 0, bool fails = false) {
+        return {
+            .name = name,
+            .required = required,
+            .provided = provided,
+            .run =
+                [this, name, fails](ast::Program&) {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_ran.push_back(name);
+                    std::vector<ast::Error> errors;
+                    if (fails) {
+                        errors.push_back({.pos = {1, 1}, .message = name});
+                    }
+                    return errors;
+                },
+        };
+    }
+
+    const std::vector<std::string>& ran() const { return m_ran; }
+
+private:
+    std::mutex m_mutex;
+    std::vector<std::string> m_ran;
+};
+
+} // namespace testing
+
+SCENARIO("Passes are scheduled by the analyses they need", "[san]") {
+    ast::Program program;
+    testing::PassLog log;
+    PassManager passes;
+
+    GIVEN("A pass that needs an analysis nothing provides") {
+        THEN("It is rejected") {
+            REQUIRE_THROWS_AS(
+                passes.add(log.pass("types", PassManager::ExpressionTypes)),
+                std::logic_error);
+        }
+    }
+
+    GIVEN("A pass that needs an analysis an earlier pass invalidates") {
+        passes.add(log.pass("resolve", 0, PassManager::ResolvedIdentifiers));
+        auto transform = log.pass("transform");
+        transform.preserved = 0;
+        passes.add(transform);
+
+        THEN("It is rejected") {
+            REQUIRE_THROWS_AS(
+                passes.add(log.pass("check", PassManager::ResolvedIdentifiers)),
+                std::logic_error);
+        }
+    }
+
+    GIVEN("A chain of passes and a single job") {
+        passes.add(log.pass("resolve", 0, PassManager::ResolvedIdentifiers));
+        passes.add(log.pass("checks", PassManager::ResolvedIdentifiers,
+                            PassManager::CallTypes));
+        passes.add(log.pass("structure", PassManager::ResolvedIdentifiers));
+        passes.add(log.pass("types", PassManager::CallTypes,
+                            PassManager::ExpressionTypes));
+
+        WHEN("They all succeed") {
+            bool ok = passes.run(program);
+
+            THEN("They run in the order they were added") {
+                REQUIRE(ok);
+                REQUIRE(log.ran() == std::vector<std::string>{
+                                         "resolve", "checks", "structure",
+                                         "types"});
+                for (auto& result : passes.getResults()) {
+                    REQUIRE(result.ran);
+                    REQUIRE(result.errors.empty());
+                }
+            }
+        }
+    }
+
+    GIVEN("A pass that fails") {
+        passes.add(log.pass("resolve", 0, PassManager::ResolvedIdentifiers));
+        passes.add(log.pass("checks", PassManager::ResolvedIdentifiers,
+                            PassManager::CallTypes, true));
+        passes.add(log.pass("structure", PassManager::ResolvedIdentifiers));
+        passes.add(log.pass("types", PassManager::CallTypes,
+                            PassManager::ExpressionTypes));
+
+        WHEN("Running in fail-fast mode") {
+            bool ok = passes.run(program);
+
+            THEN("Nothing runs after it") {
+                REQUIRE_FALSE(ok);
+                REQUIRE(log.ran() ==
+                        std::vector<std::string>{"resolve", "checks"});
+                REQUIRE(passes.getResults()[1].errors.size() == 1);
+                REQUIRE_FALSE(passes.getResults()[2].ran);
+            }
+        }
+
+        WHEN("Collecting all errors") {
+            passes.setFailFast(false);
+            bool ok = passes.run(program);
+
+            THEN("Only the passes that need its analyses are skipped") {
+                REQUIRE_FALSE(ok);
+                REQUIRE(log.ran() == std::vector<std::string>{
+                                         "resolve", "checks", "structure"});
+                REQUIRE(passes.getResults()[2].ran);
+                REQUIRE_FALSE(passes.getResults()[3].ran);
+            }
+        }
+    }
+
+    GIVEN("Two independent passes and two jobs") {
+        std::atomic<int> started{0};
+        // Each pass waits for the other one to start
+        auto meet = [&](ast::Program&) {
+            started++;
+            auto deadline =
+                std::chrono::steady_clock::now() + std::chrono::seconds(10);
+            while (started < 2 && std::chrono::steady_clock::now() < deadline) {
+                std::this_thread::yield();
+            }
+            std::vector<ast::Error> errors;
+            if (started < 2) {
+                errors.push_back({.pos = {1, 1}, .message = "ran alone"});
+            }
+            return errors;
+        };
+        passes.add(log.pass("resolve", 0, PassManager::ResolvedIdentifiers));
+        passes.add({.name = "a",
+                    .required = PassManager::ResolvedIdentifiers,
+                    .run = meet});
+        passes.add({.name = "b",
+                    .required = PassManager::ResolvedIdentifiers,
+                    .run = meet});
+        passes.setJobs(2);
+
+        THEN("They run at the same time") { REQUIRE(passes.run(program)); }
+    }
+
+    GIVEN("An allocation counter") {
+        static std::size_t allocations = 0;
+        passes.setAllocationCounter([] { return allocations; });
+        passes.add({.name = "allocates",
+                    .run =
+                        [](ast::Program&) {
+                            allocations += 3;
+                            return std::vector<ast::Error>{};
+                        }});
+
+        THEN("The allocations of every pass are reported") {
+            REQUIRE(passes.run(program));
+            REQUIRE(passes.getResults()[0].allocations == 3);
+            REQUIRE(passes.timeReport().find("allocates") != std::string::npos);
+        }
+    }
+}
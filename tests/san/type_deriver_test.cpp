@@ -0,0 +1,127 @@
+#include "catch2/catch.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "san.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace testing {
+
+/** Parses, resolves and derives the types of `source`, returning the errors */
+std::vector<ast::Error> derive(const std::string& source,
+                               ast::sPtr<ast::Program>& program) {
+    parser::Parser parser(lexer::Lexer{source});
+    program = parser.parseProgram();
+    REQUIRE(parser.getErrors().empty());
+
+    san::IdentifierResolver resolver;
+    program->accept(resolver);
+    REQUIRE(resolver.getErrors().empty());
+
+    san::TypeDeriver deriver;
+    program->accept(deriver);
+    return deriver.takeErrors();
+}
+
+ast::sPtr<ast::Type> returnedType(const ast::sPtr<ast::Program>& program) {
+    auto body = program->routines[0]->getBody();
+    auto ret = std::dynamic_pointer_cast<ast::ReturnStatement>(
+        body->statements.back());
+    REQUIRE(ret != nullptr);
+    REQUIRE(ret->expression->type != nullptr);
+    return ret->expression->type;
+}
+
+} // namespace testing
+
+SCENARIO("Types of accesses are derived from the accessed type", "[san]") {
+    ast::sPtr<ast::Program> program;
+
+    GIVEN("An element of a nested array of aliased types") {
+        auto errors = testing::derive("type Row is array [4] real\n"
+                                      "type Matrix is array [4] Row\n"
+                                      "routine main() : real is\n"
+                                      "    var m : Matrix\n"
+                                      "    m[1][2] := 0.5\n"
+                                      "    return m[1][2]\n"
+                                      "end\n",
+                                      program);
+
+        THEN("It has the type of the innermost element") {
+            REQUIRE(errors.empty());
+            auto type = testing::returnedType(program);
+            REQUIRE(type->getTypeKind() == ast::TypeKind::Real);
+        }
+    }
+
+    GIVEN("A field of a record nested in a record") {
+        auto errors = testing::derive("type Point is record\n"
+                                      "    var x : integer\n"
+                                      "    var y : real\n"
+                                      "end\n"
+                                      "type Segment is record\n"
+                                      "    var from : Point\n"
+                                      "    var to : Point\n"
+                                      "end\n"
+                                      "routine main() : real is\n"
+                                      "    var s : Segment\n"
+                                      "    return s.to.y\n"
+                                      "end\n",
+                                      program);
+
+        THEN("It has the type of the field") {
+            REQUIRE(errors.empty());
+            auto type = testing::returnedType(program);
+            REQUIRE(type->getTypeKind() == ast::TypeKind::Real);
+        }
+
+        THEN("The fields of the records can be found by name") {
+            auto record = program->types[1]->type->asRecord();
+            REQUIRE(record != nullptr);
+            REQUIRE(record->findField("to") == record->fields[1]);
+            REQUIRE(record->findField("z") == nullptr);
+        }
+    }
+
+    GIVEN("An element of an array of records assigned a record") {
+        auto errors = testing::derive("type Point is record\n"
+                                      "    var x : integer\n"
+                                      "end\n"
+                                      "routine main() : integer is\n"
+                                      "    var points : array [2] Point\n"
+                                      "    var p : Point\n"
+                                      "    points[1] := p\n"
+                                      "    return points[1].x\n"
+                                      "end\n",
+                                      program);
+
+        THEN("The types are the same") {
+            REQUIRE(errors.empty());
+            auto type = testing::returnedType(program);
+            REQUIRE(type->getTypeKind() == ast::TypeKind::Integer);
+        }
+    }
+
+    GIVEN("Accesses that do not fit the accessed type") {
+        auto errors = testing::derive("type Point is record\n"
+                                      "    var x : integer\n"
+                                      "end\n"
+                                      "routine main() : integer is\n"
+                                      "    var p : Point\n"
+                                      "    var i : integer\n"
+                                      "    var a is p.z + 1\n"
+                                      "    return i[0] + i.x\n"
+                                      "end\n",
+                                      program);
+
+        THEN("Each is reported once without crashing the derivation") {
+            REQUIRE(errors.size() == 3);
+            REQUIRE(errors[0].message == "field name of record not found");
+            REQUIRE(errors[1].message ==
+                    "invalid operation [] on the given type");
+            REQUIRE(errors[2].message ==
+                    "invalid operation '.' on the given type");
+        }
+    }
+}